@@ -0,0 +1,473 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// A standalone benchmark for libebook: measures how long it takes to open a book, to parse
+// its table of contents and index, and to read every resource in it. Not installed; built with -DBUILD_BENCHMARK=ON.
+//
+//   ebookbench [--rounds N] [--threads N [--shared]] [--http PORT] <file.chm|file.epub>
+//
+// With --rounds, the book is opened and its resources are read N times; the fastest open is reported
+// along with the median and the slowest one.
+//
+// With --threads, the resources are read by N threads at once, each with its own ebook instance
+// like the viewer workers do, or all of them through one instance with --shared.
+//
+// With --http, it is a load generator for the viewer started as "uchmviewer -httpport PORT <file>":
+// every resource of the file is requested from the viewer over N keep-alive connections
+// (--threads, 1 by default), and the requests per second are reported. The viewer serves
+// 8 connections at once; with more, the idle ones are closed and reconnect, like real clients.
+//
+// Add "-platform offscreen" to run it without a display.
+
+#include <stdio.h>
+#include <algorithm>
+
+#include <QApplication>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QThreadPool>
+#include <QtAlgorithms>			// qDeleteAll
+#include <QUrl>
+#include <QVector>
+
+#include "ebook.h"
+
+
+static void usage()
+{
+	fprintf( stderr, "Usage: ebookbench [--rounds N] [--threads N [--shared]] [--http PORT] <file>\n" );
+}
+
+// Prints min/median/p95/max of the samples, in microseconds
+static void printLatency( const char * name, QVector<qint64> samples )
+{
+	if ( samples.isEmpty() )
+		return;
+
+	std::sort( samples.begin(), samples.end() );
+
+	printf( "%-12s %8d reads  min %7lld us  median %7lld us  p95 %7lld us  max %7lld us\n",
+			name,
+			samples.size(),
+			(long long) samples.first() / 1000,
+			(long long) samples[ samples.size() / 2 ] / 1000,
+			(long long) samples[ ( samples.size() * 95 ) / 100 ] / 1000,
+			(long long) samples.last() / 1000 );
+}
+
+// Reads every resource of the book, timing each read
+static int benchLatency( EBook * ebook, const QList<QUrl>& files, int rounds )
+{
+	QVector<qint64> samples;
+	qint64 bytes = 0;
+	QElapsedTimer total;
+
+	samples.reserve( files.size() * rounds );
+	total.start();
+
+	for ( int round = 0; round < rounds; round++ )
+	{
+		Q_FOREACH( const QUrl& url, files )
+		{
+			QByteArray data;
+			QElapsedTimer timer;
+			timer.start();
+
+			if ( !ebook->getFileContentAsBinary( data, url ) )
+			{
+				fprintf( stderr, "Cannot read %s\n", qPrintable( url.toString() ) );
+				continue;
+			}
+
+			samples.push_back( timer.nsecsElapsed() );
+			bytes += data.size();
+		}
+	}
+
+	qint64 elapsed = qMax( total.elapsed(), (qint64) 1 );
+
+	printLatency( "resource", samples );
+	printf( "%-12s %8lld KB in %lld ms, %lld KB/s\n",
+			"total",
+			(long long) bytes / 1024,
+			(long long) elapsed,
+			(long long) ( bytes / 1024 ) * 1000 / elapsed );
+	return 0;
+}
+
+// Reads the resources taken from the shared list until it is exhausted
+class ReadJob : public QRunnable
+{
+	public:
+		ReadJob( EBook * ebook, const QList<QUrl>& files, int rounds, QMutex * lock, int * next, QVector<qint64> * samples, qint64 * bytes )
+			: m_ebook( ebook ), m_files( files ), m_rounds( rounds ), m_lock( lock ), m_next( next ), m_samples( samples ), m_bytes( bytes )
+		{
+		}
+
+		void run()
+		{
+			QVector<qint64> samples;
+			qint64 bytes = 0;
+
+			while ( true )
+			{
+				int index;
+
+				{
+					QMutexLocker locker( m_lock );
+
+					if ( *m_next >= m_files.size() * m_rounds )
+						break;
+
+					index = (*m_next)++ % m_files.size();
+				}
+
+				QByteArray data;
+				QElapsedTimer timer;
+				timer.start();
+
+				if ( m_ebook->getFileContentAsBinary( data, m_files[index] ) )
+				{
+					samples.push_back( timer.nsecsElapsed() );
+					bytes += data.size();
+				}
+			}
+
+			QMutexLocker locker( m_lock );
+			*m_samples += samples;
+			*m_bytes += bytes;
+		}
+
+	private:
+		EBook				*	m_ebook;
+		const QList<QUrl>&		m_files;
+		int						m_rounds;
+		QMutex				*	m_lock;
+		int					*	m_next;
+		QVector<qint64>		*	m_samples;
+		qint64				*	m_bytes;
+};
+
+// Reads every resource of the book with several threads at once
+static int benchParallel( EBook * ebook, const QString& filename, const QList<QUrl>& files, int rounds, int threads, bool shared )
+{
+	QList<EBook *> readers;
+
+	for ( int i = 0; i < threads; i++ )
+	{
+		EBook * reader = shared ? ebook : EBook::loadFile( filename );
+
+		if ( !reader )
+		{
+			fprintf( stderr, "Cannot open %s\n", qPrintable( filename ) );
+			return 1;
+		}
+
+		if ( reader != ebook )
+			readers.push_back( reader );
+	}
+
+	QThreadPool pool;
+	QMutex lock;
+	QVector<qint64> samples;
+	qint64 bytes = 0;
+	int next = 0;
+	QElapsedTimer total;
+
+	pool.setMaxThreadCount( threads );
+	total.start();
+
+	for ( int i = 0; i < threads; i++ )
+		pool.start( new ReadJob( shared ? ebook : readers[i], files, rounds, &lock, &next, &samples, &bytes ) );
+
+	pool.waitForDone();
+
+	qint64 elapsed = qMax( total.elapsed(), (qint64) 1 );
+
+	printLatency( shared ? "shared" : "per-thread", samples );
+	printf( "%-12s %8lld KB in %lld ms, %lld KB/s with %d threads\n",
+			"total",
+			(long long) bytes / 1024,
+			(long long) elapsed,
+			(long long) ( bytes / 1024 ) * 1000 / elapsed,
+			threads );
+
+	qDeleteAll( readers );
+	return 0;
+}
+
+// How long the server may take to answer
+static const int HTTP_TIMEOUT = 30000;
+
+// Requests the resources taken from the shared list over a single keep-alive connection
+class HttpJob : public QRunnable
+{
+	public:
+		HttpJob( quint16 port, const QList<QUrl>& files, int rounds, QMutex * lock, int * next, QVector<qint64> * samples, int * failed )
+			: m_port( port ), m_files( files ), m_rounds( rounds ), m_lock( lock ), m_next( next ), m_samples( samples ), m_failed( failed )
+		{
+		}
+
+		void run()
+		{
+			QVector<qint64> samples;
+			int failed = 0;
+			QTcpSocket socket;
+
+			while ( true )
+			{
+				int index;
+
+				{
+					QMutexLocker locker( m_lock );
+
+					if ( *m_next >= m_files.size() * m_rounds )
+						break;
+
+					index = (*m_next)++ % m_files.size();
+				}
+
+				// The server closes the connection after a number of requests
+				if ( socket.state() != QAbstractSocket::ConnectedState )
+				{
+					socket.abort();
+					socket.connectToHost( "127.0.0.1", m_port );
+
+					if ( !socket.waitForConnected( HTTP_TIMEOUT ) )
+					{
+						fprintf( stderr, "Cannot connect to port %d: %s\n", m_port, qPrintable( socket.errorString() ) );
+						failed++;
+						break;
+					}
+				}
+
+				QElapsedTimer timer;
+				timer.start();
+
+				if ( request( socket, m_files[index].toEncoded( QUrl::RemoveScheme | QUrl::RemoveAuthority | QUrl::RemoveFragment ) ) )
+					samples.push_back( timer.nsecsElapsed() );
+				else
+				{
+					failed++;
+					socket.abort();
+				}
+			}
+
+			QMutexLocker locker( m_lock );
+			*m_samples += samples;
+			*m_failed += failed;
+		}
+
+	private:
+		// Sends the request and reads the whole response; returns false if it is not 200
+		static bool request( QTcpSocket& socket, const QByteArray& path )
+		{
+			socket.write( "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n" );
+
+			QByteArray head;
+
+			while ( !head.endsWith( "\r\n\r\n" ) )
+			{
+				if ( !socket.canReadLine() && !socket.waitForReadyRead( HTTP_TIMEOUT ) )
+					return false;
+
+				head += socket.readLine();
+			}
+
+			int length = 0;
+			QList<QByteArray> lines = head.split( '\n' );
+
+			for ( int i = 1; i < lines.size(); i++ )
+			{
+				if ( lines[i].toLower().startsWith( "content-length:" ) )
+					length = lines[i].mid( 15 ).trimmed().toInt();
+			}
+
+			while ( length > 0 )
+			{
+				if ( socket.bytesAvailable() == 0 && !socket.waitForReadyRead( HTTP_TIMEOUT ) )
+					return false;
+
+				length -= socket.read( length ).size();
+			}
+
+			return head.startsWith( "HTTP/1.1 200" );
+		}
+
+		quint16					m_port;
+		const QList<QUrl>&		m_files;
+		int						m_rounds;
+		QMutex				*	m_lock;
+		int					*	m_next;
+		QVector<qint64>		*	m_samples;
+		int					*	m_failed;
+};
+
+// Requests every resource of the book from the viewer HTTP server
+static int benchHttp( quint16 port, const QList<QUrl>& files, int rounds, int connections )
+{
+	QThreadPool pool;
+	QMutex lock;
+	QVector<qint64> samples;
+	int failed = 0;
+	int next = 0;
+	QElapsedTimer total;
+
+	pool.setMaxThreadCount( connections );
+	total.start();
+
+	for ( int i = 0; i < connections; i++ )
+		pool.start( new HttpJob( port, files, rounds, &lock, &next, &samples, &failed ) );
+
+	pool.waitForDone();
+
+	qint64 elapsed = qMax( total.elapsed(), (qint64) 1 );
+
+	printLatency( "request", samples );
+	printf( "%-12s %8d requests in %lld ms, %lld requests/s with %d connections, %d failed\n",
+			"total",
+			samples.size(),
+			(long long) elapsed,
+			(long long) samples.size() * 1000 / elapsed,
+			connections,
+			failed );
+
+	return failed > 0 ? 1 : 0;
+}
+
+int main( int argc, char ** argv )
+{
+	// The libebook error reporting uses message boxes
+	QApplication app( argc, argv );
+	QStringList args = app.arguments().mid( 1 );
+	QString filename;
+	int rounds = 1;
+	int threads = 0;
+	bool shared = false;
+	int port = 0;
+
+	for ( int i = 0; i < args.size(); i++ )
+	{
+		if ( args[i] == "--rounds" && i + 1 < args.size() )
+			rounds = qMax( 1, args[ ++i ].toInt() );
+		else if ( args[i] == "--threads" && i + 1 < args.size() )
+			threads = qMax( 1, args[ ++i ].toInt() );
+		else if ( args[i] == "--shared" )
+			shared = true;
+		else if ( args[i] == "--http" && i + 1 < args.size() )
+			port = args[ ++i ].toInt();
+		else if ( !args[i].startsWith( "--" ) && filename.isEmpty() )
+			filename = args[i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	if ( filename.isEmpty() )
+	{
+		usage();
+		return 1;
+	}
+
+	// The open is repeated as many times as the reads, so a single slow open (a cold disk cache) does not skew it
+	QVector<qint64> opens;
+	QElapsedTimer timer;
+	EBook * ebook = 0;
+
+	for ( int round = 0; round < rounds; round++ )
+	{
+		delete ebook;
+		timer.start();
+
+		ebook = EBook::loadFile( filename );
+
+		if ( !ebook )
+		{
+			fprintf( stderr, "Cannot open %s\n", qPrintable( filename ) );
+			return 1;
+		}
+
+		opens.push_back( timer.elapsed() );
+	}
+
+	std::sort( opens.begin(), opens.end() );
+
+	if ( opens.size() > 1 )
+		printf( "%-12s %8lld ms  median %lld ms  max %lld ms over %d opens\n",
+				"open",
+				(long long) opens.first(),
+				(long long) opens[ opens.size() / 2 ],
+				(long long) opens.last(),
+				opens.size() );
+	else
+		printf( "%-12s %8lld ms\n", "open", (long long) opens.first() );
+
+	QList<QUrl> files;
+	timer.restart();
+
+	if ( !ebook->enumerateFiles( files ) )
+	{
+		fprintf( stderr, "Cannot enumerate the files in %s\n", qPrintable( filename ) );
+		delete ebook;
+		return 1;
+	}
+
+	printf( "%-12s %8lld ms, %d files\n", "enumerate", (long long) timer.elapsed(), files.size() );
+
+	if ( ebook->hasFeature( EBook::FEATURE_TOC ) )
+	{
+		QList< EBookTocEntry > toc;
+		timer.restart();
+
+		if ( ebook->getTableOfContents( toc ) )
+			printf( "%-12s %8lld ms, %d entries\n", "toc", (long long) timer.elapsed(), toc.size() );
+		else
+			fprintf( stderr, "Cannot parse the table of contents of %s\n", qPrintable( filename ) );
+	}
+
+	if ( ebook->hasFeature( EBook::FEATURE_INDEX ) )
+	{
+		QList< EBookIndexEntry > index;
+		timer.restart();
+
+		if ( ebook->getIndex( index ) )
+			printf( "%-12s %8lld ms, %d entries\n", "index", (long long) timer.elapsed(), index.size() );
+		else
+			fprintf( stderr, "Cannot parse the index of %s\n", qPrintable( filename ) );
+	}
+
+	int result;
+
+	if ( port > 0 )
+		result = benchHttp( port, files, rounds, qMax( threads, 1 ) );
+	else if ( threads > 0 )
+		result = benchParallel( ebook, filename, files, rounds, threads, shared );
+	else
+		result = benchLatency( ebook, files, rounds );
+
+	delete ebook;
+	return result;
+}
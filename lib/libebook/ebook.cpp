@@ -16,6 +16,9 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QByteArray>
+#include <QFile>
+#include <QIODevice>	// QIODevice::ReadOnly
 #include <QString>
 
 #include "ebook.h"		// EBook
@@ -34,13 +37,28 @@ EBook::~EBook()
 
 EBook * EBook::loadFile( const QString &archiveName )
 {
-	EBook_CHM * cbook = new EBook_CHM();
+	// The format is recognized by the file signature, so a file is not parsed as the wrong format
+	// first; the files with an unknown signature are tried as both formats.
+	QFile file( archiveName.startsWith( "file://" ) ? archiveName.mid( 7 ) : archiveName );
+	QByteArray signature;
 
-	if ( cbook->load( archiveName ) )
-		return cbook;
+	if ( file.open( QIODevice::ReadOnly ) )
+		signature = file.read( 4 );
 
-	delete cbook;
+	file.close();
 
+	if ( signature != "PK\x03\x04" )
+	{
+		EBook_CHM * cbook = new EBook_CHM();
+
+		if ( cbook->load( archiveName ) )
+			return cbook;
+
+		delete cbook;
+
+		if ( signature == "ITSF" )
+			return 0;
+	}
 
 	EBook_EPUB * ebook = new EBook_EPUB();
 
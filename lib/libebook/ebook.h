@@ -24,6 +24,7 @@
 #include <QUrl>
 
 class QByteArray;
+class QIODevice;
 
 
 //! Stores a single table of content entry
@@ -73,6 +74,8 @@ class EBookIndexEntry
 
 
 //! Universal ebook files processor supporting both CHM and EPUB. Abstract.
+//! The content retrieval functions (getFileContentAsString, getFileContentAsBinary, getFileContentAsStream)
+//! are thread-safe; everything else must be called from the thread which loaded the ebook.
 class EBook
 {
 	public:
@@ -92,8 +95,8 @@ class EBook
 		 * \param archiveName filename.
 		 * \return EBook object on success, NULL on failure.
 		 *
-		 * Loads a CHM or epub file. For CHM files it could internally load more than one file,
-		 * if files linked to this one are present locally (like MSDN).
+		 * Loads a CHM or epub file, recognized by its signature. For CHM files it could internally
+		 * load more than one file, if files linked to this one are present locally (like MSDN).
 		 * \ingroup init
 		 */
 		static EBook * loadFile( const QString& archiveName );
@@ -178,6 +181,20 @@ class EBook
 		 */
 		virtual bool getFileContentAsBinary( QByteArray& data, const QUrl& url ) const = 0;
 
+		/*!
+		 * \brief Opens the content from url in current ebook as a read-only stream.
+		 * \param url An URL in ebook file to retreive content from. Must be absolute.
+		 * \return The opened random-access device, or NULL if the url cannot be found. The caller owns the
+		 *         device and must delete it before the ebook is closed.
+		 *
+		 * Unlike getFileContentAsBinary() the content is decompressed in chunks while the device is read,
+		 * so large embedded objects (video, PDF) do not have to be kept in memory. The content is not encoded.
+		 *
+		 * \sa getFileContentAsBinary()
+		 * \ingroup dataretrieve
+		 */
+		virtual QIODevice * getFileContentAsStream( const QUrl& url ) const = 0;
+
 		/*!
 		 * \brief Obtains the list of all the files (URLs) in current ebook archive. This is used in search
 		 * and to dump the e-book content.
@@ -197,6 +214,14 @@ class EBook
 		 */
 		virtual QString		getTopicByUrl ( const QUrl& url ) = 0;
 
+		/*!
+		 * \brief Starts building the lookup tables used by getTopicByUrl() in a background thread,
+		 * so the first getTopicByUrl() call does not build them itself. Does nothing by default.
+		 *
+		 * \ingroup dataretrieve
+		 */
+		virtual void		prepareTopicLookup() {}
+
 		/*!
          * \brief Gets the current ebook encoding (set or autodetected) as qtcodec name. Must be implemented,
          * even if the book doesn't support change of encoding (then it should return a default encoding)
@@ -16,16 +16,24 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>	// std::lower_bound, std::stable_sort
 #include <cstddef>	// size_t
 #include <cstdio>	// fprintf
+#include <cstring>	// memcpy
 
 #include <QByteArray>
 #include <QFile>
+#include <QHash>		// qHash
+#include <QIODevice>
 #include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
 #include <QString>
 #include <Qt>			// CaseInsensitive
 #include <QtGlobal>		// qPrintable, qDebug, qFatal, qWarning
 #include <QTextCodec>
+#include <QThreadPool>
 #include <QVector>
 #include <QUrl>
 
@@ -35,6 +43,7 @@
 									// EBook_CHM, ParsedEntry
 #include "ebook_chm_encoding.h"		// Ebook_CHM_Encoding
 #include "helper_entitydecoder.h"	// HelperEntityDecoder
+#include "helper_sitemapparser.h"	// HelperSitemapParser
 
 
 // Big-enough buffer size for use with various routines.
@@ -44,12 +53,55 @@
 #define TOPICS_ENTRY_LEN 16
 #define URLTBL_ENTRY_LEN 12
 
+// $WWKeywordLinks/BTree header and listing block header sizes
+#define BTREE_HEADER_LEN 0x4C
+#define BTREE_BLOCK_HEADER_LEN 0x0C
+
 //#define DEBUGPARSER(A)	qDebug A
 #define DEBUGPARSER(A)
 
 const char * EBook_CHM::URL_SCHEME_CHM = "ms-its";
 
 
+// Returns the zero-terminated string at the offset of a raw table, never reading past the table end
+static inline QByteArray tableString( const QByteArray& table, unsigned int offset )
+{
+	if ( offset >= (unsigned int) table.size() )
+		return QByteArray();
+
+	const char * str = table.constData() + offset;
+	return QByteArray( str, qstrnlen( str, table.size() - offset ) );
+}
+
+// Normalizes a raw #URLSTR entry the same way pathToUrl() splits and decodes it,
+// so it could be compared with EBook_CHM::topicKey() without constructing QUrl.
+static QByteArray topicKeyFromRaw( const QByteArray& link )
+{
+	if ( link.startsWith( "http://" ) || link.startsWith( "https://" ) )
+		return link;
+
+	int off = link.indexOf( '#' );
+	QByteArray path = off != -1 ? link.left( off ) : link;
+
+	if ( !path.startsWith( '/' ) )
+		path.prepend( '/' );
+
+	QByteArray key = QByteArray::fromPercentEncoding( path );
+
+	if ( off != -1 )
+		key += '#' + QByteArray::fromPercentEncoding( link.mid( off + 1 ) );
+
+	// pathToUrl() reads the path as UTF-8, so the invalid sequences must be replaced the same way
+	for ( int i = 0; i < key.size(); i++ )
+	{
+		if ( (unsigned char) key[i] >= 0x80 )
+			return QString::fromUtf8( key ).toUtf8();
+	}
+
+	return key;
+}
+
+
 EBook_CHM::EBook_CHM()
     : EBook()
 {
@@ -59,10 +111,13 @@ EBook_CHM::EBook_CHM()
 
 	m_textCodec = 0;
 	m_textCodecForSpecialFiles = 0;
+	m_textCodecAsciiCompatible = true;
 	m_detectedLCID = 0;
 	m_currentEncoding = "UTF-8";
 	m_htmlEntityDecoder = 0;
 	m_lookupTablesValid = false;
+	m_topicsState = TOPICS_NOT_LOADED;
+	m_pendingTopicsReady = false;
 }
 
 EBook_CHM::~EBook_CHM()
@@ -75,6 +130,10 @@ void EBook_CHM::close()
 	if ( m_chmFile == NULL )
 		return;
 
+	// The background build reads the file
+	if ( m_topicsState == TOPICS_LOADING )
+		finishTopicLookup();
+
 	chm_close( m_chmFile );
 
 	m_chmFile = NULL;
@@ -86,9 +145,12 @@ void EBook_CHM::close()
 
 	m_textCodec = 0;
 	m_textCodecForSpecialFiles = 0;
+	m_textCodecAsciiCompatible = true;
 	m_detectedLCID = 0;
 	m_currentEncoding = "UTF-8";
 	m_lookupTablesValid = false;
+	m_topicsState = TOPICS_NOT_LOADED;
+	m_topics = TopicTable();
 }
 
 QString EBook_CHM::title() const
@@ -156,6 +218,9 @@ bool EBook_CHM::getTableOfContents( QList<EBookTocEntry> &toc ) const
 
 bool EBook_CHM::getIndex(QList<EBookIndexEntry> &index) const
 {
+	if ( parseBinaryIndex( index ) )
+		return true;
+
 	// Parse the plain text index
 	QList< ParsedEntry > parsed;
 
@@ -196,12 +261,109 @@ bool EBook_CHM::getIndex(QList<EBookIndexEntry> &index) const
             entry.indent = e.indent - root_offset;
 
 		index.append( entry );
-        printf("%d: %s\n", entry.indent, qPrintable(entry.name));
 	}
 
 	return true;
 }
 
+// IANA MIB of UTF-8
+static const int MIB_UTF8 = 106;
+
+// Checks whether the data contains only 7-bit characters. Tests eight bytes at a time,
+// which the compiler is free to vectorize further.
+static bool isAsciiOnly( const char * data, int length )
+{
+	const char * end = data + length;
+
+	for ( ; end - data >= 8; data += 8 )
+	{
+		quint64 word;
+		memcpy( &word, data, sizeof(word) );
+
+		if ( word & Q_UINT64_C(0x8080808080808080) )
+			return false;
+	}
+
+	for ( ; data < end; data++ )
+	{
+		if ( *data & 0x80 )
+			return false;
+	}
+
+	return true;
+}
+
+// Checks whether the codec maps the 7-bit characters to the same Unicode code points
+static bool isAsciiCompatible( QTextCodec * codec )
+{
+	if ( !codec )
+		return true;
+
+	char ascii[ 127 ];
+
+	for ( int i = 0; i < 127; i++ )
+		ascii[i] = (char) (i + 1);
+
+	return codec->toUnicode( ascii, sizeof(ascii) ) == QString::fromLatin1( ascii, sizeof(ascii) );
+}
+
+
+// Read-only random access device over a single object in the chm archive. chm_retrieve_object
+// decompresses only the LZX blocks which cover the requested range, so nothing but the caller's
+// buffer is allocated.
+class EBook_CHM_Stream : public QIODevice
+{
+	public:
+		EBook_CHM_Stream( chmFile * file, const chmUnitInfo& ui, QMutex * lock )
+			: m_chmFile( file ), m_unitInfo( ui ), m_archiveLock( lock )
+		{
+		}
+
+		bool isSequential() const
+		{
+			return false;
+		}
+
+		qint64 size() const
+		{
+			return (qint64) m_unitInfo.length;
+		}
+
+	protected:
+		qint64 readData( char * data, qint64 maxlen )
+		{
+			qint64 left = size() - pos();
+
+			if ( left <= 0 )
+				return left < 0 ? -1 : 0;
+
+			if ( maxlen > left )
+				maxlen = left;
+
+			QMutexLocker locker( m_archiveLock );
+			LONGINT64 got = ::chm_retrieve_object( m_chmFile, &m_unitInfo, (unsigned char*) data, pos(), maxlen );
+
+			if ( got <= 0 )
+			{
+				setErrorString( "Error decompressing the chm object" );
+				return -1;
+			}
+
+			return got;
+		}
+
+		qint64 writeData( const char *, qint64 )
+		{
+			return -1;
+		}
+
+	private:
+		chmFile		*	m_chmFile;
+		chmUnitInfo		m_unitInfo;
+		QMutex		*	m_archiveLock;
+};
+
+
 bool EBook_CHM::getFileContentAsString( QString &str, const QUrl &url ) const
 {
 	return getTextContent( str, urlToPath( url ) );
@@ -227,25 +389,50 @@ bool EBook_CHM::getBinaryContent( QByteArray &data, const QString &url ) const
 	return false;
 }
 
-bool EBook_CHM::getTextContent( QString& str, const QString& url, bool internal_encoding ) const
+QIODevice * EBook_CHM::getFileContentAsStream( const QUrl& url ) const
+{
+	chmUnitInfo ui;
+
+	if( !ResolveObject( urlToPath( url ), &ui ) )
+		return 0;
+
+	EBook_CHM_Stream * stream = new EBook_CHM_Stream( m_chmFile, ui, &m_archiveLock );
+	stream->open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+	return stream;
+}
+
+bool EBook_CHM::getTextContent( QString& str, const QString& url ) const
 {
 	QByteArray buf;
 
-	if ( getBinaryContent( buf, url ) )
-	{
-		unsigned int length = buf.size();
+	if ( !getBinaryContent( buf, url ) || buf.isEmpty() )
+		return false;
 
-		if ( length > 0 )
-		{
-			buf.resize( length + 1 );
-			buf [length] = '\0';
+	// Some pages are padded with zeros, those are not a part of the text
+	int length = buf.size();
 
-			str = internal_encoding ? encodeInternalWithCurrentCodec( buf.constData() ) :  encodeWithCurrentCodec( buf.constData() );
-			return true;
-		}
+	while ( length > 0 && buf[ length - 1 ] == '\0' )
+		length--;
+
+	// The encoding could be changed from the GUI thread meanwhile
+	QTextCodec * codec;
+	bool asciiCompatible;
+
+	{
+		QMutexLocker locker( &m_codecLock );
+		codec = m_textCodec;
+		asciiCompatible = m_textCodecAsciiCompatible;
 	}
 
-	return false;
+	// Most pages are plain ASCII, which all supported codecs map 1:1, so widen them directly
+	if ( asciiCompatible && isAsciiOnly( buf.constData(), length ) )
+		str = QString::fromLatin1( buf.constData(), length );
+	else if ( !codec || codec->mibEnum() == MIB_UTF8 )
+		str = QString::fromUtf8( buf.constData(), length );
+	else
+		str = codec->toUnicode( buf.constData(), length );
+
+	return true;
 }
 
 int EBook_CHM::getContentSize(const QString &url)
@@ -291,6 +478,7 @@ bool EBook_CHM::load(const QString &archiveName)
 	// Reset encoding
 	m_textCodec = 0;
 	m_textCodecForSpecialFiles = 0;
+	m_textCodecAsciiCompatible = true;
 	m_currentEncoding = "UTF-8";
 
 	// Get information from /#WINDOWS and /#SYSTEM files (encoding, title, context file and so)
@@ -305,8 +493,9 @@ bool EBook_CHM::load(const QString &archiveName)
 			&& ResolveObject("/#URLTBL", &m_chmURLTBL)
 			&& ResolveObject("/#URLSTR", &m_chmURLSTR) )
 	{
+		// The topic lookup table is only built when requested, see prepareTopicLookup()
 		m_lookupTablesValid = true;
-		fillTopicsUrlMap();
+		m_topicsState = TOPICS_NOT_LOADED;
 	}
 
 	// Some CHM files have toc and index files, but do not set the name properly.
@@ -330,134 +519,86 @@ bool EBook_CHM::load(const QString &archiveName)
 	return true;
 }
 
-int EBook_CHM::findStringInQuotes (const QString& tag, int offset, QString& value, bool firstquote, bool decodeentities) const
+QString EBook_CHM::decodeSitemapValue( const QByteArray& raw ) const
 {
-	int qbegin = tag.indexOf ('"', offset);
+	QString str = encodeInternalWithCurrentCodec( raw );
 
-	if ( qbegin == -1 )
-		qFatal ("EBook_CHMImpl::findStringInQuotes: cannot find first quote in <param> tag: '%s'", qPrintable( tag ));
+	// Most values have no HTML entities, so there is nothing to decode
+	if ( str.indexOf( '&' ) == -1 )
+		return str;
 
-	int qend = firstquote ? tag.indexOf ('"', qbegin + 1) : tag.lastIndexOf ('"');
+	QString value, htmlentity;
+	bool fill_entity = false;
 
-	if ( qend == -1 || qend <= qbegin )
-		qFatal ("EBook_CHMImpl::findStringInQuotes: cannot find last quote in <param> tag: '%s'", qPrintable( tag ));
+	value.reserve( str.length() ); // to avoid multiple memory allocations
 
-	// If we do not need to decode HTML entities, just return.
-	if ( decodeentities )
+	for ( int i = 0; i < str.length(); i++ )
 	{
-		QString htmlentity = QString();
-		bool fill_entity = false;
-
-		value.reserve (qend - qbegin); // to avoid multiple memory allocations
-
-		for ( int i = qbegin + 1; i < qend; i++ )
+		if ( !fill_entity )
 		{
-			if ( !fill_entity )
-			{
-				if ( tag[i] == '&' ) // HTML entity starts
-					fill_entity = true;
-				else
-					value.append (tag[i]);
-			}
+			if ( str[i] == '&' ) // HTML entity starts
+				fill_entity = true;
 			else
+				value.append( str[i] );
+		}
+		else
+		{
+			if ( str[i] == ';' ) // HTML entity ends
 			{
-				if ( tag[i] == ';' ) // HTML entity ends
-				{
-					// If entity is an ASCII code, just decode it
-					QString decode = m_htmlEntityDecoder.decode( htmlentity );
+				// If entity is an ASCII code, just decode it
+				QString decode = m_htmlEntityDecoder.decode( htmlentity );
 
-					if ( decode.isNull() )
-						break;
+				if ( decode.isNull() )
+					break;
 
-					value.append ( decode );
-					htmlentity = QString();
-					fill_entity = false;
-				}
-				else
-					htmlentity.append (tag[i]);
+				value.append( decode );
+				htmlentity = QString();
+				fill_entity = false;
 			}
+			else
+				htmlentity.append( str[i] );
 		}
 	}
-	else
-		value = tag.mid (qbegin + 1, qend - qbegin - 1);
 
-	return qend + 1;
+	return value;
 }
 
 
 bool EBook_CHM::parseFileAndFillArray( const QString& file, QList< ParsedEntry >& data, bool asIndex ) const
 {
-	QString src;
+	QByteArray src;
 	const int MAX_NEST_DEPTH = 256;
 
-	if ( !getTextContent( src, file, true ) || src.isEmpty() )
+	if ( !getBinaryContent( src, file ) || src.isEmpty() )
 		return false;
 
-/*
-	// Save the index for debugging purposes
-	QFile outfile( "parsed.htm" );
-
-	if ( outfile.open( QIODevice::WriteOnly ) )
-	{
-		QTextStream textstream( &outfile );
-		textstream << src;
-		outfile.close();
-	}
-*/
-
 	EBookTocEntry::Icon defaultimagenum = EBookTocEntry::IMAGE_AUTO;
-	int pos = 0, indent = 0, root_indent_offset = 0;
+	int indent = 0, root_indent_offset = 0;
 	bool in_object = false, root_indent_offset_set = false;
 
 	ParsedEntry entry;
 	entry.iconid = defaultimagenum;
 
-	// Split the HHC file by HTML tags
-	int stringlen = src.length();
+	// Split the HHC file by HTML tags. Only the parameter values are decoded.
+	HelperSitemapParser parser( src );
 
-	while ( pos < stringlen && (pos = src.indexOf ('<', pos)) != -1 )
+	while ( parser.nextTag() )
 	{
-		int i, word_end = 0;
-
-		for ( i = ++pos; i < stringlen; i++ )
+		switch ( parser.tagType() )
 		{
-			// If a " or ' is found, skip to the next one.
-			if ( (src[i] == '"' || src[i] == '\'') )
-			{
-				// find where quote ends, either by another quote, or by '>' symbol (some people don't know HTML)
-				int nextpos = src.indexOf (src[i], i+1);
-				if ( nextpos == -1 	&& (nextpos = src.indexOf ('>', i+1)) == -1 )
-				{
-					qWarning ("EBook_CHMImpl::ParseHhcAndFillTree: corrupted TOC: %s", qPrintable( src.mid(i) ));
-					return false;
-				}
+		// <OBJECT type="text/sitemap"> - a topic entry
+		case HelperSitemapParser::TAG_OBJECT:
+			in_object = true;
+			break;
 
-				i =  nextpos;
-			}
-			else if ( src[i] == '>'  )
+		case HelperSitemapParser::TAG_OBJECT_END:
+			if ( !in_object )
 				break;
-			else if ( !src[i].isLetterOrNumber() && src[i] != '/' && !word_end )
-				word_end = i;
-		}
-
-		QString tagword, tag = src.mid (pos, i - pos);
-
-		if ( word_end )
-			tagword = src.mid (pos, word_end - pos).toLower();
-		else
-			tagword = tag.toLower();
-
-        //DEBUGPARSER(("tag: '%s', tagword: '%s'\n", qPrintable( tag ), qPrintable( tagword ) ));
 
-		// <OBJECT type="text/sitemap"> - a topic entry
-		if ( tagword == "object" && tag.indexOf ("text/sitemap", 0, Qt::CaseInsensitive ) != -1 )
-			in_object = true;
-		else if ( tagword == "/object" && in_object )
-		{
 			// a topic entry closed. Add a tree item
 			if ( entry.name.isEmpty() && entry.urls.isEmpty() )
 			{
-				qWarning ("EBook_CHMImpl::ParseAndFillTopicsTree: <object> tag is parsed, but both name and url are empty.");
+				qWarning ("EBook_CHM::parseFileAndFillArray: <object> tag is parsed, but both name and url are empty.");
 			}
 			else
 			{
@@ -488,93 +629,96 @@ bool EBook_CHM::parseFileAndFillArray( const QString& file, QList< ParsedEntry >
 			entry.iconid = defaultimagenum;
 			entry.seealso.clear();
 			in_object = false;
-		}
-		else if ( tagword == "param" && in_object )
-		{
-			// <param name="Name" value="First Page">
-			int offset; // strlen("param ")
-			QString name_pattern = "name=", value_pattern = "value=";
-			QString pname, pvalue;
-
-			if ( (offset = tag.indexOf (name_pattern, 0, Qt::CaseInsensitive )) == -1 )
-				qFatal ("EBook_CHMImpl::ParseAndFillTopicsTree: bad <param> tag '%s': no name=\n", qPrintable( tag ));
+			break;
 
-			// offset+5 skips 'name='
-            offset = findStringInQuotes (tag, offset + name_pattern.length(), pname, true, false);
-			pname = pname.toLower();
+		case HelperSitemapParser::TAG_PARAM:
+			{
+				if ( !in_object )
+					break;
 
-			if ( (offset = tag.indexOf(value_pattern, offset, Qt::CaseInsensitive )) == -1 )
-				qFatal ("EBook_CHMImpl::ParseAndFillTopicsTree: bad <param> tag '%s': no value=\n", qPrintable( tag ));
+				// <param name="Name" value="First Page">
+				if ( !parser.hasParam() )
+				{
+					qWarning ("EBook_CHM::parseFileAndFillArray: bad <param> tag '%s', ignored", parser.tag().constData() );
+					break;
+				}
 
-			// offset+6 skips 'value='
-            findStringInQuotes (tag, offset + value_pattern.length(), pvalue, false, true);
+				QString pvalue = decodeSitemapValue( parser.paramValue() );
 
-            //DEBUGPARSER(("<param>: name '%s', value '%s'", qPrintable( pname ), qPrintable( pvalue )));
+				//DEBUGPARSER(("<param>: value '%s'", qPrintable( pvalue )));
 
-			if ( pname == "name" || pname == "keyword" )
-			{
-				// Some help files contain duplicate names, where the second name is empty. Work it around by keeping the first one
-				if ( !pvalue.isEmpty() )
-					entry.name = pvalue;
-			}
-			else if ( pname == "merge" )
-			{
-				// MERGE implementation is experimental
-				QUrl mergeurl = pathToUrl( pvalue );
-				QString mergecontent;
+				if ( parser.paramNameIs( "name" ) || parser.paramNameIs( "keyword" ) )
+				{
+					// Some help files contain duplicate names, where the second name is empty. Work it around by keeping the first one
+					if ( !pvalue.isEmpty() )
+						entry.name = pvalue;
+				}
+				else if ( parser.paramNameIs( "merge" ) )
+				{
+					// MERGE implementation is experimental
+					QByteArray mergecontent;
+
+					if ( getBinaryContent( mergecontent, urlToPath( pathToUrl( pvalue ) ) ) && !mergecontent.isEmpty() )
+					{
+						qWarning( "MERGE is used in index; the implementation is experimental. Please let me know if it works" );
+
+						// The merged file is parsed in place of the tag, and then the current file continues
+						parser.pushSource( mergecontent );
+					}
+					else
+						qWarning( "MERGE is used in index but file %s was not found in CHM archive", qPrintable(pvalue) );
+				}
+				else if ( parser.paramNameIs( "local" ) )
+				{
+					// Check for URL duplication
+					QUrl url = pathToUrl( pvalue );
 
-				if ( getFileContentAsString( mergecontent, mergeurl ) && !mergecontent.isEmpty() )
+					if ( !entry.urls.contains( url ) )
+						entry.urls.push_back( url );
+				}
+				else if ( parser.paramNameIs( "see also" ) && asIndex && entry.name != pvalue )
+				{
+					entry.urls.push_back( QUrl("seealso") );
+					entry.seealso = pvalue;
+				}
+				else if ( parser.paramNameIs( "imagenumber" ) )
 				{
-					qWarning( "MERGE is used in index; the implementation is experimental. Please let me know if it works" );
+					bool bok;
+					int imgnum = pvalue.toInt (&bok);
 
-					// Merge the read value into the current parsed file.
-					// To save memory it is done in a kinda hacky way:
-					src = mergecontent + src.mid( i );
-					pos = 0;
-					stringlen = src.length();
+					if ( bok && imgnum >= 0 && imgnum < EBookTocEntry::MAX_BUILTIN_ICONS )
+						entry.iconid = (EBookTocEntry::Icon) imgnum;
 				}
-				else
-					qWarning( "MERGE is used in index but file %s was not found in CHM archive", qPrintable(pvalue) );
 			}
-			else if ( pname == "local" )
-			{
-				// Check for URL duplication
-				QUrl url = pathToUrl( pvalue );
+			break;
 
-				if ( !entry.urls.contains( url ) )
-					entry.urls.push_back( url );
-			}
-			else if ( pname == "see also" && asIndex && entry.name != pvalue )
+		case HelperSitemapParser::TAG_UL: // increase indent level
+			// Fix for buggy help files
+			if ( ++indent >= MAX_NEST_DEPTH )
 			{
-				entry.urls.push_back( QUrl("seealso") );
-				entry.seealso = pvalue;
+				qWarning("EBook_CHM::parseFileAndFillArray: max nest depth (%d) is reached, error in help file %s", MAX_NEST_DEPTH, qPrintable( file ) );
+				return false;
 			}
-			else if ( pname == "imagenumber" )
-			{
-				bool bok;
-				int imgnum = pvalue.toInt (&bok);
 
-				if ( bok && imgnum >= 0 && imgnum < EBookTocEntry::MAX_BUILTIN_ICONS )
-					entry.iconid = (EBookTocEntry::Icon) imgnum;
-			}
-		}
-		else if ( tagword == "ul" ) // increase indent level
-		{
-			// Fix for buggy help files
-			if ( ++indent >= MAX_NEST_DEPTH )
-				qFatal("EBook_CHMImpl::ParseAndFillTopicsTree: max nest depth (%d) is reached, error in help file", MAX_NEST_DEPTH);
+			DEBUGPARSER(("<ul>: new intent is %d\n", indent - root_indent_offset));
+			break;
 
-            DEBUGPARSER(("<ul>: new intent is %d\n", indent - root_indent_offset));
-		}
-		else if ( tagword == "/ul" ) // decrease indent level
-		{
+		case HelperSitemapParser::TAG_UL_END: // decrease indent level
 			if ( --indent < root_indent_offset )
 				indent = root_indent_offset;
 
 			DEBUGPARSER(("</ul>: new intent is %d\n", indent - root_indent_offset));
+			break;
+
+		default:
+			break;
 		}
+	}
 
-		pos = i;
+	if ( parser.hasError() )
+	{
+		qWarning ("EBook_CHM::parseFileAndFillArray: corrupted file %s: %s", qPrintable( file ), qPrintable( parser.errorString() ));
+		return false;
 	}
 
     // Dump our array
@@ -586,6 +730,8 @@ bool EBook_CHM::parseFileAndFillArray( const QString& file, QList< ParsedEntry >
 
 bool EBook_CHM::ResolveObject(const QString& fileName, chmUnitInfo *ui) const
 {
+	QMutexLocker locker( &m_archiveLock );
+
 	return m_chmFile != NULL
 			&& ::chm_resolve_object(m_chmFile, qPrintable( fileName ), ui) ==
 			CHM_RESOLVE_SUCCESS;
@@ -595,6 +741,7 @@ bool EBook_CHM::ResolveObject(const QString& fileName, chmUnitInfo *ui) const
 bool EBook_CHM::hasFile(const QString & fileName) const
 {
 	chmUnitInfo ui;
+	QMutexLocker locker( &m_archiveLock );
 
 	return m_chmFile != NULL
 			&& ::chm_resolve_object(m_chmFile, qPrintable( fileName ), &ui) ==
@@ -605,6 +752,8 @@ bool EBook_CHM::hasFile(const QString & fileName) const
 size_t EBook_CHM::RetrieveObject(const chmUnitInfo *ui, unsigned char *buffer,
 								LONGUINT64 fileOffset, LONGINT64 bufferSize) const
 {
+	QMutexLocker locker( &m_archiveLock );
+
 	return ::chm_retrieve_object(m_chmFile, const_cast<chmUnitInfo*>(ui),
 								 buffer, fileOffset, bufferSize);
 }
@@ -795,12 +944,50 @@ bool EBook_CHM::getInfoFromSystem()
 
 QString EBook_CHM::getTopicByUrl( const QUrl& url )
 {
-	QMap< QUrl, QString >::const_iterator it = m_url2topics.find( url );
+	if ( m_topicsState != TOPICS_LOADED )
+		finishTopicLookup();
 
-	if ( it == m_url2topics.end() )
+	if ( m_topics.entries.isEmpty() )
 		return QString();
 
-	return it.value();
+	QByteArray key = topicKey( url );
+
+	TopicEntry lookup;
+	lookup.hash = qHash( key );
+
+	QVector< TopicEntry >::const_iterator it = std::lower_bound( m_topics.entries.constBegin(), m_topics.entries.constEnd(), lookup );
+	QString title;
+
+	// Several URLs may share the hash; the entries with equal hashes keep the table order,
+	// and the last matching one wins as the map-based lookup did.
+	for ( ; it != m_topics.entries.constEnd() && it->hash == lookup.hash; ++it )
+	{
+		if ( topicKeyFromRaw( tableString( m_topics.urlstr, it->off_url ) ) != key )
+			continue;
+
+		if ( it->off_title < (unsigned int) m_topics.strings.size() )
+			title = encodeWithCurrentCodec( tableString( m_topics.strings, it->off_title ) );
+		else
+			title = "Untitled";
+	}
+
+	return title;
+}
+
+QByteArray EBook_CHM::topicKey( const QUrl& url ) const
+{
+	if ( url.scheme() != URL_SCHEME_CHM )
+		return url.toString().toUtf8();
+
+	QByteArray key = url.path().toUtf8();
+
+	if ( !key.startsWith( '/' ) )
+		key.prepend( '/' );
+
+	if ( url.hasFragment() )
+		key += '#' + url.fragment().toUtf8();
+
+	return key;
 }
 
 
@@ -814,6 +1001,7 @@ static int chm_enumerator_callback( struct chmFile*, struct chmUnitInfo *ui, voi
 bool EBook_CHM::enumerateFiles(QList<QUrl> &files )
 {
 	files.clear();
+	QMutexLocker locker( &m_archiveLock );
 	return chm_enumerate( m_chmFile, CHM_ENUMERATE_ALL, chm_enumerator_callback, &files );
 }
 
@@ -858,22 +1046,25 @@ bool EBook_CHM::changeFileEncoding( const QString& qtencoding  )
 	// set up encodings separately for text (first) and internal files (second)
 	int p = qtencoding.indexOf( '/' );
 
+	QTextCodec * textCodec;
+	QTextCodec * specialCodec;
+
 	if ( p != -1 )
 	{
 		QString global = qtencoding.left( p );
 		QString special = qtencoding.mid( p + 1 );
 
-		m_textCodec = QTextCodec::codecForName( global.toUtf8() );
+		textCodec = QTextCodec::codecForName( global.toUtf8() );
 
-		if ( !m_textCodec )
+		if ( !textCodec )
 		{
 			qWarning( "Could not set up Text Codec for encoding '%s'", qPrintable( global ) );
 			return false;
 		}
 
-		m_textCodecForSpecialFiles = QTextCodec::codecForName( special.toUtf8() );
+		specialCodec = QTextCodec::codecForName( special.toUtf8() );
 
-		if ( !m_textCodecForSpecialFiles )
+		if ( !specialCodec )
 		{
 			qWarning( "Could not set up Text Codec for encoding '%s'", qPrintable( special ) );
 			return false;
@@ -881,49 +1072,134 @@ bool EBook_CHM::changeFileEncoding( const QString& qtencoding  )
 	}
 	else
 	{
-		m_textCodecForSpecialFiles = m_textCodec = QTextCodec::codecForName( qtencoding.toUtf8() );
+		specialCodec = textCodec = QTextCodec::codecForName( qtencoding.toUtf8() );
 
-		if ( !m_textCodec )
+		if ( !textCodec )
 		{
 			qWarning( "Could not set up Text Codec for encoding '%s'", qPrintable( qtencoding ) );
 			return false;
 		}
 	}
 
-	m_url2topics.clear();
-	fillTopicsUrlMap();
+	// getTextContent() reads the codec in the worker threads
+	{
+		QMutexLocker locker( &m_codecLock );
+		m_textCodec = textCodec;
+		m_textCodecForSpecialFiles = specialCodec;
+		m_textCodecAsciiCompatible = isAsciiCompatible( textCodec );
+	}
+
 	m_htmlEntityDecoder.changeEncoding( m_textCodec );
 	return true;
 }
 
 
-void EBook_CHM::fillTopicsUrlMap()
+// Builds the topic lookup table in the thread pool
+class EBook_CHM_TopicsJob : public QRunnable
 {
+	public:
+		EBook_CHM_TopicsJob( EBook_CHM * ebook )
+			: m_ebook( ebook )
+		{
+		}
+
+		void run()
+		{
+			EBook_CHM::TopicTable table;
+
+			m_ebook->buildTopicTable( table );
+			m_ebook->topicTableBuilt( table );
+		}
+
+	private:
+		EBook_CHM	*	m_ebook;
+};
+
+
+void EBook_CHM::prepareTopicLookup()
+{
+	if ( !m_lookupTablesValid || m_topicsState != TOPICS_NOT_LOADED )
+		return;
+
+	m_topicsState = TOPICS_LOADING;
+	m_pendingTopicsReady = false;
+
+	QThreadPool::globalInstance()->start( new EBook_CHM_TopicsJob( this ) );
+}
+
+void EBook_CHM::topicTableBuilt( TopicTable& table )
+{
+	QMutexLocker locker( &m_topicsLock );
+
+	qSwap( m_pendingTopics, table );
+	m_pendingTopicsReady = true;
+	m_topicsBuilt.wakeAll();
+}
+
+void EBook_CHM::finishTopicLookup()
+{
+	if ( m_topicsState == TOPICS_LOADING )
+	{
+		// Usually it is done long before the first title is needed
+		QMutexLocker locker( &m_topicsLock );
+
+		while ( !m_pendingTopicsReady )
+			m_topicsBuilt.wait( &m_topicsLock );
+
+		qSwap( m_topics, m_pendingTopics );
+		m_pendingTopics = TopicTable();
+		m_pendingTopicsReady = false;
+	}
+	else if ( m_topicsState == TOPICS_NOT_LOADED )
+		buildTopicTable( m_topics );
+
+	m_topicsState = TOPICS_LOADED;
+}
+
+void EBook_CHM::buildTopicTable( TopicTable& table ) const
+{
+	table = TopicTable();
+
 	if ( !m_lookupTablesValid )
 		return;
 
-	// Read those tables
-	QVector<unsigned char> topics( m_chmTOPICS.length ), urltbl( m_chmURLTBL.length ), urlstr( m_chmURLSTR.length ), strings( m_chmSTRINGS.length );
+	// Read those tables. #URLSTR and #STRINGS are kept, the titles are decoded from them on request.
+	QByteArray topics, urltbl;
 
-	if ( !RetrieveObject( &m_chmTOPICS, (unsigned char*) topics.data(), 0, m_chmTOPICS.length )
-	|| !RetrieveObject( &m_chmURLTBL, (unsigned char*) urltbl.data(), 0, m_chmURLTBL.length )
-	|| !RetrieveObject( &m_chmURLSTR, (unsigned char*) urlstr.data(), 0, m_chmURLSTR.length )
-	|| !RetrieveObject( &m_chmSTRINGS, (unsigned char*) strings.data(), 0, m_chmSTRINGS.length ) )
+	if ( !getBinaryContent( topics, "/#TOPICS" )
+	|| !getBinaryContent( urltbl, "/#URLTBL" )
+	|| !getBinaryContent( table.urlstr, "/#URLSTR" )
+	|| !getBinaryContent( table.strings, "/#STRINGS" ) )
+	{
+		table = TopicTable();
 		return;
+	}
 
-	for ( unsigned int i = 0; i < m_chmTOPICS.length; i += TOPICS_ENTRY_LEN )
+	table.entries.reserve( topics.size() / TOPICS_ENTRY_LEN );
+
+	for ( int i = 0; i + TOPICS_ENTRY_LEN <= topics.size(); i += TOPICS_ENTRY_LEN )
 	{
-		unsigned int off_title = get_int32_le( (unsigned int *)(topics.data() + i + 4) );
-		unsigned int off_url = get_int32_le( (unsigned int *)(topics.data() + i + 8) );
-		off_url = get_int32_le( (unsigned int *)( urltbl.data() + off_url + 8) ) + 8;
+		unsigned int off_title = UINT32ARRAY( topics.constData() + i + 4 );
+		unsigned int off_url = UINT32ARRAY( topics.constData() + i + 8 );
+
+		if ( off_url + URLTBL_ENTRY_LEN > (unsigned int) urltbl.size() )
+			continue;
 
-		QUrl url = pathToUrl( (const char*) urlstr.data() + off_url );
+		off_url = UINT32ARRAY( urltbl.constData() + off_url + 8 ) + 8;
 
-		if ( off_title < (unsigned int)strings.size() )
-			m_url2topics[url] = encodeWithCurrentCodec ( (const char*) strings.data() + off_title );
-		else
-			m_url2topics[url] = "Untitled";
+		if ( off_url >= (unsigned int) table.urlstr.size() )
+			continue;
+
+		TopicEntry entry;
+		entry.hash = qHash( topicKeyFromRaw( tableString( table.urlstr, off_url ) ) );
+		entry.off_url = off_url;
+		entry.off_title = off_title;
+		table.entries.push_back( entry );
 	}
+
+	// Stable sort keeps the table order for the duplicate URLs
+	std::stable_sort( table.entries.begin(), table.entries.end() );
+	table.entries.squeeze();
 }
 
 
@@ -1068,6 +1344,181 @@ bool EBook_CHM::RecurseLoadBTOC( const QByteArray& tocidx,
 	return true;
 }
 
+bool EBook_CHM::parseBinaryIndex( QList< EBookIndexEntry >& index ) const
+{
+	if ( !m_lookupTablesValid || !hasFile( "/$WWKeywordLinks/BTree" ) )
+		return false;
+
+	QByteArray btree, topics, urltbl, urlstr;
+
+	// Read the keyword tree and the lookup tables
+	if ( !getBinaryContent( btree, "/$WWKeywordLinks/BTree" )
+	|| !getBinaryContent( topics, "/#TOPICS" )
+	|| !getBinaryContent( urltbl, "/#URLTBL" )
+	|| !getBinaryContent( urlstr, "/#URLSTR" ) )
+		return false;
+
+	if ( btree.size() < BTREE_HEADER_LEN )
+		return false;
+
+	unsigned int blocksize = UINT16ARRAY( btree.constData() + 0x04 );
+
+	if ( blocksize <= BTREE_BLOCK_HEADER_LEN )
+	{
+		qWarning("EBook_CHM::parseBinaryIndex: invalid block size (%u)", blocksize );
+		return false;
+	}
+
+	// Protects against the looped block chains
+	unsigned int blockcount = (btree.size() - BTREE_HEADER_LEN) / blocksize;
+
+	// The listing blocks come first and are chained; the index blocks which follow them
+	// are only needed for the keyword search, so they are skipped.
+	unsigned int block = 0;
+	unsigned int visited = 0;
+
+	while ( block != 0xFFFFFFFF )
+	{
+		unsigned long blockoffset = BTREE_HEADER_LEN + (unsigned long) block * blocksize;
+
+		if ( visited++ > blockcount || blockoffset + blocksize > (unsigned long) btree.size() )
+		{
+			qWarning("EBook_CHM::parseBinaryIndex: invalid listing block (%u), fallback to text-based index", block );
+			index.clear();
+			return false;
+		}
+
+		const char * data = btree.constData() + blockoffset;
+		unsigned int freespace = UINT16ARRAY( data );
+		unsigned int entries = UINT16ARRAY( data + 2 );
+		unsigned int next = UINT32ARRAY( data + 8 );
+
+		if ( freespace > blocksize - BTREE_BLOCK_HEADER_LEN )
+			freespace = 0;
+
+		unsigned long offset = blockoffset + BTREE_BLOCK_HEADER_LEN;
+		unsigned short spaceLeft = blocksize - BTREE_BLOCK_HEADER_LEN - freespace;
+
+		for ( unsigned int i = 0; i < entries; i++ )
+		{
+			// Keyword, in the "parent, child" form for the nested ones
+			QString keyword = getBtreeString( btree, &offset, &spaceLeft );
+
+			if ( keyword.isNull() || spaceLeft < 16 )
+			{
+				qWarning("EBook_CHM::parseBinaryIndex: corrupted entry in block %u, fallback to text-based index", block );
+				index.clear();
+				return false;
+			}
+
+			unsigned int seealso = UINT16ARRAY( btree.constData() + offset );
+			unsigned int depth = UINT16ARRAY( btree.constData() + offset + 2 );
+			unsigned int lastkeyword = UINT32ARRAY( btree.constData() + offset + 4 );
+			unsigned int pairs = UINT32ARRAY( btree.constData() + offset + 12 );
+			offset += 16;
+			spaceLeft -= 16;
+
+			EBookIndexEntry entry;
+
+			if ( depth > 0 && lastkeyword < (unsigned int) keyword.length() )
+				entry.name = keyword.mid( lastkeyword ).trimmed();
+			else
+				entry.name = keyword.trimmed();
+
+			// If the index array is empty, make sure the first entry is on root offset
+			entry.indent = index.isEmpty() ? 0 : depth;
+
+			if ( seealso == 2 )
+			{
+				entry.seealso = getBtreeString( btree, &offset, &spaceLeft );
+
+				if ( entry.seealso.isNull() )
+				{
+					qWarning("EBook_CHM::parseBinaryIndex: corrupted see also entry in block %u, fallback to text-based index", block );
+					index.clear();
+					return false;
+				}
+
+				if ( entry.seealso != entry.name )
+					entry.urls.push_back( QUrl("seealso") );
+			}
+			else
+			{
+				if ( (unsigned long) pairs * 4 > spaceLeft )
+				{
+					qWarning("EBook_CHM::parseBinaryIndex: invalid topic count (%u) in block %u, fallback to text-based index", pairs, block );
+					index.clear();
+					return false;
+				}
+
+				for ( unsigned int j = 0; j < pairs; j++ )
+				{
+					unsigned int topic = UINT32ARRAY( btree.constData() + offset );
+					offset += 4;
+					spaceLeft -= 4;
+
+					// #TOPICS -> #URLTBL -> #URLSTR, as for the binary TOC
+					if ( (unsigned long) topic * TOPICS_ENTRY_LEN + 12 > (unsigned long) topics.size() )
+						continue;
+
+					unsigned int urloffset = UINT32ARRAY( topics.constData() + topic * TOPICS_ENTRY_LEN + 8 );
+
+					if ( (unsigned long) urloffset + URLTBL_ENTRY_LEN > (unsigned long) urltbl.size() )
+						continue;
+
+					urloffset = UINT32ARRAY( urltbl.constData() + urloffset + 8 ) + 8;
+
+					if ( urloffset >= (unsigned int) urlstr.size() )
+						continue;
+
+					QUrl url = pathToUrl( encodeInternalWithCurrentCodec( urlstr.constData() + urloffset ) );
+
+					if ( !entry.urls.contains( url ) )
+						entry.urls.push_back( url );
+				}
+			}
+
+			// Two trailing DWORDs: unknown and the entry number
+			if ( spaceLeft < 8 )
+			{
+				qWarning("EBook_CHM::parseBinaryIndex: truncated entry in block %u, fallback to text-based index", block );
+				index.clear();
+				return false;
+			}
+
+			offset += 8;
+			spaceLeft -= 8;
+
+			if ( !entry.urls.isEmpty() && !entry.name.isEmpty() )
+				index.push_back( entry );
+		}
+
+		block = next;
+	}
+
+	return !index.isEmpty();
+}
+
+QString EBook_CHM::getBtreeString( const QByteArray& btidx, unsigned long * offset, unsigned short * spaceLeft ) const
+{
+	// Zero-terminated UTF-16LE string; returns a null string if it runs out of the block
+	QString str( "" );
+
+	while ( *spaceLeft >= 2 )
+	{
+		unsigned short ch = UINT16ARRAY( btidx.constData() + *offset );
+		*offset += 2;
+		*spaceLeft -= 2;
+
+		if ( ch == 0 )
+			return str;
+
+		str.append( QChar( ch ) );
+	}
+
+	return QString();
+}
+
 bool EBook_CHM::hasOption(const QString & name) const
 {
 	if ( !m_envOptions.isEmpty() && m_envOptions.contains( name ) )
@@ -23,11 +23,13 @@
 
 #include <QByteArray>
 #include <QList>
-#include <QMap>
+#include <QMutex>
 #include <QString>
 #include <QTextCodec>
 #include <QtGlobal>		// qPrintable
 #include <QUrl>
+#include <QVector>
+#include <QWaitCondition>
 
 // Enable Unicode use in libchm
 #if defined (WIN32)
@@ -92,8 +94,8 @@ class EBook_CHM : public EBook
 		 * \param topics A pointer to the container which will store the parsed results.
 		 *               Will be cleaned before parsing.
 		 * \return true if the tree is present and parsed successfully, false otherwise.
-		 *         The parser is built to be error-prone, however it still can abort with qFatal()
-		 *         by really buggy files; please report a bug if the file is opened ok under Windows.
+		 *         The parser is built to be error-prone; really buggy files are reported with a warning,
+		 *         please report a bug if the file is opened ok under Windows.
 		 * \ingroup fileparsing
 		 */
 		virtual bool getTableOfContents( QList< EBookTocEntry >& toc ) const;
@@ -103,8 +105,7 @@ class EBook_CHM : public EBook
 		 * \param indexes A pointer to the container which will store the parsed results.
 		 *               Will be cleaned before parsing.
 		 * \return true if the tree is present and parsed successfully, false otherwise.
-		 *         The parser is built to be error-prone, however it still can abort with qFatal()
-		 *         by really buggy chm file; so far it never happened on indexes.
+		 *         The parser is built to be error-prone; really buggy files are reported with a warning.
 		 * \ingroup fileparsing
 		 */
 		virtual bool getIndex( QList< EBookIndexEntry >& index ) const;
@@ -138,6 +139,17 @@ class EBook_CHM : public EBook
 		 */
 		virtual bool getFileContentAsBinary( QByteArray& data, const QUrl& url ) const;
 
+		/*!
+		 * \brief Opens the content from url in current ebook as a read-only stream.
+		 * \param url An URL in ebook file to retreive content from. Must be absolute.
+		 * \return The opened random-access device, or NULL if the url cannot be found. The caller owns the
+		 *         device and must delete it before the ebook is closed.
+		 *
+		 * \sa getFileContentAsBinary()
+		 * \ingroup dataretrieve
+		 */
+		virtual QIODevice * getFileContentAsStream( const QUrl& url ) const;
+
 		/*!
 		 * \brief Retrieves the content size.
 		 * \param url An URL in ebook file to retreive content from. Must be absolute.
@@ -166,6 +178,14 @@ class EBook_CHM : public EBook
 		 */
 		virtual QString		getTopicByUrl ( const QUrl& url );
 
+		/*!
+		 * \brief Builds the topic lookup table in the global thread pool. It is swapped in
+		 * by getTopicByUrl(), which waits for it if it is not ready yet.
+		 *
+		 * \ingroup dataretrieve
+		 */
+		virtual void		prepareTopicLookup();
+
 		/*!
 		 * \brief Gets the current ebook encoding (set or autodetected) as qtcodec
 		 * \return The current encoding.
@@ -208,6 +228,34 @@ class EBook_CHM : public EBook
 				QString		seealso;
 		};
 
+		// Entry of the topic title lookup table. Refers to the raw #URLSTR and #STRINGS tables,
+		// so the title is only decoded when it is requested.
+		class TopicEntry
+		{
+			public:
+				bool operator< ( const TopicEntry& other ) const { return hash < other.hash; }
+
+				uint			hash;		// hash of the normalized URL path
+				unsigned int	off_url;	// offset in #URLSTR
+				unsigned int	off_title;	// offset in #STRINGS
+		};
+
+		// Topic lookup table sorted by hash, url->topic, with the raw #URLSTR and #STRINGS tables it refers to
+		class TopicTable
+		{
+			public:
+				QVector< TopicEntry >	entries;
+				QByteArray				urlstr;
+				QByteArray				strings;
+		};
+
+		enum TopicsState
+		{
+			TOPICS_NOT_LOADED,
+			TOPICS_LOADING,		// built in the thread pool
+			TOPICS_LOADED
+		};
+
 		//! Looks up fileName in the archive.
 		bool hasFile( const QString& fileName ) const;
 
@@ -229,6 +277,13 @@ class EBook_CHM : public EBook
 			return (m_textCodec ? m_textCodec->toUnicode( str ) : (QString) str);
 		}
 
+		//! Encode the string from internal files with the currently selected text codec, if possible.
+		//! Or return as-is, if not. Unlike the other overloads, the data may contain zeros.
+		inline QString encodeInternalWithCurrentCodec (const QByteArray& str) const
+		{
+			return (m_textCodecForSpecialFiles ? m_textCodecForSpecialFiles->toUnicode( str ) : QString::fromUtf8( str ));
+		}
+
 		//! Encode the string from internal files with the currently selected text codec, if possible.
 		//! Or return as-is, if not.
 		inline QString encodeInternalWithCurrentCodec (const QString& str) const
@@ -250,13 +305,18 @@ class EBook_CHM : public EBook
 		bool  		parseFileAndFillArray (const QString& file, QList< ParsedEntry >& data, bool asIndex ) const;
 
 		bool		getBinaryContent( QByteArray &data, const QString &url ) const;
-		bool		getTextContent( QString& str, const QString& url, bool internal_encoding = false ) const;
+		bool		getTextContent( QString& str, const QString& url ) const;
 
 		/*!
 		 * Parse binary TOC
 		 */
 		bool parseBinaryTOC(QList<EBookTocEntry> &data ) const;
 
+		/*!
+		 * Parse binary index ($WWKeywordLinks/BTree)
+		 */
+		bool parseBinaryIndex( QList<EBookIndexEntry> &data ) const;
+
 		//! btree string parser
 		QString getBtreeString( const QByteArray& btidx, unsigned long * offset, unsigned short * spaceLeft ) const;
 
@@ -273,15 +333,24 @@ class EBook_CHM : public EBook
 							  int level ) const;
 
 		/*!
-		 * Helper procedure in TOC parsing, decodes the string between the quotes (first or last) with decoding HTML
-		 * entities like &iacute;
+		 * Helper procedure in TOC parsing, decodes the raw <param> value with the codec for internal files
+		 * and decodes HTML entities like &iacute;
 		 */
-		int findStringInQuotes (const QString& tag, int offset, QString& value, bool firstquote, bool decodeentities ) const;
+		QString decodeSitemapValue( const QByteArray& raw ) const;
 		bool getInfoFromWindows();
 		bool getInfoFromSystem();
 		bool changeFileEncoding(const QString &qtencoding);
 		bool guessTextEncoding();
-		void fillTopicsUrlMap();
+		// Reads the tables through the thread-safe content retrieval, so it could run in any thread
+		void buildTopicTable( TopicTable& table ) const;
+
+		// Makes the topic table ready, waiting for the background build if it is running
+		void finishTopicLookup();
+
+		// Called by the background job
+		friend class EBook_CHM_TopicsJob;
+		void topicTableBuilt( TopicTable& table );
+		QByteArray topicKey( const QUrl& url ) const;
 		bool hasOption(const QString &name) const;
 
 		// Members
@@ -289,6 +358,9 @@ class EBook_CHM : public EBook
 		//! Pointer to the chmlib structure
 		chmFile	*	m_chmFile;
 
+		//! chmlib is not thread-safe, all calls using m_chmFile are serialized by this lock
+		mutable QMutex	m_archiveLock;
+
 		//! Opened file name
 		QString  	m_filename;
 
@@ -315,6 +387,13 @@ class EBook_CHM : public EBook
 		QTextCodec	*	m_textCodec;
 		QTextCodec	*	m_textCodecForSpecialFiles;
 
+		//! TRUE if m_textCodec decodes 7-bit text as Latin-1, so ASCII pages could bypass it
+		bool			m_textCodecAsciiCompatible;
+
+		//! Guards m_textCodec and m_textCodecAsciiCompatible, which getTextContent() reads in the worker threads.
+		//! They are only changed in the GUI thread, so the GUI thread reads them unlocked.
+		mutable QMutex	m_codecLock;
+
 		//! Current encoding
 		QString			m_currentEncoding;
 
@@ -339,8 +418,15 @@ class EBook_CHM : public EBook
 		//! Indicates whether index, either binary or text, is available.
 		bool			m_indexAvailable;
 
-		//! Map url->topic
-		QMap< QUrl, QString >	m_url2topics;
+		//! Topic lookup table; built in background after prepareTopicLookup(), or on the first lookup
+		TopicTable				m_topics;
+		TopicsState				m_topicsState;
+
+		//! The table built in background, until getTopicByUrl() swaps it in
+		QMutex					m_topicsLock;
+		QWaitCondition			m_topicsBuilt;
+		TopicTable				m_pendingTopics;
+		bool					m_pendingTopicsReady;
 
 		//! uChmViewer debug options from environment
 		QString			m_envOptions;
@@ -23,19 +23,22 @@
     #include <unistd.h>
 #endif
 
+#include <QBuffer>
 #include <QByteArray>
+#include <QDir>				// QDir::cleanPath
+#include <QHash>
 #include <QIODevice>
 #include <QList>
 #include <QMessageBox>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QString>
 #include <QtGlobal>				// qPrintable, qDebug, qWarning
 #include <QUrl>
-#include <QXmlDefaultHandler>
-#include <QXmlSimpleReader>
-#include <QXmlInputSource>
 
 #include "zip.h"
 
+#include "bitfiddle.h"						// UINT16ARRAY, UINT32ARRAY
 #include "ebook_epub.h"						// ebook.h -> EBook, EBookIndexEntry, EBookTocEntry
 											// EBook_EPUB
 #include "helperxmlhandler_epubcontainer.h"	// HelperXmlHandler_EpubContainer
@@ -44,10 +47,125 @@
 
 const char * EBook_EPUB::URL_SCHEME_EPUB = "epub";
 
+// Read-only random access device over a single entry in the zip archive. Deflated entries
+// can only be read forward, so a backward seek reopens the entry and skips up to the
+// requested position using a fixed scratch buffer; memory use does not depend on the entry size.
+class EBook_EPUB_Stream : public QIODevice
+{
+	public:
+		EBook_EPUB_Stream( struct zip * archive, zip_uint64_t index, qint64 size, QMutex * lock )
+			: m_zipFile( archive ), m_index( index ), m_size( size ), m_archiveLock( lock ), m_file( 0 ), m_filePos( 0 )
+		{
+		}
+
+		~EBook_EPUB_Stream()
+		{
+			QMutexLocker locker( m_archiveLock );
+
+			if ( m_file )
+				zip_fclose( m_file );
+		}
+
+		bool isSequential() const
+		{
+			return false;
+		}
+
+		qint64 size() const
+		{
+			return m_size;
+		}
+
+	protected:
+		qint64 readData( char * data, qint64 maxlen )
+		{
+			qint64 left = m_size - pos();
+
+			if ( left <= 0 )
+				return left < 0 ? -1 : 0;
+
+			if ( maxlen > left )
+				maxlen = left;
+
+			QMutexLocker locker( m_archiveLock );
+
+			if ( !rewindTo( pos() ) )
+				return -1;
+
+			zip_int64_t got = zip_fread( m_file, data, maxlen );
+
+			if ( got <= 0 )
+			{
+				setErrorString( "Error decompressing the zip entry" );
+				return -1;
+			}
+
+			m_filePos += got;
+			return got;
+		}
+
+		qint64 writeData( const char *, qint64 )
+		{
+			return -1;
+		}
+
+	private:
+		// Positions the zip stream at offset, reopening it if we have to go back
+		bool rewindTo( qint64 offset )
+		{
+			if ( m_file && offset < m_filePos )
+			{
+				zip_fclose( m_file );
+				m_file = 0;
+			}
+
+			if ( !m_file )
+			{
+				m_file = zip_fopen_index( m_zipFile, m_index, 0 );
+				m_filePos = 0;
+
+				if ( !m_file )
+				{
+					setErrorString( "Could not open the zip entry" );
+					return false;
+				}
+			}
+
+			char scratch[ 16384 ];
+
+			while ( m_filePos < offset )
+			{
+				zip_int64_t got = zip_fread( m_file, scratch, qMin( (qint64) sizeof(scratch), offset - m_filePos ) );
+
+				if ( got <= 0 )
+				{
+					setErrorString( "Error decompressing the zip entry" );
+					return false;
+				}
+
+				m_filePos += got;
+			}
+
+			return true;
+		}
+
+		struct zip		*	m_zipFile;
+		zip_uint64_t		m_index;
+		qint64				m_size;
+		QMutex			*	m_archiveLock;
+
+		// Currently open entry and its read position
+		struct zip_file	*	m_file;
+		qint64				m_filePos;
+};
+
+
 EBook_EPUB::EBook_EPUB()
     : EBook()
 {
 	m_zipFile = 0;
+	m_mappedData = 0;
+	m_mappedSize = 0;
 }
 
 EBook_EPUB::~EBook_EPUB()
@@ -68,26 +186,35 @@ bool EBook_EPUB::load(const QString &archiveName)
 		return false;
 	}
 
-	// Open the ZIP archive: http://www.nih.at/libzip/zip_fdopen.html
-    // Note that zip_fdopen takes control over the passed descriptor,
-    // so we need to pass a duplicate of it for this to work correctly
-    int fdcopy = dup( m_epubFile.handle() );
+	// Map the whole file and let libzip read it from memory, so the entries are decompressed
+	// straight from the mapping instead of through read() calls.
+	if ( !openMappedArchive() )
+	{
+		// Open the ZIP archive: http://www.nih.at/libzip/zip_fdopen.html
+		// Note that zip_fdopen takes control over the passed descriptor,
+		// so we need to pass a duplicate of it for this to work correctly
+		int fdcopy = dup( m_epubFile.handle() );
 
-    if ( fdcopy < 0 )
-    {
-        qWarning("Could not duplicate descriptor" );
-        return false;
-    }
+		if ( fdcopy < 0 )
+		{
+			qWarning("Could not duplicate descriptor" );
+			return false;
+		}
 
-	int errcode;
-    m_zipFile = zip_fdopen( fdcopy, 0, &errcode );
+		int errcode;
+		m_zipFile = zip_fdopen( fdcopy, 0, &errcode );
 
-	if ( !m_zipFile )
-	{
-		qWarning("Could not open file %s: error %d", qPrintable(archiveName), errcode);
-		return false;
+		if ( !m_zipFile )
+		{
+			qWarning("Could not open file %s: error %d", qPrintable(archiveName), errcode);
+			return false;
+		}
 	}
 
+	// Index the archive, so the files are not looked up by name on every request
+	if ( !fillArchiveEntries() )
+		return false;
+
 	// Parse the book descriptor file
 	if ( !parseBookinfo() )
 		return false;
@@ -103,10 +230,57 @@ void EBook_EPUB::close()
 		m_zipFile = 0;
 	}
 
-    //if ( m_epubFile.isOpen() )
-    //	m_epubFile.close();
+	m_archiveEntries.clear();
 
+	if ( m_mappedData )
+	{
+		m_epubFile.unmap( m_mappedData );
+		m_mappedData = 0;
+		m_mappedSize = 0;
+	}
 
+	if ( m_epubFile.isOpen() )
+		m_epubFile.close();
+}
+
+bool EBook_EPUB::openMappedArchive()
+{
+	m_mappedSize = m_epubFile.size();
+	m_mappedData = m_epubFile.map( 0, m_mappedSize );
+
+	if ( !m_mappedData )
+	{
+		qDebug("Could not map file %s, reading it instead: %s", qPrintable( m_epubFile.fileName() ), qPrintable( m_epubFile.errorString() ) );
+		m_mappedSize = 0;
+		return false;
+	}
+
+	// http://www.nih.at/libzip/zip_source_buffer.html
+	zip_error_t error;
+	zip_error_init( &error );
+
+	zip_source_t * source = zip_source_buffer_create( m_mappedData, m_mappedSize, 0, &error );
+
+	if ( source )
+	{
+		// On success the archive owns the source
+		m_zipFile = zip_open_from_source( source, ZIP_RDONLY, &error );
+
+		if ( !m_zipFile )
+			zip_source_free( source );
+	}
+
+	if ( !m_zipFile )
+	{
+		qWarning("Could not open mapped file %s: %s", qPrintable( m_epubFile.fileName() ), zip_error_strerror( &error ) );
+
+		m_epubFile.unmap( m_mappedData );
+		m_mappedData = 0;
+		m_mappedSize = 0;
+	}
+
+	zip_error_fini( &error );
+	return m_zipFile != 0;
 }
 
 bool EBook_EPUB::getFileContentAsString(QString &str, const QUrl &url) const
@@ -119,6 +293,27 @@ bool EBook_EPUB::getFileContentAsBinary(QByteArray &data, const QUrl &url) const
 	return getFileAsBinary( data, urlToPath( url ) );
 }
 
+QIODevice * EBook_EPUB::getFileContentAsStream( const QUrl &url ) const
+{
+	ArchiveEntry entry;
+
+	if ( !locateFile( entry, urlToPath( url ) ) )
+		return 0;
+
+	// Stored entries are served directly from the mapping without a copy
+	if ( entry.rawOffset >= 0 )
+	{
+		QBuffer * buffer = new QBuffer();
+		buffer->setData( QByteArray::fromRawData( (const char*) m_mappedData + entry.rawOffset, entry.size ) );
+		buffer->open( QIODevice::ReadOnly );
+		return buffer;
+	}
+
+	EBook_EPUB_Stream * stream = new EBook_EPUB_Stream( m_zipFile, entry.index, entry.size, &m_archiveLock );
+	stream->open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+	return stream;
+}
+
 bool EBook_EPUB::enumerateFiles(QList<QUrl> &files)
 {
 	files = m_ebookManifest;
@@ -186,45 +381,30 @@ bool EBook_EPUB::isSupportedUrl(const QUrl &url)
 	return url.scheme() == URL_SCHEME_EPUB;
 }
 
-bool EBook_EPUB::parseXML(const QString &uri, QXmlDefaultHandler * parser)
+bool EBook_EPUB::parseBookinfo()
 {
-	QByteArray container;
-
-	if ( !getFileAsBinary( container, uri ) )
-	{
-		qDebug("Failed to retrieve XML file %s", qPrintable( uri ) );
-		return false;
-	}
-
-	// Use it as XML source
-	QXmlInputSource source;
-	source.setData( container );
-
-	// Init the reader
-	QXmlSimpleReader reader;
-	reader.setContentHandler( parser );
-	reader.setErrorHandler( parser );
+	QByteArray data;
 
-	return reader.parse( source );
-}
+	// The container and content paths are relative to the archive root
+	m_documentRoot.clear();
 
-bool EBook_EPUB::parseBookinfo()
-{
 	// Parse the container.xml to find the content descriptor
 	HelperXmlHandler_EpubContainer container_parser;
 
-	if ( !parseXML( "META-INF/container.xml", &container_parser )
-		 || container_parser.contentPath.isEmpty() )
+	if ( !getFileAsBinary( data, "META-INF/container.xml" )
+		 || !container_parser.parse( data ) )
 		return false;
 
 	// Parse the content.opf
 	HelperXmlHandler_EpubContent content_parser;
 
-	if ( !parseXML( container_parser.contentPath, &content_parser ) )
+	if ( !getFileAsBinary( data, container_parser.contentPath )
+		 || !content_parser.parse( data ) )
 		return false;
 
-	// At least title and the TOC must be present
-	if ( !content_parser.metadata.contains("title") || content_parser.tocname.isEmpty() )
+	// At least title and the TOC (NCX or EPUB3 navigation document) must be present
+	if ( !content_parser.metadata.contains("title")
+		 || ( content_parser.tocname.isEmpty() && content_parser.navname.isEmpty() ) )
 		return false;
 
 	// All the files, including TOC, are relative to the container_parser.contentPath
@@ -234,10 +414,18 @@ bool EBook_EPUB::parseBookinfo()
 	if ( sep != -1 )
 		m_documentRoot = container_parser.contentPath.left( sep + 1 );	// Keep the trailing slash
 
-	// Parse the TOC
-	HelperXmlHandler_EpubTOC toc_parser( this );
+	// From now on the entries are looked up by the document paths
+	rebaseArchiveEntries();
+
+	// Parse the TOC. NCX is preferred when both are present, so EPUB2-compatible books keep their TOC.
+	// The links inside are relative to the TOC file location.
+	QString tocname = content_parser.tocname.isEmpty() ? content_parser.navname : content_parser.tocname;
+	int tocsep = tocname.lastIndexOf( '/' );
 
-	if ( !parseXML( content_parser.tocname, &toc_parser ) )
+	HelperXmlHandler_EpubTOC toc_parser( this, tocsep != -1 ? tocname.left( tocsep + 1 ) : QString() );
+
+	if ( !getFileAsBinary( data, tocname )
+		 || !toc_parser.parse( data ) )
 		return false;
 
 	// Get the data
@@ -348,42 +536,173 @@ bool EBook_EPUB::getFileAsString(QString &str, const QString &path) const
 	return true;
 }
 
-bool EBook_EPUB::getFileAsBinary(QByteArray &data, const QString &path) const
+bool EBook_EPUB::fillArchiveEntries()
 {
-	// Retrieve the file size
-	struct zip_stat fileinfo;
-	QString completeUrl;
+	m_archiveEntries.clear();
+
+	// http://www.nih.at/libzip/zip_get_num_entries.html
+	zip_int64_t entries = zip_get_num_entries( m_zipFile, 0 );
+
+	if ( entries < 0 )
+		return false;
+
+	m_archiveEntries.reserve( entries );
+
+	for ( zip_int64_t i = 0; i < entries; i++ )
+	{
+		struct zip_stat fileinfo;
+
+		if ( zip_stat_index( m_zipFile, i, 0, &fileinfo ) != 0 )
+			continue;
+
+		// Make sure the name and size fields are valid
+		if ( (fileinfo.valid & ZIP_STAT_NAME) == 0 || (fileinfo.valid & ZIP_STAT_SIZE) == 0 )
+			continue;
+
+		ArchiveEntry entry;
+		entry.index = i;
+		entry.size = fileinfo.size;
+		entry.rawOffset = -1;
+
+		m_archiveEntries.insert( archiveKey( QString::fromUtf8( fileinfo.name ) ), entry );
+	}
+
+	if ( m_mappedData )
+		fillStoredEntryOffsets();
+
+	return true;
+}
+
+void EBook_EPUB::fillStoredEntryOffsets()
+{
+	// libzip does not tell where the entry data is located, so walk the central directory ourselves.
+	// See APPNOTE.TXT, sections 4.3.7, 4.3.12 and 4.3.16. ZIP64 archives are left to libzip.
+	const uchar * data = m_mappedData;
+	qint64 eocd = m_mappedSize - 22;
+	qint64 eocdLimit = qMax( (qint64) 0, eocd - 65535 );
+
+	// End of central directory record could be followed by the comment up to 64K
+	while ( eocd >= eocdLimit && UINT32ARRAY( data + eocd ) != 0x06054b50 )
+		eocd--;
 
-	if ( !path.isEmpty() && path[0] == '/' )
-		completeUrl = m_documentRoot + path.mid( 1 );
-	else
-		completeUrl = m_documentRoot + path;
+	if ( eocd < eocdLimit )
+		return;
 
-	//qDebug("URL requested: %s (%s)", qPrintable(path), qPrintable(completeUrl));
+	unsigned int entries = UINT16ARRAY( data + eocd + 10 );
+	qint64 offset = UINT32ARRAY( data + eocd + 16 );
 
-	// http://www.nih.at/libzip/zip_stat.html
-	if ( zip_stat( m_zipFile, completeUrl.toUtf8().constData(), 0, &fileinfo) != 0 )
+	for ( unsigned int i = 0; i < entries; i++ )
 	{
-		qDebug("File %s is not found in the archive", qPrintable(completeUrl));
+		// Central directory file header
+		if ( offset + 46 > m_mappedSize || UINT32ARRAY( data + offset ) != 0x02014b50 )
+			return;
+
+		const uchar * hdr = data + offset;
+		unsigned int flags = UINT16ARRAY( hdr + 8 );
+		unsigned int method = UINT16ARRAY( hdr + 10 );
+		qint64 compsize = UINT32ARRAY( hdr + 20 );
+		qint64 size = UINT32ARRAY( hdr + 24 );
+		unsigned int namelen = UINT16ARRAY( hdr + 28 );
+		qint64 localoffset = UINT32ARRAY( hdr + 42 );
+
+		if ( offset + 46 + namelen > m_mappedSize )
+			return;
+
+		QByteArray name( (const char*) hdr + 46, namelen );
+		offset += 46 + namelen + UINT16ARRAY( hdr + 30 ) + UINT16ARRAY( hdr + 32 );
+
+		// Only stored, unencrypted entries could be served from the mapping as-is
+		if ( method != ZIP_CM_STORE || (flags & 0x01) != 0 || compsize != size || size == 0xFFFFFFFF )
+			continue;
+
+		// Local file header; its extra field may differ from the central directory one
+		if ( localoffset + 30 > m_mappedSize || UINT32ARRAY( data + localoffset ) != 0x04034b50 )
+			continue;
+
+		qint64 dataoffset = localoffset + 30 + UINT16ARRAY( data + localoffset + 26 ) + UINT16ARRAY( data + localoffset + 28 );
+
+		if ( dataoffset + size > m_mappedSize )
+			continue;
+
+		// Names which libzip had to recode do not match and are simply read through libzip
+		QHash< QString, ArchiveEntry >::iterator it = m_archiveEntries.find( archiveKey( QString::fromUtf8( name ) ) );
+
+		if ( it != m_archiveEntries.end() && it.value().size == size )
+			it.value().rawOffset = dataoffset;
+	}
+}
+
+QString EBook_EPUB::archiveKey( const QString& name )
+{
+	return QDir::cleanPath( '/' + name );
+}
+
+void EBook_EPUB::rebaseArchiveEntries()
+{
+	if ( m_documentRoot.isEmpty() )
+		return;
+
+	// The files outside the document root could not be addressed by the URLs anyway
+	QString root = archiveKey( m_documentRoot );
+	QHash< QString, ArchiveEntry > entries;
+	entries.reserve( m_archiveEntries.size() );
+
+	for ( QHash< QString, ArchiveEntry >::const_iterator it = m_archiveEntries.constBegin(); it != m_archiveEntries.constEnd(); ++it )
+	{
+		if ( it.key().startsWith( root ) && it.key().length() > root.length() && it.key()[ root.length() ] == '/' )
+			entries.insert( it.key().mid( root.length() ), it.value() );
+	}
+
+	m_archiveEntries.swap( entries );
+}
+
+bool EBook_EPUB::locateFile( ArchiveEntry& entry, const QString &path ) const
+{
+	// The URL paths already start with a slash, only the paths used while loading need it
+	QHash< QString, ArchiveEntry >::const_iterator it = path.startsWith( '/' )
+			? m_archiveEntries.constFind( path )
+			: m_archiveEntries.constFind( '/' + path );
+
+	if ( it == m_archiveEntries.constEnd() )
+	{
+		qDebug("File %s is not found in the archive", qPrintable(path));
 		return false;
 	}
 
-	// Make sure the size field is valid
-	if ( (fileinfo.valid & ZIP_STAT_SIZE) == 0 || (fileinfo.valid & ZIP_STAT_INDEX) == 0 )
+	entry = it.value();
+	return true;
+}
+
+bool EBook_EPUB::getFileAsBinary(QByteArray &data, const QString &path) const
+{
+	ArchiveEntry entry;
+
+	if ( !locateFile( entry, path ) )
 		return false;
 
+	// Stored entries are copied straight from the mapping. The data is not shared with the
+	// mapping, as the caller may keep it after the ebook is closed.
+	if ( entry.rawOffset >= 0 )
+	{
+		data = QByteArray( (const char*) m_mappedData + entry.rawOffset, entry.size );
+		return true;
+	}
+
+	// libzip archives are not thread-safe
+	QMutexLocker locker( &m_archiveLock );
+
 	// Open the file
-	struct zip_file * file = zip_fopen_index( m_zipFile, fileinfo.index, 0 );
+	struct zip_file * file = zip_fopen_index( m_zipFile, entry.index, 0 );
 
 	if ( !file )
 		return false;
 
 	// Allocate the memory and read the file
-	data.resize( fileinfo.size );
+	data.resize( entry.size );
 
-	// Could it return a positive number but not fileinfo.size???
-	int ret = zip_fread( file, data.data(), fileinfo.size );
-	if ( ret != (int) fileinfo.size )
+	// Could it return a positive number but not entry.size???
+	zip_int64_t ret = zip_fread( file, data.data(), entry.size );
+	if ( ret != entry.size )
 	{
 		zip_fclose( file );
 		return false;
@@ -19,15 +19,17 @@
 #ifndef EBOOK_EPUB_H
 #define EBOOK_EPUB_H
 
+#include <QByteArray>
 #include <QFile>
+#include <QHash>
 #include <QList>
 #include <QMap>
+#include <QMutex>
 #include <QString>
 #include <QUrl>
 
 #include "ebook.h"
 
-class QXmlDefaultHandler;
 struct zip;
 
 
@@ -129,6 +131,17 @@ class EBook_EPUB : public EBook
 		 */
 		virtual bool getFileContentAsBinary( QByteArray& data, const QUrl& url ) const;
 
+		/*!
+		 * \brief Opens the content from url in current ebook as a read-only stream.
+		 * \param url An URL in ebook file to retreive content from. Must be absolute.
+		 * \return The opened random-access device, or NULL if the url cannot be found. The caller owns the
+		 *         device and must delete it before the ebook is closed.
+		 *
+		 * \sa getFileContentAsBinary()
+		 * \ingroup dataretrieve
+		 */
+		virtual QIODevice * getFileContentAsStream( const QUrl& url ) const;
+
 		/*!
 		 * \brief Obtains the list of all the files (URLs) in current ebook archive. This is used in search
 		 * and to dump the e-book content.
@@ -177,8 +190,14 @@ class EBook_EPUB : public EBook
 		QString urlToPath( const QUrl& link ) const;
 
 	private:
-		// Parses the XML file using a specified parser
-		bool	parseXML( const QString& uri, QXmlDefaultHandler * reader );
+		// Location of a file in the ZIP archive
+		class ArchiveEntry
+		{
+			public:
+				quint64		index;	// zip index
+				qint64		size;	// uncompressed size
+				qint64		rawOffset;	// offset of the stored data in the mapped file, -1 if compressed or not mapped
+		};
 
 		// Parses the book description file. Fills up the ebook info
 		bool	parseBookinfo();
@@ -187,10 +206,40 @@ class EBook_EPUB : public EBook
 		bool	getFileAsString( QString& str, const QString& path ) const;
 		bool	getFileAsBinary( QByteArray& data, const QString& path ) const;
 
+		// Maps the file and opens it as a ZIP archive from memory
+		bool	openMappedArchive();
+
+		// Fills the archive entry table from the ZIP central directory
+		bool	fillArchiveEntries();
+
+		// Finds the data offsets of the stored entries in the mapped file
+		void	fillStoredEntryOffsets();
+
+		// Makes the archive entry key from the path: cleaned up, with a leading slash
+		static QString	archiveKey( const QString& name );
+
+		// Makes the entry keys relative to the document root, once it is known
+		void	rebaseArchiveEntries();
+
+		// Finds the archive entry for the path, relative to the document root
+		bool	locateFile( ArchiveEntry& entry, const QString& path ) const;
+
 		// ZIP archive fd and structs
 		QFile			m_epubFile;
 		struct zip *	m_zipFile;
 
+		// libzip is not thread-safe, all reads from m_zipFile are serialized by this lock
+		mutable QMutex	m_archiveLock;
+
+		// Whole file mapping, if the archive is opened from memory
+		uchar		*	m_mappedData;
+		qint64			m_mappedSize;
+
+		// Archive entries by their path relative to the document root, keyed like the URL paths
+		// ("/text/chapter1.html"), so the request path is looked up as is and the file is opened by index.
+		// Until the document root is known, the paths are relative to the archive root.
+		QHash< QString, ArchiveEntry >	m_archiveEntries;
+
 		// Ebook info
 		QString			m_title;
 		QString			m_documentRoot;
@@ -0,0 +1,215 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>	// memchr, strlen
+
+#include <QByteArray>	// qstrnicmp
+#include <QString>
+
+#include "helper_sitemapparser.h"
+
+
+// Tag name characters; everything else ends the tag word
+static inline bool isTagWordChar( char ch )
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9')
+			|| ch == '/' || (unsigned char) ch >= 0x80;
+}
+
+
+HelperSitemapParser::HelperSitemapParser( const QByteArray& data )
+{
+	m_tag = 0;
+	m_tagLength = 0;
+	m_wordLength = 0;
+	m_type = TAG_OTHER;
+	m_name = m_value = 0;
+	m_nameLength = m_valueLength = 0;
+
+	pushSource( data );
+}
+
+void HelperSitemapParser::pushSource( const QByteArray& data )
+{
+	Source src;
+	src.data = data;
+	src.pos = 0;
+
+	m_sources.push_back( src );
+}
+
+bool HelperSitemapParser::nextTag()
+{
+	m_tag = m_name = m_value = 0;
+	m_tagLength = m_wordLength = m_nameLength = m_valueLength = 0;
+	m_type = TAG_OTHER;
+
+	while ( !m_sources.isEmpty() )
+	{
+		Source& src = m_sources.last();
+		const char * data = src.data.constData();
+		int size = src.data.size();
+
+		const char * lt = (const char *) memchr( data + src.pos, '<', size - src.pos );
+
+		// This input is finished, continue with the one it was merged into
+		if ( !lt )
+		{
+			m_sources.removeLast();
+			continue;
+		}
+
+		int start = lt - data + 1;
+		int wordend = -1;
+		int i;
+
+		for ( i = start; i < size; i++ )
+		{
+			char ch = data[i];
+
+			// If a " or ' is found, skip to the next one.
+			if ( ch == '"' || ch == '\'' )
+			{
+				// find where quote ends, either by another quote, or by '>' symbol (some people don't know HTML)
+				const char * next = (const char *) memchr( data + i + 1, ch, size - i - 1 );
+
+				if ( !next )
+				{
+					next = (const char *) memchr( data + i + 1, '>', size - i - 1 );
+
+					if ( !next )
+					{
+						m_error = QString( "unterminated quote at offset %1" ).arg( i );
+						m_sources.clear();
+						return false;
+					}
+
+					i = next - data;
+					break;
+				}
+
+				i = next - data;
+			}
+			else if ( ch == '>' )
+				break;
+			else if ( wordend == -1 && !isTagWordChar( ch ) )
+				wordend = i;
+		}
+
+		m_tag = data + start;
+		m_tagLength = i - start;
+		m_wordLength = (wordend == -1 ? i : wordend) - start;
+		src.pos = i < size ? i + 1 : size;
+
+		if ( wordIs( "object" ) && findInTag( "text/sitemap", 0 ) != -1 )
+			m_type = TAG_OBJECT;
+		else if ( wordIs( "/object" ) )
+			m_type = TAG_OBJECT_END;
+		else if ( wordIs( "param" ) )
+		{
+			m_type = TAG_PARAM;
+			parseParam();
+		}
+		else if ( wordIs( "ul" ) )
+			m_type = TAG_UL;
+		else if ( wordIs( "/ul" ) )
+			m_type = TAG_UL_END;
+
+		return true;
+	}
+
+	return false;
+}
+
+QByteArray HelperSitemapParser::tag() const
+{
+	return QByteArray( m_tag, m_tagLength );
+}
+
+bool HelperSitemapParser::paramNameIs( const char * lowercase ) const
+{
+	int len = strlen( lowercase );
+	return m_name && m_nameLength == len && qstrnicmp( m_name, lowercase, len ) == 0;
+}
+
+QByteArray HelperSitemapParser::paramValue() const
+{
+	return QByteArray::fromRawData( m_value, m_valueLength );
+}
+
+bool HelperSitemapParser::wordIs( const char * lowercase ) const
+{
+	int len = strlen( lowercase );
+	return m_wordLength == len && qstrnicmp( m_tag, lowercase, len ) == 0;
+}
+
+int HelperSitemapParser::findInTag( const char * lowercase, int from ) const
+{
+	int len = strlen( lowercase );
+
+	for ( int i = from; i + len <= m_tagLength; i++ )
+	{
+		if ( qstrnicmp( m_tag + i, lowercase, len ) == 0 )
+			return i;
+	}
+
+	return -1;
+}
+
+int HelperSitemapParser::findInTag( char ch, int from ) const
+{
+	if ( from >= m_tagLength )
+		return -1;
+
+	const char * p = (const char *) memchr( m_tag + from, ch, m_tagLength - from );
+	return p ? p - m_tag : -1;
+}
+
+void HelperSitemapParser::parseParam()
+{
+	// <param name="Name" value="First Page">
+	int offset = findInTag( "name=", 0 );
+
+	if ( offset == -1 )
+		return;
+
+	int qbegin = findInTag( '"', offset + 5 );
+	int qend = qbegin == -1 ? -1 : findInTag( '"', qbegin + 1 );
+
+	if ( qend == -1 )
+		return;
+
+	m_name = m_tag + qbegin + 1;
+	m_nameLength = qend - qbegin - 1;
+
+	if ( (offset = findInTag( "value=", qend + 1 )) == -1 )
+		return;
+
+	// The value ends by the last quote, as it may contain unescaped quotes
+	qbegin = findInTag( '"', offset + 6 );
+	qend = m_tagLength - 1;
+
+	while ( qend > qbegin && m_tag[qend] != '"' )
+		qend--;
+
+	if ( qbegin == -1 || qend <= qbegin )
+		return;
+
+	m_value = m_tag + qbegin + 1;
+	m_valueLength = qend - qbegin - 1;
+}
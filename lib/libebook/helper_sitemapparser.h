@@ -0,0 +1,99 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HELPER_SITEMAPPARSER_H
+#define HELPER_SITEMAPPARSER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+
+//
+// This helper class splits the HHC/HHK sitemap files into tags. It works directly
+// over the raw bytes and returns the tag and parameter data as views into them,
+// so only the extracted values need to be decoded.
+//
+class HelperSitemapParser
+{
+	public:
+		enum TagType
+		{
+			TAG_OTHER,
+			TAG_OBJECT,		// <object type="text/sitemap">
+			TAG_OBJECT_END,	// </object>
+			TAG_PARAM,		// <param name="..." value="...">
+			TAG_UL,			// <ul>
+			TAG_UL_END		// </ul>
+		};
+
+		HelperSitemapParser( const QByteArray& data );
+
+		// Inserts the data at the current position; it is parsed before the rest of the current input.
+		// Used for MERGE.
+		void		pushSource( const QByteArray& data );
+
+		// Moves to the next tag. Returns false at the end of the input or if the input is malformed.
+		bool		nextTag();
+
+		// The current tag
+		TagType		tagType() const	{ return m_type; }
+		QByteArray	tag() const;
+
+		// For TAG_PARAM: whether both name and value are present, the name check and the raw value.
+		// The value is valid until the next call to nextTag().
+		bool		hasParam() const	{ return m_name != 0 && m_value != 0; }
+		bool		paramNameIs( const char * lowercase ) const;
+		QByteArray	paramValue() const;
+
+		// Returns the error message if nextTag() stopped on malformed input
+		bool		hasError() const	{ return !m_error.isEmpty(); }
+		QString		errorString() const	{ return m_error; }
+
+	private:
+		class Source
+		{
+			public:
+				QByteArray	data;
+				int			pos;
+		};
+
+		bool		wordIs( const char * lowercase ) const;
+		int			findInTag( const char * lowercase, int from ) const;
+		int			findInTag( char ch, int from ) const;
+		void		parseParam();
+
+		// Input stack; the last one is parsed first
+		QVector< Source >	m_sources;
+
+		// Current tag, without the angle brackets
+		const char	*	m_tag;
+		int				m_tagLength;
+		int				m_wordLength;
+		TagType			m_type;
+
+		// Current <param> name and value
+		const char	*	m_name;
+		int				m_nameLength;
+		const char	*	m_value;
+		int				m_valueLength;
+
+		QString			m_error;
+};
+
+#endif // HELPER_SITEMAPPARSER_H
@@ -16,23 +16,31 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QByteArray>
+#include <QLatin1String>
 #include <QString>
-#include <QXmlAttributes>
+#include <QtGlobal>			// qWarning
+#include <QXmlStreamReader>
 
 #include "helperxmlhandler_epubcontainer.h"
 
 
-bool HelperXmlHandler_EpubContainer::startElement(const QString &, const QString &, const QString &qName, const QXmlAttributes &atts)
+bool HelperXmlHandler_EpubContainer::parse( const QByteArray& data )
 {
-	if ( qName == "rootfile" )
-	{
-		int idx = atts.index( "full-path" );
+	QXmlStreamReader xml( data );
 
-		if ( idx == -1 )
-			return false;
+	while ( !xml.atEnd() )
+	{
+		if ( xml.readNext() != QXmlStreamReader::StartElement || xml.name() != QLatin1String( "rootfile" ) )
+			continue;
 
-		contentPath = atts.value( idx );
+		// The first rootfile is the default rendition, nothing else is needed from this file
+		contentPath = xml.attributes().value( "full-path" ).toString();
+		return !contentPath.isEmpty();
 	}
 
-	return true;
+	if ( xml.hasError() )
+		qWarning( "Error parsing container.xml: %s", qPrintable( xml.errorString() ) );
+
+	return false;
 }
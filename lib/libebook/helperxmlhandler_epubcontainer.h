@@ -20,16 +20,16 @@
 #define HELPERXMLHANDLER_EPUBCONTAINER_H
 
 #include <QString>
-#include <QXmlDefaultHandler>
 
-class QXmlAttributes;
+class QByteArray;
 
 
-class HelperXmlHandler_EpubContainer : public QXmlDefaultHandler
+// Parses META-INF/container.xml
+class HelperXmlHandler_EpubContainer
 {
 	public:
-		// Overridden members
-		bool startElement ( const QString & namespaceURI, const QString & localName, const QString & qName, const QXmlAttributes & atts );
+		// Parses the container file, returns false if it is not well-formed or has no rootfile
+		bool parse( const QByteArray& data );
 
 		// The content path
 		QString	contentPath;
@@ -16,83 +16,101 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <QtDebug>					// qDebug() <<
+#include <QByteArray>
+#include <QLatin1String>
 #include <QString>
-#include <QXmlAttributes>
+#include <QStringList>
+#include <QtGlobal>			// qWarning
+#include <QXmlStreamReader>
 
 #include "helperxmlhandler_epubcontent.h"
 
 
-HelperXmlHandler_EpubContent::HelperXmlHandler_EpubContent()
+bool HelperXmlHandler_EpubContent::parse( const QByteArray& data )
 {
-	m_state = STATE_NONE;
-}
-
-bool HelperXmlHandler_EpubContent::startElement(const QString &, const QString &localName, const QString &, const QXmlAttributes &atts)
-{
-	// <metadata> tag contains the medatada which goes into m_metadata
-	if ( localName == "metadata" )
-		m_state = STATE_IN_METADATA;
-	else if ( localName == "manifest" )
-		m_state = STATE_IN_MANIFEST;
-	else if ( localName == "spine" )
-		m_state = STATE_IN_SPINE;
-	// Now handle the states
-	else if ( m_state == STATE_IN_METADATA ) // we don't need to store the first 'metadata' here
-		m_tagname = localName;
-	else if ( m_state == STATE_IN_MANIFEST && localName == "item" )
+	enum State
 	{
-		int idx_id = atts.index( "id" );
-		int idx_href = atts.index( "href" );
-		int idx_mtype = atts.index( "media-type" );
+		STATE_NONE,
+		STATE_IN_METADATA,
+		STATE_IN_MANIFEST,
+		STATE_IN_SPINE
+	};
 
-		if ( idx_id == -1 || idx_href == -1 || idx_mtype == -1 )
-			return false;
+	QXmlStreamReader xml( data );
+	State state = STATE_NONE;
 
-		manifest[ atts.value( idx_id ) ] = atts.value( idx_href );
+	while ( !xml.atEnd() )
+	{
+		QXmlStreamReader::TokenType token = xml.readNext();
 
-		if ( atts.value( idx_mtype ) == "application/x-dtbncx+xml" )
-			tocname = atts.value( idx_href );
+		if ( token == QXmlStreamReader::EndElement )
+		{
+			if ( xml.name() == QLatin1String( "metadata" )
+			|| xml.name() == QLatin1String( "manifest" )
+			|| xml.name() == QLatin1String( "spine" ) )
+				state = STATE_NONE;
 
-		//qDebug() << "MANIFEST: " << atts.value( idx_id ) << "->" << atts.value( idx_href );
-	}
-	else if ( m_state == STATE_IN_SPINE && localName == "itemref" )
-	{
-		int idx = atts.index( "idref" );
+			continue;
+		}
 
-		if ( idx == -1 )
-			return false;
+		if ( token != QXmlStreamReader::StartElement )
+			continue;
+
+		// <metadata> tag contains the medatada which goes into m_metadata
+		if ( xml.name() == QLatin1String( "metadata" ) )
+			state = STATE_IN_METADATA;
+		else if ( xml.name() == QLatin1String( "manifest" ) )
+			state = STATE_IN_MANIFEST;
+		else if ( xml.name() == QLatin1String( "spine" ) )
+			state = STATE_IN_SPINE;
+		// Now handle the states
+		else if ( state == STATE_IN_METADATA )
+		{
+			QString tagname = xml.name().toString();
+			QString value = xml.readElementText( QXmlStreamReader::IncludeChildElements ).trimmed();
+
+			if ( value.isEmpty() )
+				continue;
+
+			// Some metadata may be duplicated; we concantenate them with |
+			if ( metadata.contains( tagname ) )
+			{
+				metadata[ tagname ].append( "|" );
+				metadata[ tagname ].append( value );
+			}
+			else
+				metadata[ tagname ] = value;
+		}
+		else if ( state == STATE_IN_MANIFEST && xml.name() == QLatin1String( "item" ) )
+		{
+			QString id = xml.attributes().value( "id" ).toString();
+			QString href = xml.attributes().value( "href" ).toString();
 
-		spine.push_back( atts.value( idx ) );
-		//qDebug() << "SPINE: " << atts.value( idx );
-	}
+			if ( id.isEmpty() || href.isEmpty() )
+				continue;
 
-	return true;
-}
+			manifest[ id ] = href;
 
-bool HelperXmlHandler_EpubContent::characters(const QString &ch)
-{
-	if ( m_state == STATE_IN_METADATA && !m_tagname.isEmpty() && !ch.trimmed().isEmpty() )
-	{
-		// Some metadata may be duplicated; we concantenate them with |
-		if ( metadata.contains( m_tagname ) )
-		{
-			metadata[ m_tagname ].append( "|" );
-			metadata[ m_tagname ].append( ch.trimmed() );
+			if ( xml.attributes().value( "media-type" ) == QLatin1String( "application/x-dtbncx+xml" ) )
+				tocname = href;
+
+			if ( xml.attributes().value( "properties" ).toString().split( ' ' ).contains( "nav" ) )
+				navname = href;
 		}
-		else
-			metadata[ m_tagname ] = ch.trimmed();
+		else if ( state == STATE_IN_SPINE && xml.name() == QLatin1String( "itemref" ) )
+		{
+			QString idref = xml.attributes().value( "idref" ).toString();
 
-		//qDebug() << "METATAG: " << m_tagname << " " << metadata[ m_tagname ];
+			if ( !idref.isEmpty() )
+				spine.push_back( idref );
+		}
 	}
 
-	return true;
-}
-
-bool HelperXmlHandler_EpubContent::endElement(const QString &, const QString &, const QString &qName)
-{
-	if ( qName == "manifest" || qName == "metadata" || qName == "spine" )
-		m_state = STATE_NONE;
+	if ( xml.hasError() )
+	{
+		qWarning( "Error parsing the package file: %s", qPrintable( xml.errorString() ) );
+		return false;
+	}
 
 	return true;
 }
@@ -22,15 +22,16 @@
 #include <QList>
 #include <QMap>
 #include <QString>
-#include <QXmlDefaultHandler>
 
-class QXmlAttributes;
+class QByteArray;
 
 
-class HelperXmlHandler_EpubContent : public QXmlDefaultHandler
+// Parses the OPF package document
+class HelperXmlHandler_EpubContent
 {
 	public:
-		HelperXmlHandler_EpubContent();
+		// Parses the package file, returns false if it is not well-formed
+		bool parse( const QByteArray& data );
 
 		// Keep the tag-associated metadata
 		QMap< QString, QString >	metadata;
@@ -44,22 +45,8 @@ class HelperXmlHandler_EpubContent : public QXmlDefaultHandler
 		// TOC (NCX) filename
 		QString						tocname;
 
-	private:
-		enum State
-		{
-			STATE_NONE,
-			STATE_IN_METADATA,
-			STATE_IN_MANIFEST,
-			STATE_IN_SPINE
-		};
-
-		bool startElement ( const QString & namespaceURI, const QString & localName, const QString & qName, const QXmlAttributes & atts );
-		bool characters(const QString &ch);
-		bool endElement(const QString &namespaceURI, const QString &localName, const QString &qName);
-
-		// Tracking
-		State		m_state;
-		QString		m_tagname;
+		// EPUB3 navigation document filename
+		QString						navname;
 };
 
 #endif // HELPERXMLHANDLER_EPUBCONTENT_H
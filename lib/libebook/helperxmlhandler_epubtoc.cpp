@@ -16,101 +16,164 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <QtDebug>			// qDebug() <<
+#include <QByteArray>
+#include <QDir>				// cleanPath
+#include <QLatin1String>
 #include <QString>
-#include <QXmlAttributes>
+#include <QtGlobal>			// qWarning
+#include <QXmlStreamAttribute>
+#include <QXmlStreamReader>
 
 #include "helperxmlhandler_epubtoc.h"	// ebook.h -> EBookTocEntry
 										// ebook_epub.h -> EBook_EPUB
 
-HelperXmlHandler_EpubTOC::HelperXmlHandler_EpubTOC(EBook_EPUB *epub)
+HelperXmlHandler_EpubTOC::HelperXmlHandler_EpubTOC( EBook_EPUB *epub, const QString& basePath )
 {
 	m_epub = epub;
-	m_inNavMap = false;
-	m_inText = false;
-	m_indent = 0;
+	m_basePath = basePath;
 }
 
-bool HelperXmlHandler_EpubTOC::startElement(const QString &, const QString &localName, const QString &, const QXmlAttributes &atts)
+bool HelperXmlHandler_EpubTOC::parse( const QByteArray& data )
 {
-//	qDebug() << "startElement " << " " << localName;
+	QXmlStreamReader xml( data );
 
-//	for ( int i = 0; i < atts.count(); i++ )
-//		qDebug() << "    " << atts.localName(i) << " " << atts.value(i);
-
-	if ( localName == "navMap" )
+	// The root element tells which kind of TOC this is
+	if ( xml.readNextStartElement() )
 	{
-		m_inNavMap = true;
-		return true;
+		if ( xml.name() == QLatin1String( "ncx" ) )
+			parseNCX( xml );
+		else if ( xml.name() == QLatin1String( "html" ) )
+			parseNav( xml );
 	}
 
-	if ( !m_inNavMap )
-		return true;
-
-	if ( localName == "navPoint" )
-		m_indent++;
-
-	if ( localName == "text" )
-		m_inText = true;
-
-	if ( localName == "content" )
+	if ( xml.hasError() )
 	{
-		int idx = atts.index( "src" );
-
-		if ( idx == -1 )
-			return false;
+		qWarning( "Error parsing the TOC file at line %d: %s", (int) xml.lineNumber(), qPrintable( xml.errorString() ) );
 
-		m_lastId = atts.value( idx );
-		checkNewTocEntry();
+		// XHTML navigation documents often use HTML entities, keep whatever was parsed before that
+		return !entries.isEmpty();
 	}
 
 	return true;
 }
 
-bool HelperXmlHandler_EpubTOC::characters(const QString &ch)
+void HelperXmlHandler_EpubTOC::parseNCX( QXmlStreamReader& xml )
 {
-	//	qDebug() << "characters" << " " << ch;
-	if ( m_inText )
-		m_lastTitle = ch;
+	bool inNavMap = false;
+	int indent = 0;
+	QString lastTitle;
 
-	checkNewTocEntry();
-	return true;
+	while ( !xml.atEnd() )
+	{
+		QXmlStreamReader::TokenType token = xml.readNext();
+
+		if ( token == QXmlStreamReader::EndElement )
+		{
+			if ( xml.name() == QLatin1String( "navMap" ) )
+				inNavMap = false;
+			else if ( xml.name() == QLatin1String( "navPoint" ) )
+				indent--;
+
+			continue;
+		}
+
+		if ( token != QXmlStreamReader::StartElement )
+			continue;
+
+		if ( xml.name() == QLatin1String( "navMap" ) )
+		{
+			inNavMap = true;
+			continue;
+		}
+
+		if ( !inNavMap )
+			continue;
+
+		if ( xml.name() == QLatin1String( "navPoint" ) )
+			indent++;
+		else if ( xml.name() == QLatin1String( "text" ) )
+			lastTitle = xml.readElementText();
+		else if ( xml.name() == QLatin1String( "content" ) )
+		{
+			// navLabel always precedes content in the navPoint
+			addEntry( lastTitle, xml.attributes().value( "src" ).toString(), indent - 1 );
+			lastTitle.clear();
+		}
+	}
 }
 
-bool HelperXmlHandler_EpubTOC::endElement(const QString& , const QString &localName, const QString &)
+void HelperXmlHandler_EpubTOC::parseNav( QXmlStreamReader& xml )
 {
-//	qDebug() << "endElement" << " " << qName;
+	int navDepth = 0;	// nesting of elements inside the TOC <nav>, 0 if outside
+	int olDepth = 0;
 
-	if ( localName == "navMap" )
+	while ( !xml.atEnd() )
 	{
-		m_inNavMap = false;
-		return true;
-	}
+		QXmlStreamReader::TokenType token = xml.readNext();
 
-	if ( localName == "navPoint" )
-		m_indent--;
+		if ( token == QXmlStreamReader::EndElement )
+		{
+			if ( navDepth == 0 )
+				continue;
 
-	if ( localName == "text" )
-		m_inText = false;
+			if ( xml.name() == QLatin1String( "ol" ) )
+				olDepth--;
 
-	return true;
+			// The document may contain other navs (landmarks, page-list), only the TOC is needed
+			if ( --navDepth == 0 )
+				return;
+
+			continue;
+		}
+
+		if ( token != QXmlStreamReader::StartElement )
+			continue;
+
+		if ( navDepth == 0 )
+		{
+			if ( xml.name() != QLatin1String( "nav" ) )
+				continue;
+
+			// <nav epub:type="toc">
+			Q_FOREACH( const QXmlStreamAttribute& attr, xml.attributes() )
+			{
+				if ( attr.name() == QLatin1String( "type" ) && attr.value().toString().split( ' ' ).contains( "toc" ) )
+					navDepth = 1;
+			}
+
+			continue;
+		}
+
+		navDepth++;
+
+		if ( xml.name() == QLatin1String( "ol" ) )
+			olDepth++;
+		else if ( xml.name() == QLatin1String( "a" ) )
+		{
+			QString href = xml.attributes().value( "href" ).toString();
+
+			// Consumes the end element as well
+			addEntry( xml.readElementText( QXmlStreamReader::IncludeChildElements ).simplified(), href, olDepth - 1 );
+			navDepth--;
+		}
+	}
 }
 
-void HelperXmlHandler_EpubTOC::checkNewTocEntry()
+void HelperXmlHandler_EpubTOC::addEntry( const QString& title, const QString& href, int indent )
 {
-	if ( !m_lastId.isEmpty() && !m_lastTitle.isEmpty() )
-	{
-		EBookTocEntry entry;
-		entry.name = m_lastTitle;
-		entry.url = m_epub->pathToUrl( m_lastId );
-		entry.iconid = EBookTocEntry::IMAGE_AUTO;
-		entry.indent = m_indent - 1;
+	if ( title.isEmpty() || href.isEmpty() )
+		return;
 
-		entries.push_back( entry );
+	QString path = m_basePath + href;
 
-		//qDebug() << "TOC entry: " << m_lastId << " :" << m_lastTitle << " :" << m_indent - 1;
+	if ( path.contains( "./" ) )
+		path = QDir::cleanPath( path );
 
-		m_lastId.clear();
-		m_lastTitle.clear();
-	}
+	EBookTocEntry entry;
+	entry.name = title;
+	entry.url = m_epub->pathToUrl( path );
+	entry.iconid = EBookTocEntry::IMAGE_AUTO;
+	entry.indent = qMax( indent, 0 );
+
+	entries.push_back( entry );
 }
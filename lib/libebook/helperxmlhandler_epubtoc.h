@@ -21,33 +21,33 @@
 
 #include <QList>
 #include <QString>
-#include <QXmlDefaultHandler>
 
 #include "ebook_epub.h"	// ebook.h -> EBookTocEntry
 						// EBook_EPUB
 
-class QXmlAttributes;
+class QByteArray;
+class QXmlStreamReader;
 
 
-class HelperXmlHandler_EpubTOC : public QXmlDefaultHandler
+// Parses the table of contents, either the NCX file (EPUB2) or the navigation document (EPUB3)
+class HelperXmlHandler_EpubTOC
 {
 	public:
-		HelperXmlHandler_EpubTOC( EBook_EPUB * epub );
+		// basePath is the directory of the TOC file relative to the document root, with the trailing slash.
+		// The links in the TOC are relative to it.
+		HelperXmlHandler_EpubTOC( EBook_EPUB * epub, const QString& basePath = QString() );
+
+		// Parses the TOC file, returns false if it is not well-formed and nothing could be recovered
+		bool parse( const QByteArray& data );
 
 		QList< EBookTocEntry >	entries;
 
 	private:
-		// Overridden members
-		bool startElement ( const QString & namespaceURI, const QString & localName, const QString & qName, const QXmlAttributes & atts );
-		bool characters(const QString &ch);
-		bool endElement(const QString &namespaceURI, const QString &localName, const QString &qName);
-		void checkNewTocEntry();
-
-		bool			m_inNavMap;
-		bool			m_inText;
-		unsigned int	m_indent;
-		QString			m_lastId;
-		QString			m_lastTitle;
+		void parseNCX( QXmlStreamReader& xml );
+		void parseNav( QXmlStreamReader& xml );
+		void addEntry( const QString& title, const QString& href, int indent );
+
+		QString			m_basePath;
 		EBook_EPUB	*	m_epub;
 };
 
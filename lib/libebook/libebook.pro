@@ -2,7 +2,7 @@
 TEMPLATE = lib
 TARGET = ebook
 CONFIG *= c++11 warn_on staticlib
-QT += widgets xml
+QT += widgets
 
 HEADERS += \
     bitfiddle.h \
@@ -13,6 +13,7 @@ HEADERS += \
     ebook_search.h \
     helper_entitydecoder.h \
     helper_search_index.h \
+    helper_sitemapparser.h \
     helperxmlhandler_epubcontainer.h \
     helperxmlhandler_epubcontent.h \
     helperxmlhandler_epubtoc.h
@@ -25,6 +26,7 @@ SOURCES += \
     ebook_search.cpp \
     helper_entitydecoder.cpp \
     helper_search_index.cpp \
+    helper_sitemapparser.cpp \
     helperxmlhandler_epubcontainer.cpp \
     helperxmlhandler_epubcontent.cpp \
     helperxmlhandler_epubtoc.cpp
@@ -53,6 +53,8 @@ Config::Config()
 	m_advUseInternalEditor = settings.value( "advanced/internaleditor", true ).toBool();
 	m_advLayoutDirectionRL = settings.value( "advanced/layoutltr", false ).toBool();
 	m_advAutodetectEncoding = settings.value( "advanced/autodetectenc", false ).toBool();
+	m_advTranscodeImages = settings.value( "advanced/transcodeimages", false ).toBool();
+	m_advTranscodeDownscale = settings.value( "advanced/transcodedownscale", false ).toBool();
 	m_advExternalEditorPath = settings.value( "advanced/editorpath", "/usr/bin/kate" ).toString();
 	m_toolbarMode = (Config::ToolbarMode) settings.value( "advanced/toolbarmode", TOOLBAR_LARGEICONSTEXT ).toInt();
 	m_lastOpenedDir = settings.value( "advanced/lastopendir", "." ).toString();
@@ -68,6 +70,8 @@ Config::Config()
 
     m_tocOpenAllEntries = settings.value( "browser/tocopenallentries", true ).toBool();
     m_tabUseSingleClick = settings.value( "browser/tabusesingleclick", true ).toBool();
+	m_browserHibernateMinutes = settings.value( "browser/hibernateminutes", 30 ).toInt();
+	m_browserMaxLoadedTabs = settings.value( "browser/maxloadedtabs", 10 ).toInt();
 
 	QDir dir;
 	dir.setPath (m_datapath);
@@ -89,6 +93,8 @@ void Config::save( )
 	settings.setValue( "advanced/internaleditor", m_advUseInternalEditor );
 	settings.setValue( "advanced/layoutltr", m_advLayoutDirectionRL );
 	settings.setValue( "advanced/autodetectenc", m_advAutodetectEncoding );
+	settings.setValue( "advanced/transcodeimages", m_advTranscodeImages );
+	settings.setValue( "advanced/transcodedownscale", m_advTranscodeDownscale );
 	settings.setValue( "advanced/editorpath", m_advExternalEditorPath );
 	settings.setValue( "advanced/toolbarmode", m_toolbarMode );
 	settings.setValue( "advanced/lastopendir", m_lastOpenedDir );
@@ -104,6 +110,8 @@ void Config::save( )
 
     settings.setValue( "browser/tocopenallentries", m_tocOpenAllEntries );
     settings.setValue( "browser/tabusesingleclick", m_tabUseSingleClick );
+	settings.setValue( "browser/hibernateminutes", m_browserHibernateMinutes );
+	settings.setValue( "browser/maxloadedtabs", m_browserMaxLoadedTabs );
 }
 
 QString Config::getEbookSettingFile(const QString &ebookfile ) const
@@ -121,3 +129,19 @@ QString Config::getEbookIndexFile(const QString &ebookfile) const
 
 	return prefix + ".idx";
 }
+
+QString Config::getEbookNavigationFile( const QString &ebookfile ) const
+{
+	QFileInfo finfo ( ebookfile );
+	QString prefix = pConfig->m_datapath + "/" + finfo.completeBaseName();
+
+	return prefix + ".navigation";
+}
+
+QString Config::getEbookImageCacheDir( const QString &ebookfile ) const
+{
+	QFileInfo finfo ( ebookfile );
+	QString prefix = pConfig->m_datapath + "/" + finfo.completeBaseName();
+
+	return prefix + ".images";
+}
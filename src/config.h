@@ -56,6 +56,12 @@ class Config
 		// Returns the index filename for this ebook
 		QString	getEbookIndexFile( const QString& ebookfile )  const;
 
+		// Returns the parsed contents and index snapshot filename for this ebook
+		QString	getEbookNavigationFile( const QString& ebookfile ) const;
+
+		// Returns the directory for the transcoded images of this ebook
+		QString	getEbookImageCacheDir( const QString& ebookfile ) const;
+
 	public:
 		QString				m_lastOpenedDir;
 		
@@ -76,11 +82,15 @@ class Config
         bool                m_browserHighlightSearchResults;
         bool                m_tocOpenAllEntries;
         bool                m_tabUseSingleClick;
+		int					m_browserHibernateMinutes;	// 0 never hibernates the idle tabs
+		int					m_browserMaxLoadedTabs;		// background tabs kept loaded; 0 is unlimited
 		
 		bool				m_advUseInternalEditor;
 		QString				m_advExternalEditorPath;
 		bool				m_advLayoutDirectionRL;
 		bool				m_advAutodetectEncoding;
+		bool				m_advTranscodeImages;
+		bool				m_advTranscodeDownscale;	// the converted images are not wider than the view
 
 	private:
 		QString				m_datapath;
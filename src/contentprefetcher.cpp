@@ -0,0 +1,326 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>		// std::sort
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMetaObject>
+#include <QPair>
+#include <QString>
+#include <QThreadPool>
+#include <QUrl>
+#include <Qt>				// Qt::QueuedConnection
+
+#include "contentprefetcher.h"
+#include "ebook.h"				// EBook
+#include "ebookreaders.h"		// EBookReaders
+#include "mainwindow.h"			// ::mainWindow
+#include "navigationpanel.h"	// NavigationPanel
+#include "resourcecache.h"		// ResourceCache
+#include "settings.h"			// Settings
+
+
+// Give the browser some time to request the images and styles of the page first
+static const int PREFETCH_DELAY = 300;
+
+// How much content a single round may load
+static const qint64 PREFETCH_BUDGET = 4 * 1024 * 1024;
+
+// How many links from the page, and frequently opened pages are prefetched
+static const int MAX_PREFETCH_LINKS = 8;
+static const int MAX_PREFETCH_FREQUENT = 3;
+
+// How many next pages are remembered for every page, and for how many pages
+static const int MAX_PAGE_TRANSITIONS = 8;
+static const int MAX_TRANSITION_PAGES = 1000;
+
+
+ContentPrefetcher::ContentPrefetcher( QObject * parent )
+	: QObject( parent )
+{
+	m_loaded = 0;
+	m_running = false;
+
+	m_delayTimer.setSingleShot( true );
+	m_delayTimer.setInterval( PREFETCH_DELAY );
+	connect( &m_delayTimer, SIGNAL(timeout()), this, SLOT(startNext()) );
+}
+
+void ContentPrefetcher::pageOpened( const QUrl& pageurl )
+{
+	// Moving between the anchors of the same page does not change anything
+	QUrl url = pageurl.adjusted( QUrl::RemoveFragment );
+
+	if ( url == m_currentPage || !::mainWindow->chmFile() || !::mainWindow->chmFile()->isSupportedUrl( url ) )
+		return;
+
+	if ( !m_currentPage.isEmpty() )
+		recordTransition( m_currentPage, url );
+
+	m_currentPage = url;
+
+	cancel();
+	m_seen.insert( url );
+
+	// The page itself is already in the cache, it is only scanned for the links,
+	// which are added when it is done
+	m_queue.append( url );
+
+	enqueue( ::mainWindow->navigator()->urlNextInToc( url ) );
+
+	// The pages the user went to from here before, most frequent first
+	const QHash<QString, quint32> targets = ::mainWindow->currentSettings()->m_pageTransitions.value( url.toString() );
+	QList< QPair<quint32, QString> > ranked;
+
+	for ( QHash<QString, quint32>::const_iterator it = targets.begin(); it != targets.end(); ++it )
+		ranked.append( qMakePair( it.value(), it.key() ) );
+
+	std::sort( ranked.begin(), ranked.end(),
+			   []( const QPair<quint32, QString>& a, const QPair<quint32, QString>& b ) { return a.first > b.first; } );
+
+	for ( int i = 0; i < ranked.size() && i < MAX_PREFETCH_FREQUENT; i++ )
+		enqueue( QUrl( ranked[i].second ) );
+
+	enqueue( ::mainWindow->navigator()->urlPrevInToc( url ) );
+
+	m_delayTimer.start();
+}
+
+void ContentPrefetcher::cancel()
+{
+	// The running job sees it and skips the work
+	m_round.ref();
+
+	m_delayTimer.stop();
+	m_queue.clear();
+	m_seen.clear();
+	m_loaded = 0;
+}
+
+void ContentPrefetcher::reset()
+{
+	cancel();
+	m_currentPage = QUrl();
+}
+
+void ContentPrefetcher::startNext()
+{
+	EBook * ebook = ::mainWindow->chmFile();
+
+	// One job at a time, so the browser requests do not wait for us
+	if ( m_running || m_queue.isEmpty() || m_loaded >= PREFETCH_BUDGET || !ebook )
+		return;
+
+	QUrl url = m_queue.takeFirst();
+	ContentPrefetchJob * job = new ContentPrefetchJob( this, ebook, url, ebook->currentEncoding(),
+													   ::mainWindow->resourceCache()->generation(),
+													   m_round.loadAcquire(), url == m_currentPage );
+
+	m_running = true;
+
+	// Below the default priority of the browser requests
+	::mainWindow->contentThreadPool()->start( job, -1 );
+}
+
+void ContentPrefetcher::jobFinished( ContentPrefetchJob * job )
+{
+	m_running = false;
+
+	// Results of the cancelled round are not interesting anymore
+	if ( job->m_round == m_round.loadAcquire() )
+	{
+		m_loaded += job->m_size;
+
+		for ( int i = 0; i < job->m_links.size(); i++ )
+			enqueue( job->m_links[i] );
+	}
+
+	// The new round may be waiting for the delay
+	if ( !m_delayTimer.isActive() )
+		startNext();
+}
+
+void ContentPrefetcher::enqueue( const QUrl& url )
+{
+	if ( url.isEmpty() )
+		return;
+
+	QUrl pageurl = url.adjusted( QUrl::RemoveFragment );
+
+	if ( m_seen.contains( pageurl ) )
+		return;
+
+	m_seen.insert( pageurl );
+	m_queue.append( pageurl );
+}
+
+void ContentPrefetcher::recordTransition( const QUrl& from, const QUrl& to )
+{
+	QHash<QString, quint32>& targets = ::mainWindow->currentSettings()->m_pageTransitions[ from.toString() ];
+	QString target = to.toString();
+
+	targets[ target ]++;
+
+	// Forget the least used one, but not the one just added
+	if ( targets.size() > MAX_PAGE_TRANSITIONS )
+	{
+		QHash<QString, quint32>::iterator rarest = targets.end();
+
+		for ( QHash<QString, quint32>::iterator it = targets.begin(); it != targets.end(); ++it )
+		{
+			if ( it.key() != target && (rarest == targets.end() || it.value() < rarest.value()) )
+				rarest = it;
+		}
+
+		targets.erase( rarest );
+	}
+
+	// Forget the least used pages, down to three quarters of the limit, so it is not done for every new page
+	Settings::page_transitions_t& pages = ::mainWindow->currentSettings()->m_pageTransitions;
+
+	if ( pages.size() > MAX_TRANSITION_PAGES )
+	{
+		QString source = from.toString();
+		QList< QPair<quint32, QString> > ranked;
+
+		for ( Settings::page_transitions_t::const_iterator it = pages.constBegin(); it != pages.constEnd(); ++it )
+		{
+			quint32 total = 0;
+
+			for ( QHash<QString, quint32>::const_iterator target = it.value().constBegin(); target != it.value().constEnd(); ++target )
+				total += target.value();
+
+			if ( it.key() != source )
+				ranked.append( qMakePair( total, it.key() ) );
+		}
+
+		std::sort( ranked.begin(), ranked.end(),
+				   []( const QPair<quint32, QString>& a, const QPair<quint32, QString>& b ) { return a.first < b.first; } );
+
+		for ( int i = 0; i < ranked.size() && pages.size() > MAX_TRANSITION_PAGES * 3 / 4; i++ )
+			pages.remove( ranked[i].second );
+	}
+}
+
+
+ContentPrefetchJob::ContentPrefetchJob( ContentPrefetcher * prefetcher, EBook * ebook, const QUrl& url, const QString& encoding,
+										unsigned int generation, int round, bool extractLinks )
+	: QObject(), QRunnable(), m_prefetcher( prefetcher ), m_ebook( ebook ), m_url( url ), m_encoding( encoding ),
+	  m_generation( generation ), m_round( round ), m_extractLinks( extractLinks )
+{
+	m_size = 0;
+
+	// Taken here, in the GUI thread, as the worker may only read the content through the ebook
+	m_scheme = ebook->homeUrl().scheme();
+
+	// Deleted from done()
+	setAutoDelete( false );
+}
+
+void ContentPrefetchJob::run()
+{
+	QByteArray data, mimetype;
+
+	// The user may have moved on while we were waiting in the queue
+	if ( m_round == m_prefetcher->m_round.loadAcquire() )
+	{
+		EBook * reader = ::mainWindow->ebookReaders()->acquire();
+
+		if ( ::mainWindow->resourceCache()->fetch( reader ? reader : m_ebook, m_url, m_encoding, m_generation, data, mimetype ) )
+		{
+			m_size = data.size();
+
+			if ( m_extractLinks && mimetype == "text/html" )
+				extractLinks( data );
+		}
+
+		::mainWindow->ebookReaders()->release( reader );
+	}
+
+	QMetaObject::invokeMethod( this, "done", Qt::QueuedConnection );
+}
+
+void ContentPrefetchJob::done()
+{
+	deleteLater();
+	m_prefetcher->jobFinished( this );
+}
+
+void ContentPrefetchJob::extractLinks( const QByteArray& data )
+{
+	// A full HTML parser is not needed to find the href attributes. Offsets are the same in both.
+	QByteArray lower = data.toLower();
+	int pos = 0;
+
+	while ( m_links.size() < MAX_PREFETCH_LINKS )
+	{
+		pos = lower.indexOf( "href", pos );
+
+		if ( pos < 0 )
+			break;
+
+		pos += 4;
+
+		while ( pos < data.size() && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\r' || data[pos] == '\n') )
+			pos++;
+
+		if ( pos >= data.size() || data[pos] != '=' )
+			continue;
+
+		pos++;
+
+		while ( pos < data.size() && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\r' || data[pos] == '\n') )
+			pos++;
+
+		if ( pos >= data.size() )
+			break;
+
+		int end;
+
+		if ( data[pos] == '"' || data[pos] == '\'' )
+		{
+			char quote = data[pos++];
+			end = data.indexOf( quote, pos );
+		}
+		else
+		{
+			for ( end = pos; end < data.size() && data[end] != ' ' && data[end] != '>'; end++ )
+				;
+		}
+
+		if ( end < 0 )
+			break;
+
+		QByteArray link = data.mid( pos, end - pos );
+		pos = end;
+
+		// Anchors in this page
+		if ( link.isEmpty() || link.startsWith( '#' ) )
+			continue;
+
+		QUrl url = m_url.resolved( QUrl( QString::fromUtf8( link ) ) ).adjusted( QUrl::RemoveFragment );
+
+		// External links, javascript: and such
+		if ( url == m_url || url.scheme() != m_scheme || m_links.contains( url ) )
+			continue;
+
+		m_links.append( url );
+	}
+}
@@ -0,0 +1,118 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTENTPREFETCHER_H
+#define CONTENTPREFETCHER_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QList>
+#include <QObject>
+#include <QRunnable>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+#include <QUrl>
+#include <QtGlobal>			// qint64
+
+class EBook;
+class ContentPrefetchJob;
+
+
+//! Loads the pages the user is likely to open next into the resource cache while the current one
+//! is being read: the neighbours in the table of contents, the pages most often opened after this one
+//! in the previous sessions, and the pages linked from it. Runs one low priority job at a time
+//! in the content thread pool, limited by a memory budget, and starts over on every navigation.
+class ContentPrefetcher : public QObject
+{
+	Q_OBJECT
+
+	public:
+		ContentPrefetcher( QObject * parent );
+
+		//! Called when a page is shown in the current browser. Records the transition
+		//! from the previous page and schedules the prefetch round for this one.
+		void	pageOpened( const QUrl& url );
+
+		//! Drops the scheduled prefetches; the running one is ignored when it finishes.
+		//! Must be called before the ebook is closed.
+		void	cancel();
+
+		//! Forgets the current page, so the next opened page does not record a transition
+		void	reset();
+
+	private slots:
+		void	startNext();
+
+	private:
+		friend class ContentPrefetchJob;
+
+		// Called from the GUI thread when the job is finished
+		void	jobFinished( ContentPrefetchJob * job );
+
+		void	enqueue( const QUrl& url );
+		void	recordTransition( const QUrl& from, const QUrl& to );
+
+		QUrl				m_currentPage;
+
+		// Prefetch round state
+		QAtomicInt			m_round;
+		QList<QUrl>			m_queue;
+		QSet<QUrl>			m_seen;
+		qint64				m_loaded;
+		bool				m_running;
+		QTimer				m_delayTimer;
+};
+
+
+//! A single prefetch in the content thread pool; optionally extracts the links from the page.
+class ContentPrefetchJob : public QObject, public QRunnable
+{
+	Q_OBJECT
+
+	public:
+		ContentPrefetchJob( ContentPrefetcher * prefetcher, EBook * ebook, const QUrl& url, const QString& encoding,
+							unsigned int generation, int round, bool extractLinks );
+
+		// Runs in the worker thread
+		void	run();
+
+	private slots:
+		// Runs in the GUI thread
+		void	done();
+
+	private:
+		void	extractLinks( const QByteArray& data );
+
+		friend class ContentPrefetcher;
+
+		ContentPrefetcher	*	m_prefetcher;
+		EBook				*	m_ebook;
+		QUrl					m_url;
+		QString					m_scheme;		// of the ebook URLs, the links with another one are skipped
+		QString					m_encoding;
+		unsigned int			m_generation;	// of the resource cache
+		int						m_round;
+		bool					m_extractLinks;
+
+		// Results
+		qint64					m_size;
+		QList<QUrl>				m_links;
+};
+
+#endif // CONTENTPREFETCHER_H
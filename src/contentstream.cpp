@@ -0,0 +1,112 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QIODevice>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QUrl>
+
+#include "contentstream.h"
+#include "ebook.h"				// EBook
+
+
+// All the streams which have not been deleted yet
+static QMutex 					openStreamsLock;
+static QSet<ContentStream*>		openStreams;
+
+
+ContentStream * ContentStream::open( EBook * ebook, const QUrl& url )
+{
+	QIODevice * source = ebook->getFileContentAsStream( url );
+
+	if ( !source )
+		return 0;
+
+	ContentStream * stream = new ContentStream( source );
+	stream->QIODevice::open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+	return stream;
+}
+
+void ContentStream::detachAll()
+{
+	QMutexLocker locker( &openStreamsLock );
+
+	for ( QSet<ContentStream*>::const_iterator it = openStreams.begin(); it != openStreams.end(); ++it )
+	{
+		QMutexLocker streamlocker( &(*it)->m_lock );
+
+		delete (*it)->m_source;
+		(*it)->m_source = 0;
+	}
+}
+
+ContentStream::ContentStream( QIODevice * source )
+	: m_source( source ), m_size( source->size() )
+{
+	QMutexLocker locker( &openStreamsLock );
+	openStreams.insert( this );
+}
+
+ContentStream::~ContentStream()
+{
+	QMutexLocker locker( &openStreamsLock );
+	openStreams.remove( this );
+
+	delete m_source;
+}
+
+bool ContentStream::isSequential() const
+{
+	return false;
+}
+
+qint64 ContentStream::size() const
+{
+	return m_size;
+}
+
+qint64 ContentStream::readData( char * data, qint64 maxlen )
+{
+	QMutexLocker locker( &m_lock );
+
+	if ( !m_source )
+	{
+		setErrorString( "The ebook has been closed" );
+		return -1;
+	}
+
+	// Seeking the ebook stream is cheap; it only decompresses when read
+	if ( m_source->pos() != pos() && !m_source->seek( pos() ) )
+	{
+		setErrorString( m_source->errorString() );
+		return -1;
+	}
+
+	qint64 got = m_source->read( data, maxlen );
+
+	if ( got < 0 )
+		setErrorString( m_source->errorString() );
+
+	return got;
+}
+
+qint64 ContentStream::writeData( const char *, qint64 )
+{
+	return -1;
+}
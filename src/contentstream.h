@@ -0,0 +1,61 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTENTSTREAM_H
+#define CONTENTSTREAM_H
+
+#include <QIODevice>
+#include <QMutex>
+#include <QtGlobal>			// qint64
+
+class QUrl;
+
+class EBook;
+
+
+//! Random access device over a file in the ebook, served to the browser for the audio and video,
+//! which are too large to be loaded in memory. The browser owns the device and may keep it after
+//! the ebook is closed, so the open streams are detached from the ebook by detachAll(),
+//! and report an error afterwards. Thread-safe.
+class ContentStream : public QIODevice
+{
+	public:
+		//! Returns the opened stream, or NULL if the url cannot be found
+		static ContentStream * open( EBook * ebook, const QUrl& url );
+
+		//! Must be called before the ebook is closed
+		static void	detachAll();
+
+		~ContentStream();
+
+		bool	isSequential() const;
+		qint64	size() const;
+
+	protected:
+		qint64	readData( char * data, qint64 maxlen );
+		qint64	writeData( const char * data, qint64 len );
+
+	private:
+		ContentStream( QIODevice * source );
+
+		QMutex			m_lock;		// guards m_source
+		QIODevice	*	m_source;
+		qint64			m_size;
+};
+
+#endif // CONTENTSTREAM_H
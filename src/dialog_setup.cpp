@@ -75,6 +75,8 @@ DialogSetup::DialogSetup(QWidget *parent)
 
 	boxAutodetectEncoding->setChecked( pConfig->m_advAutodetectEncoding );
 	boxLayoutDirectionRL->setChecked( pConfig->m_advLayoutDirectionRL );
+	boxTranscodeImages->setChecked( pConfig->m_advTranscodeImages );
+	boxTranscodeDownscale->setChecked( pConfig->m_advTranscodeDownscale );
 
 	// Browser settings
 	m_enableImages->setChecked( pConfig->m_browserEnableImages );
@@ -193,6 +195,10 @@ void DialogSetup::accept()
 	// Autodetect encoding
 	Check_Need_Restart( boxAutodetectEncoding, &pConfig->m_advAutodetectEncoding, &need_restart );
 
+	// Applied when the next file is opened
+	pConfig->m_advTranscodeImages = boxTranscodeImages->isChecked();
+	pConfig->m_advTranscodeDownscale = boxTranscodeDownscale->isChecked();
+
 	// Layout direction management
 	bool layout_rl = boxLayoutDirectionRL->isChecked();
 	
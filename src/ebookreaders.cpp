@@ -0,0 +1,109 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QMutexLocker>
+#include <QString>
+
+#include "ebook.h"				// EBook
+#include "ebookreaders.h"
+
+
+EBookReaders::EBookReaders()
+{
+	m_generation = 0;
+}
+
+EBookReaders::~EBookReaders()
+{
+	closeAll();
+}
+
+void EBookReaders::setFile( const QString& filename )
+{
+	QMutexLocker locker( &m_lock );
+
+	closeAll();
+	m_filename = filename;
+	m_generation++;
+}
+
+EBook * EBookReaders::acquire()
+{
+	QString filename;
+	unsigned int generation;
+
+	{
+		QMutexLocker locker( &m_lock );
+
+		if ( !m_idle.isEmpty() )
+		{
+			EBook * reader = m_idle.takeLast();
+			m_acquired.insert( reader, m_generation );
+			return reader;
+		}
+
+		filename = m_filename;
+		generation = m_generation;
+	}
+
+	if ( filename.isEmpty() )
+		return 0;
+
+	// Opening reads the archive directory, so it is done outside the lock
+	EBook * reader = EBook::loadFile( filename );
+
+	if ( !reader )
+		return 0;
+
+	QMutexLocker locker( &m_lock );
+
+	// The file was switched while this one was opening
+	if ( generation != m_generation )
+	{
+		locker.unlock();
+		delete reader;
+		return 0;
+	}
+
+	m_acquired.insert( reader, generation );
+	return reader;
+}
+
+void EBookReaders::release( EBook * reader )
+{
+	if ( !reader )
+		return;
+
+	QMutexLocker locker( &m_lock );
+
+	// The file was switched while it was being read
+	if ( m_acquired.take( reader ) != m_generation )
+	{
+		locker.unlock();
+		delete reader;
+		return;
+	}
+
+	m_idle.push_back( reader );
+}
+
+void EBookReaders::closeAll()
+{
+	while ( !m_idle.isEmpty() )
+		delete m_idle.takeLast();
+}
@@ -0,0 +1,68 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EBOOKREADERS_H
+#define EBOOKREADERS_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+class EBook;
+
+
+//! Private ebook instances for the worker threads. An EBook serializes all the archive reads
+//! of its instance, so the workers sharing the ebook opened in the GUI thread decompress one
+//! at a time. Each reader is another EBook instance of the same file, which is read in parallel
+//! with the others. The readers are reused, so there are never more of them than the workers
+//! reading at the same time. Only the content retrieval functions may be used on the readers.
+//! Thread-safe.
+class EBookReaders
+{
+	public:
+		EBookReaders();
+		~EBookReaders();
+
+		//! Sets the file to open the readers from, or an empty string. Closes the idle readers
+		//! of the previous file; the acquired ones are closed when they are released, so they
+		//! could still be read meanwhile.
+		void	setFile( const QString& filename );
+
+		//! Returns an idle reader, opening a new one if there is none. Returns NULL if no file
+		//! is set or it could not be opened; the caller then uses the shared ebook.
+		EBook *	acquire();
+
+		//! Returns the reader for reuse; NULL is ignored.
+		void	release( EBook * reader );
+
+	private:
+		void	closeAll();
+
+		QMutex				m_lock;
+		QString				m_filename;
+		QList< EBook * >	m_idle;
+
+		// Incremented by setFile(), so the readers opened for the previous file are not kept
+		unsigned int		m_generation;
+
+		// The generation of the acquired readers
+		QHash< EBook *, unsigned int >	m_acquired;
+};
+
+#endif // EBOOKREADERS_H
@@ -0,0 +1,353 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QObject>
+#include <QReadLocker>
+#include <QRunnable>
+#include <QString>
+#include <QTcpSocket>
+#include <QUrl>
+#include <QWriteLocker>
+
+#include "ebook.h"				// EBook
+#include "ebookreaders.h"		// EBookReaders
+#include "httpserver.h"
+#include "mimehelper.h"			// MimeHelper::mimeType
+
+
+// How long an idle keep-alive connection is kept open, and how often the shutdown is checked meanwhile
+static const int KEEPALIVE_TIMEOUT = 5000;
+static const int SHUTDOWN_POLL_INTERVAL = 250;
+
+// How long a client may take to accept the response
+static const int WRITE_TIMEOUT = 30000;
+
+// The limits are generous for the requests of the ordinary clients
+static const int MAX_REQUEST_HEADER_SIZE = 16384;
+static const int MAX_REQUESTS_PER_CONNECTION = 1000;
+
+// Every connection takes a thread while it is open; the idle keep-alive connections are closed
+// when more clients are waiting, so they do not stall behind them
+static const int MAX_CONNECTION_THREADS = 8;
+
+
+// A single client connection, served with the blocking socket in the pool thread
+class HttpConnection : public QRunnable
+{
+	public:
+		HttpConnection( HttpServer * server, qintptr descriptor )
+			: m_server( server ), m_descriptor( descriptor )
+		{
+		}
+
+		void	run();
+
+	private:
+		// Handles a single request; returns false if the connection must be closed
+		bool	handleRequest( const QByteArray& head );
+
+		// Waits for the more request data, checking whether the server is being shut down
+		bool	waitForRequest();
+
+		// Returns true if the If-None-Match header value lists the ETag
+		static bool	etagMatches( const QByteArray& ifnonematch, const QByteArray& etag );
+
+		bool	sendResponse( int status, const char * reason, const QList<QByteArray>& headers,
+							  const QByteArray& body, bool sendbody, bool keepalive );
+
+		HttpServer	*	m_server;
+		qintptr			m_descriptor;
+		QTcpSocket	*	m_socket;
+};
+
+
+void HttpConnection::run()
+{
+	m_server->m_queued.fetchAndAddOrdered( -1 );
+
+	QTcpSocket socket;
+
+	if ( !socket.setSocketDescriptor( m_descriptor ) )
+		return;
+
+	m_socket = &socket;
+
+	QByteArray buffer;
+	int served = 0;
+
+	while ( served < MAX_REQUESTS_PER_CONNECTION )
+	{
+		int end = buffer.indexOf( "\r\n\r\n" );
+
+		if ( end < 0 )
+		{
+			if ( buffer.size() > MAX_REQUEST_HEADER_SIZE || !waitForRequest() )
+				break;
+
+			buffer += socket.readAll();
+			continue;
+		}
+
+		QByteArray head = buffer.left( end );
+		buffer.remove( 0, end + 4 );
+		served++;
+
+		if ( !handleRequest( head ) )
+			break;
+	}
+
+	socket.disconnectFromHost();
+
+	if ( socket.state() != QAbstractSocket::UnconnectedState )
+		socket.waitForDisconnected( SHUTDOWN_POLL_INTERVAL );
+}
+
+bool HttpConnection::waitForRequest()
+{
+	for ( int waited = 0; waited < KEEPALIVE_TIMEOUT; waited += SHUTDOWN_POLL_INTERVAL )
+	{
+		if ( m_server->m_shutdown.loadAcquire() || m_socket->state() != QAbstractSocket::ConnectedState )
+			return false;
+
+		if ( m_socket->bytesAvailable() > 0 )
+			return true;
+
+		// The thread is handed over to the client waiting for it; this one reconnects when it needs to
+		if ( m_server->m_queued.loadAcquire() > 0 )
+			return false;
+
+		if ( m_socket->waitForReadyRead( SHUTDOWN_POLL_INTERVAL ) )
+			return true;
+	}
+
+	return false;
+}
+
+bool HttpConnection::etagMatches( const QByteArray& ifnonematch, const QByteArray& etag )
+{
+	QList<QByteArray> tags = ifnonematch.split( ',' );
+
+	for ( int i = 0; i < tags.size(); i++ )
+	{
+		QByteArray tag = tags[i].trimmed();
+
+		// The content is served as is, so the weak comparison is the same as the strong one
+		if ( tag.startsWith( "W/" ) )
+			tag.remove( 0, 2 );
+
+		if ( tag == etag || tag == "*" )
+			return true;
+	}
+
+	return false;
+}
+
+bool HttpConnection::handleRequest( const QByteArray& head )
+{
+	QList<QByteArray> lines = head.split( '\n' );
+	QList<QByteArray> request = lines.takeFirst().simplified().split( ' ' );
+
+	if ( request.size() != 3 || !request[2].startsWith( "HTTP/1." ) )
+		return sendResponse( 400, "Bad Request", QList<QByteArray>(), QByteArray(), true, false );
+
+	QHash<QByteArray, QByteArray> headers;
+
+	for ( int i = 0; i < lines.size(); i++ )
+	{
+		int colon = lines[i].indexOf( ':' );
+
+		if ( colon > 0 )
+			headers[ lines[i].left( colon ).trimmed().toLower() ] = lines[i].mid( colon + 1 ).trimmed();
+	}
+
+	const QByteArray& method = request[0];
+	bool sendbody = method != "HEAD";
+	QByteArray connection = headers.value( "connection" ).toLower();
+	bool keepalive = request[2] == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+
+	// The request bodies are not read, so the connection cannot be reused after them
+	if ( headers.value( "content-length", "0" ) != "0" || headers.contains( "transfer-encoding" ) )
+		keepalive = false;
+
+	if ( method != "GET" && method != "HEAD" )
+		return sendResponse( 405, "Method Not Allowed", QList<QByteArray>() << "Allow: GET, HEAD", QByteArray(), sendbody, keepalive );
+
+	// The query is meaningless for the ebook content
+	QByteArray path = request[1];
+	int query = path.indexOf( '?' );
+
+	if ( query >= 0 )
+		path.truncate( query );
+
+	if ( !path.startsWith( '/' ) )
+		return sendResponse( 400, "Bad Request", QList<QByteArray>(), QByteArray(), sendbody, false );
+
+	// The ebook state is taken under the lock, but the content is read outside it through
+	// the private reader, so setEBook() does not wait for the decompression, nor the reader opening
+	QReadLocker locker( &m_server->m_lock );
+
+	if ( !m_server->m_ebook )
+		return sendResponse( 503, "Service Unavailable", QList<QByteArray>(), QByteArray(), sendbody, keepalive );
+
+	if ( path == "/" )
+	{
+		QByteArray location = "Location: " + m_server->m_homePath;
+		return sendResponse( 302, "Found", QList<QByteArray>() << location, QByteArray(), sendbody, keepalive );
+	}
+
+	// ms-its:/path and epub:/path are served as http://host/path. The URL is built here the way
+	// pathToUrl() does, as the ebook itself may only be used for the content retrieval.
+	QUrl url;
+	url.setScheme( m_server->m_scheme );
+	url.setHost( m_server->m_scheme );
+	url.setPath( QUrl::fromPercentEncoding( path ) );
+
+	// The content never changes while the same version of the ebook is opened with the same encoding
+	QByteArray etag = '"' + QCryptographicHash::hash( (m_server->m_stamp + '\n' + m_server->m_encoding + '\n' + url.path()).toUtf8(),
+													  QCryptographicHash::Sha1 ).toHex() + '"';
+	QByteArray encoding = m_server->m_encoding.toLatin1();
+
+	locker.unlock();
+
+	// Opening the stream only resolves the file, nothing is decompressed yet. The private reader
+	// is closed on release if the ebook is changed meanwhile; without it, the shared ebook is read
+	// under the lock.
+	EBook * reader = m_server->m_readers->acquire();
+
+	if ( !reader )
+		locker.relock();
+
+	EBook * ebook = reader ? reader : m_server->m_ebook;
+	QIODevice * stream = ebook ? ebook->getFileContentAsStream( url ) : 0;
+	QByteArray data;
+	bool found = stream != 0;
+	bool notmodified = false;
+
+	// Even a matching ETag must not turn a missing file into 304
+	if ( found )
+	{
+		notmodified = etagMatches( headers.value( "if-none-match" ), etag );
+
+		if ( !notmodified )
+			data = stream->readAll();
+
+		delete stream;
+	}
+
+	m_server->m_readers->release( reader );
+
+	if ( !reader )
+		locker.unlock();
+
+	if ( !found )
+		return sendResponse( 404, "Not Found", QList<QByteArray>(), QByteArray(), sendbody, keepalive );
+
+	QList<QByteArray> responseheaders;
+	responseheaders << "ETag: " + etag << "Cache-Control: no-cache";
+
+	if ( notmodified )
+		return sendResponse( 304, "Not Modified", responseheaders, QByteArray(), false, keepalive );
+
+	QByteArray mimetype = MimeHelper::mimeType( url, data );
+
+	if ( mimetype == "text/js" )
+		mimetype = "application/javascript";
+	else if ( mimetype == "text/html" && !encoding.isEmpty() )
+		mimetype += "; charset=" + encoding;
+
+	responseheaders << "Content-Type: " + mimetype;
+	return sendResponse( 200, "OK", responseheaders, data, sendbody, keepalive );
+}
+
+bool HttpConnection::sendResponse( int status, const char * reason, const QList<QByteArray>& headers,
+								   const QByteArray& body, bool sendbody, bool keepalive )
+{
+	QByteArray response = "HTTP/1.1 " + QByteArray::number( status ) + ' ' + reason + "\r\n"
+						  "Server: uChmViewer\r\n";
+
+	for ( int i = 0; i < headers.size(); i++ )
+		response += headers[i] + "\r\n";
+
+	// 304 has no body, but Content-Length would describe the full one
+	if ( status != 304 )
+		response += "Content-Length: " + QByteArray::number( body.size() ) + "\r\n";
+
+	response += keepalive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+	m_socket->write( response );
+
+	if ( sendbody && status != 304 )
+		m_socket->write( body );
+
+	while ( m_socket->bytesToWrite() > 0 )
+	{
+		if ( !m_socket->waitForBytesWritten( WRITE_TIMEOUT ) )
+			return false;
+	}
+
+	return keepalive;
+}
+
+
+HttpServer::HttpServer( QObject * parent, EBookReaders * readers )
+	: QTcpServer( parent ), m_readers( readers )
+{
+	m_ebook = 0;
+	m_threadPool.setMaxThreadCount( MAX_CONNECTION_THREADS );
+}
+
+HttpServer::~HttpServer()
+{
+	close();
+
+	// The idle connections notice it within the poll interval
+	m_shutdown.storeRelease( 1 );
+	m_threadPool.waitForDone();
+}
+
+void HttpServer::setEBook( EBook * ebook, const QString& stamp, const QString& encoding )
+{
+	// Taken here, in the GUI thread, as the connection threads may not call the other ebook functions
+	QString scheme = ebook ? ebook->homeUrl().scheme() : QString();
+	QByteArray homepath = ebook ? ebook->homeUrl().toEncoded( QUrl::RemoveScheme | QUrl::RemoveAuthority | QUrl::RemoveFragment ) : QByteArray();
+
+	QWriteLocker locker( &m_lock );
+
+	m_ebook = ebook;
+	m_scheme = scheme;
+	m_homePath = homepath;
+	m_stamp = stamp;
+	m_encoding = encoding;
+}
+
+void HttpServer::setEncoding( const QString& encoding )
+{
+	QWriteLocker locker( &m_lock );
+	m_encoding = encoding;
+}
+
+void HttpServer::incomingConnection( qintptr socketDescriptor )
+{
+	m_queued.fetchAndAddOrdered( 1 );
+	m_threadPool.start( new HttpConnection( this, socketDescriptor ) );
+}
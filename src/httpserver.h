@@ -0,0 +1,78 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTPSERVER_H
+#define HTTPSERVER_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QReadWriteLock>
+#include <QString>
+#include <QTcpServer>
+#include <QThreadPool>
+#include <QtGlobal>			// qintptr
+
+class QObject;
+
+class EBook;
+class EBookReaders;
+
+
+//! Loopback HTTP/1.1 server exposing the opened ebook to the external clients (crawlers, link checkers,
+//! headless browsers). The ebook paths are served as the HTTP paths, with the MIME types and ETags;
+//! the keep-alive connections are handled by a pool of threads. Each request is read through a private
+//! reader of the ebook, so the connections decompress concurrently.
+class HttpServer : public QTcpServer
+{
+	public:
+		//! \param readers The private ebook readers for the connection threads
+		HttpServer( QObject * parent, EBookReaders * readers );
+		~HttpServer();
+
+		//! Sets the ebook to serve, or NULL. Waits for the requests to the previous ebook to finish.
+		//! The stamp identifies the ebook version, and is a part of the ETags.
+		//! Must be called from the GUI thread, as the ebook URL scheme is taken from the ebook here.
+		void	setEBook( EBook * ebook, const QString& stamp, const QString& encoding );
+
+		//! Must be called when the ebook encoding is changed
+		void	setEncoding( const QString& encoding );
+
+	protected:
+		void	incomingConnection( qintptr socketDescriptor );
+
+	private:
+		friend class HttpConnection;
+
+		QThreadPool			m_threadPool;
+		QAtomicInt			m_shutdown;
+
+		// The connections waiting for a pool thread
+		QAtomicInt			m_queued;
+		EBookReaders	*	m_readers;
+
+		// Guards the ebook, the requests are served under the read lock. The connection threads
+		// only use its content retrieval functions, and build the URLs from the scheme and home path.
+		QReadWriteLock		m_lock;
+		EBook			*	m_ebook;
+		QString				m_scheme;
+		QByteArray			m_homePath;
+		QString				m_stamp;
+		QString				m_encoding;
+};
+
+#endif // HTTPSERVER_H
@@ -0,0 +1,252 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QIODevice>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+#include <QUrl>
+#include <Qt>				// Qt::SmoothTransformation
+#include <QtGlobal>			// qPrintable, qWarning
+
+#include "imagetranscoder.h"
+
+
+// Converts a single image in the thread pool
+class ImageTranscodeJob : public QRunnable
+{
+	public:
+		ImageTranscodeJob( ImageTranscoder * transcoder, const QString& cachefile, int maxwidth, const QByteArray& data )
+			: m_transcoder( transcoder ), m_cacheFile( cachefile ), m_maxWidth( maxwidth ), m_data( data )
+		{
+		}
+
+		void run()
+		{
+			m_transcoder->transcode( m_cacheFile, m_maxWidth, m_data );
+
+			QMutexLocker locker( &m_transcoder->m_lock );
+			m_transcoder->m_pending.remove( m_cacheFile );
+		}
+
+	private:
+		ImageTranscoder	*	m_transcoder;
+		QString				m_cacheFile;
+		int					m_maxWidth;
+		QByteArray			m_data;
+};
+
+
+// Removes everything but the current version directory from the ebook cache directory
+class ImageCachePruneJob : public QRunnable
+{
+	public:
+		ImageCachePruneJob( const QString& cachedir, const QString& keep )
+			: m_cacheDir( cachedir ), m_keep( keep )
+		{
+		}
+
+		void run()
+		{
+			QFileInfoList entries = QDir( m_cacheDir ).entryInfoList( QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden );
+
+			for ( int i = 0; i < entries.size(); i++ )
+			{
+				if ( entries[i].fileName() == m_keep )
+					continue;
+
+				bool removed = entries[i].isDir()
+						? QDir( entries[i].filePath() ).removeRecursively()
+						: QFile::remove( entries[i].filePath() );
+
+				if ( !removed )
+					qWarning( "Could not remove stale image cache %s", qPrintable( entries[i].filePath() ) );
+			}
+		}
+
+	private:
+		QString				m_cacheDir;
+		QString				m_keep;
+};
+
+
+ImageTranscoder::ImageTranscoder( QThreadPool * pool )
+	: m_threadPool( pool )
+{
+	m_maxWidth = 0;
+}
+
+void ImageTranscoder::setCacheDirectory( const QString& path, const QString& stamp )
+{
+	QMutexLocker locker( &m_lock );
+
+	m_cacheDir = path;
+	m_stamp = stamp;
+
+	// The images of the changed file, or of the other widths, would never be used again
+	if ( !m_cacheDir.isEmpty() && QFileInfo( m_cacheDir ).isDir() )
+		m_threadPool->start( new ImageCachePruneJob( m_cacheDir, QFileInfo( versionDirectory() ).fileName() ), -1 );
+}
+
+void ImageTranscoder::setMaxWidth( int maxwidth )
+{
+	QMutexLocker locker( &m_lock );
+	m_maxWidth = maxwidth;
+}
+
+ImageTranscoder::Result ImageTranscoder::process( const QUrl& url, QByteArray& data, QByteArray& mimetype )
+{
+	if ( mimetype != "image/bmp" && mimetype != "image/gif" )
+		return KEPT;
+
+	QString cachefile;
+	int maxwidth;
+
+	{
+		QMutexLocker locker( &m_lock );
+
+		if ( m_cacheDir.isEmpty() )
+			return KEPT;
+
+		cachefile = cacheFile( url );
+		maxwidth = m_maxWidth;
+	}
+
+	// Converted before, or empty if it is kept as it is
+	QFile file( cachefile );
+
+	if ( file.open( QIODevice::ReadOnly ) )
+	{
+		if ( file.size() == 0 )
+			return KEPT;
+
+		data = file.readAll();
+		mimetype = "image/png";
+		return CONVERTED;
+	}
+
+	// Decoding a large image takes a while, so the GUI thread serves the original this time
+	if ( QThread::currentThread() == QCoreApplication::instance()->thread() )
+	{
+		QMutexLocker locker( &m_lock );
+
+		if ( !m_pending.contains( cachefile ) )
+		{
+			m_pending.insert( cachefile );
+			m_threadPool->start( new ImageTranscodeJob( this, cachefile, maxwidth, data ), -1 );
+		}
+
+		return DEFERRED;
+	}
+
+	if ( !transcode( cachefile, maxwidth, data ) )
+		return KEPT;
+
+	mimetype = "image/png";
+	return CONVERTED;
+}
+
+bool ImageTranscoder::transcode( const QString& cachefile, int maxwidth, QByteArray& data )
+{
+	QBuffer source( &data );
+	QImageReader reader( &source );
+
+	// Animations would lose all but the first frame
+	if ( reader.imageCount() > 1 )
+	{
+		keepOriginal( cachefile );
+		return false;
+	}
+
+	QImage image = reader.read();
+
+	if ( image.isNull() )
+	{
+		qWarning( "Could not decode image for %s: %s", qPrintable( cachefile ), qPrintable( reader.errorString() ) );
+		keepOriginal( cachefile );
+		return false;
+	}
+
+	if ( maxwidth > 0 && image.width() > maxwidth )
+		image = image.scaledToWidth( maxwidth, Qt::SmoothTransformation );
+
+	QByteArray png;
+	QBuffer output( &png );
+
+	if ( !output.open( QIODevice::WriteOnly ) || !image.save( &output, "PNG" ) )
+		return false;
+
+	// Small GIFs are often compressed better than PNG
+	if ( png.size() >= data.size() )
+	{
+		keepOriginal( cachefile );
+		return false;
+	}
+
+	QFileInfo finfo( cachefile );
+
+	if ( !QDir().mkpath( finfo.path() ) )
+	{
+		qWarning( "Could not create directory %s", qPrintable( finfo.path() ) );
+		return false;
+	}
+
+	// Another thread may be reading it, so it must never be seen half written
+	QSaveFile file( cachefile );
+
+	if ( !file.open( QIODevice::WriteOnly ) || file.write( png ) != png.size() || !file.commit() )
+	{
+		qWarning( "Could not write image %s: %s", qPrintable( cachefile ), qPrintable( file.errorString() ) );
+		return false;
+	}
+
+	data = png;
+	return true;
+}
+
+void ImageTranscoder::keepOriginal( const QString& cachefile )
+{
+	QFileInfo finfo( cachefile );
+	QSaveFile file( cachefile );
+
+	if ( !QDir().mkpath( finfo.path() ) || !file.open( QIODevice::WriteOnly ) || !file.commit() )
+		qWarning( "Could not write image %s: %s", qPrintable( cachefile ), qPrintable( file.errorString() ) );
+}
+
+QString ImageTranscoder::versionDirectory() const
+{
+	// The same image scaled differently is a different file
+	return m_cacheDir + "/" + m_stamp + "-" + QString::number( m_maxWidth );
+}
+
+QString ImageTranscoder::cacheFile( const QUrl& url ) const
+{
+	return versionDirectory() + "/" + QCryptographicHash::hash( url.toString().toUtf8(), QCryptographicHash::Sha1 ).toHex() + ".png";
+}
@@ -0,0 +1,83 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGETRANSCODER_H
+#define IMAGETRANSCODER_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+class QThreadPool;
+class QUrl;
+
+
+//! Converts the uncompressed BMP and single frame GIF images of the old books to PNG, optionally
+//! downscaled to the view width, and keeps the results in a per-book directory on disk, so the repeated
+//! views load small files. The images which are kept as they are (animations, undecodable, or not smaller
+//! as PNG) get an empty file instead, so they are not decoded again. The conversion itself is never done
+//! in the GUI thread: there the original is served, and the conversion is queued into the thread pool
+//! for the next time. Thread-safe.
+class ImageTranscoder
+{
+	public:
+		enum Result
+		{
+			KEPT,			//!< Not an image to convert, or kept as it is
+			CONVERTED,		//!< Replaced by the converted one
+			DEFERRED		//!< Kept this time, but converted in background; must not be cached
+		};
+
+		ImageTranscoder( QThreadPool * pool );
+
+		//! Sets the directory for the opened ebook; empty disables the conversion.
+		//! The stamp identifies the ebook version, so the images of the changed file are not reused.
+		//! The images of the other versions and widths are removed from the directory in background.
+		void	setCacheDirectory( const QString& path, const QString& stamp );
+
+		//! Sets the width to downscale the wider images to; 0 keeps the original size
+		void	setMaxWidth( int maxwidth );
+
+		//! Replaces the image by the converted one if it should be converted
+		Result	process( const QUrl& url, QByteArray& data, QByteArray& mimetype );
+
+	private:
+		friend class ImageTranscodeJob;
+
+		// Converts the image and stores the result; returns false if the image is kept as it is
+		bool	transcode( const QString& cachefile, int maxwidth, QByteArray& data );
+
+		// Stores the empty file for the image kept as it is
+		void	keepOriginal( const QString& cachefile );
+
+		// Directory of the current ebook version and width, must be called locked
+		QString	versionDirectory() const;
+
+		QString	cacheFile( const QUrl& url ) const;
+
+		QThreadPool			*	m_threadPool;
+
+		mutable QMutex			m_lock;
+		QString					m_cacheDir;
+		QString					m_stamp;
+		int						m_maxWidth;
+		QSet<QString>			m_pending;		// queued conversions
+};
+
+#endif // IMAGETRANSCODER_H
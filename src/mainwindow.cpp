@@ -31,6 +31,7 @@
 #include <QEvent>
 #include <QFile>
 #include <QFileInfo>
+#include <QHostAddress>
 #include <QIODevice>		// QIODevice::WriteOnly
 #include <QKeySequence>
 #include <QList>
@@ -39,8 +40,8 @@
 #include <QPixmap>
 #include <QProcess>
 #include <QProgressDialog>
+#include <QResizeEvent>
 #include <QSettings>
-#include <QSharedMemory>
 #include <QSize>
 #include <QShortcut>
 #include <QString>
@@ -51,6 +52,8 @@
 #include <QTemporaryFile>
 #include <QTextEdit>
 #include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
 #include <QTimer>
 #include <QUrl>
 #include <QVariant>
@@ -61,12 +64,20 @@
 #include "i18n.h"
 
 #include "config.h"				// pConfig
+#include "contentprefetcher.h"	// ContentPrefetcher
+#include "contentstream.h"		// ContentStream
 #include "dialog_setup.h"		// DialogSetup
 #include "ebook.h"				// EBook
+#include "ebookreaders.h"		// EBookReaders
+#include "httpserver.h"			// HttpServer
+#include "imagetranscoder.h"	// ImageTranscoder
 #include "mainwindow.h"			// MainWindow, QMainWindow
 #include "navigationpanel.h"	// NavigationPanel
+#include "opentiming.h"		// OpenTiming
 #include "recentfiles.h"		// RecentFiles
+#include "resourcecache.h"		// ResourceCache
 #include "settings.h"			// Settings
+#include "singleinstance.h"		// SingleInstance
 #include "textencodings.h"		// TextEncodings
 #include "toolbarmanager.h"		// ToolbarManager
 #include "ui_dialog_about.h"	// Ui::DialogAbout
@@ -75,8 +86,11 @@
 #include "viewwindowmgr.h"		// ViewWindowMgr
 
 
-// Maximum memory size for inter-application communication
-static const int SHARED_MEMORY_SIZE = 4096;
+// Total size of the browser content kept in memory
+static const int RESOURCE_CACHE_SIZE = 32 * 1024 * 1024;
+
+// The images are downscaled to the view width rounded up to this step
+static const int TRANSCODE_WIDTH_STEP = 256;
 
 static const unsigned int WINDOW_DEFAULT_X_SIZE = 900;
 static const unsigned int WINDOW_DEFAULT_Y_SIZE = 700;
@@ -103,7 +117,21 @@ MainWindow::MainWindow( const QStringList& arguments )
 	
 	m_ebookFile = 0;
 	m_autoteststate = STATE_OFF;
-    m_sharedMemory = 0;
+    m_singleInstance = 0;
+	m_httpServer = 0;
+
+	// Content is decompressed in the background. Each thread reads its own instance of the ebook,
+	// as EBook serializes the archive access
+	m_contentThreadPool = new QThreadPool( this );
+	m_contentThreadPool->setMaxThreadCount( qBound( 2, QThread::idealThreadCount(), 4 ) );
+	m_ebookReaders = new EBookReaders();
+
+	m_imageTranscoder = new ImageTranscoder( m_contentThreadPool );
+	m_resourceCache = new ResourceCache( RESOURCE_CACHE_SIZE, m_imageTranscoder );
+
+	// Created after the pool, so the pool waits for its jobs before it is deleted
+	m_contentPrefetcher = new ContentPrefetcher( this );
+	m_openTiming = new OpenTiming();
 
 	m_currentSettings = new Settings();
 		
@@ -158,7 +186,15 @@ MainWindow::~MainWindow()
 	while ( !m_tempFileKeeper.isEmpty() )
 		delete m_tempFileKeeper.takeFirst();
 
-    delete m_sharedMemory;
+	// The pool is deleted with the children, after the objects its jobs use
+	m_contentThreadPool->waitForDone();
+
+	// Its connections may still hold the readers
+	delete m_httpServer;
+    delete m_resourceCache;
+    delete m_imageTranscoder;
+    delete m_ebookReaders;
+    delete m_openTiming;
 }
 
 void MainWindow::launch()
@@ -185,78 +221,33 @@ bool MainWindow::hasSameTokenInstance()
     if ( token.isEmpty() )
         return false;
 
-    m_sharedMemory = new QSharedMemory( token );
+    m_singleInstance = new SingleInstance( token, this );
 
-    // If we can attach to it, the segment already exists
-    if ( m_sharedMemory->attach() )
+    // If another instance exists, it got our command-line
+    if ( m_singleInstance->start( m_arguments ) )
     {
-        // Another instance exists; send the command-line there
-        QByteArray args = m_arguments.join("|").toLocal8Bit();
-
-        if ( args.size() < SHARED_MEMORY_SIZE - 2 )
-        {
-            // Write the size first, then the string
-            if ( m_sharedMemory->lock() )
-            {
-                char * data = (char*) m_sharedMemory->data();
-                *((short*)data) = args.size();
-                memcpy( data + 2, args.data(), args.size() );
-
-                m_sharedMemory->unlock();
-            }
-            else
-                qDebug("failed to lock");
-        }
-
-        // Clean up
-        delete m_sharedMemory;
-        m_sharedMemory = 0;
+        delete m_singleInstance;
+        m_singleInstance = 0;
 
         return true;
     }
 
-    // Create a new segment
-    if ( !m_sharedMemory->create( SHARED_MEMORY_SIZE ) )
+    if ( !m_singleInstance->isListening() )
     {
         QMessageBox::critical( 0,
-                               i18n("Shared memory segment failed"),
-                               i18n("Failed to create a shared memory segment: %1").arg( m_sharedMemory->errorString()) );
+                               i18n("Single instance mode failed"),
+                               i18n("Failed to listen for the other instances: %1").arg( m_singleInstance->errorString()) );
         return false;
     }
 
-    // Set it up so our checker knows there's no data yet
-    *((short*) m_sharedMemory->data()) = 0;
-
-    // Recheck every second
-    QTimer * timer = new QTimer( this );
-    connect( timer, SIGNAL(timeout()), this, SLOT(checkForSharedMemoryMessage()));
-    timer->start(1000);
+    // The messages are handled as soon as they come
+    connect( m_singleInstance, SIGNAL(messageReceived(QStringList)), this, SLOT(onInstanceMessage(QStringList)) );
     return false;
 }
 
-void MainWindow::checkForSharedMemoryMessage()
+void MainWindow::onInstanceMessage( const QStringList& args )
 {
-    QStringList args;
-    m_sharedMemory->lock();
-
-    // Is there any data?
-    char * data = (char*) m_sharedMemory->data();
-
-    if ( data[0] != 0 || data[1] != 0 )
-    {
-        // Get the message length and the message
-        short len = *((short*) data);
-        args = QString::fromLocal8Bit( data + 2, len ).split( "|" );
-
-        // Clean up
-        *((short*) data) = 0;
-    }
-
-    m_sharedMemory->unlock();
-
-    // And process it if we find anything
-    if ( !args.isEmpty() )
-        parseCmdLineArgs( args, true );
+    parseCmdLineArgs( args, true );
 }
 
 bool MainWindow::loadFile ( const QString &loadFileName, bool call_open_page )
@@ -266,11 +257,17 @@ bool MainWindow::loadFile ( const QString &loadFileName, bool call_open_page )
 	// Strip file:// prefix if any
 	if ( fileName.startsWith( "file://" ) )
 		fileName.remove( 0, 7 );
-			
+
+	// Only what is needed to show the page is done here; the contents, index and the topic titles
+	// are loaded after it, and report their stages themselves
+	m_openTiming->start( fileName );
+
 	EBook * new_ebook = EBook::loadFile( fileName );
 	
 	if ( new_ebook )
 	{
+		m_openTiming->stage( "ebook loaded" );
+
 		// The new file is opened, so we can close the old one
 		if ( m_ebookFile )
 		{
@@ -280,6 +277,9 @@ bool MainWindow::loadFile ( const QString &loadFileName, bool call_open_page )
 	
 		m_ebookFile = new_ebook;
 		updateActions();
+
+		// The tab and search titles are looked up after the first page is shown; have it ready by then
+		m_ebookFile->prepareTopicLookup();
 		
 		// Show current encoding in status bar
 		if ( m_ebookFile->hasFeature( EBook::FEATURE_ENCODING ) )
@@ -297,6 +297,24 @@ bool MainWindow::loadFile ( const QString &loadFileName, bool call_open_page )
 		pConfig->m_lastOpenedDir = qf.dir().path();
 		m_ebookFileBasename = qf.fileName();
 
+		// The worker threads open their readers on the first request
+		m_ebookReaders->setFile( m_ebookFilename );
+
+		// The converted images of the changed file must not be reused. The width goes first,
+		// as the images of the other widths are removed with the directory set.
+		updateTranscodeWidth();
+
+		if ( pConfig->m_advTranscodeImages )
+			m_imageTranscoder->setCacheDirectory( pConfig->getEbookImageCacheDir( m_ebookFilename ),
+												  QString( "%1-%2" ).arg( qf.size() ).arg( qf.lastModified().toMSecsSinceEpoch() ) );
+		else
+			m_imageTranscoder->setCacheDirectory( QString(), QString() );
+
+		if ( m_httpServer )
+			m_httpServer->setEBook( m_ebookFile,
+									QString( "%1-%2" ).arg( qf.size() ).arg( qf.lastModified().toMSecsSinceEpoch() ),
+									m_ebookFile->currentEncoding() );
+
 		// Apply settings to the navigation dock
 		m_navPanel->updateTabs( m_ebookFile );
 
@@ -325,9 +343,8 @@ bool MainWindow::loadFile ( const QString &loadFileName, bool call_open_page )
 			{
 				m_viewWindowMgr->restoreSettings( m_currentSettings->m_viewwindows );
 				m_viewWindowMgr->setCurrentPage( m_currentSettings->m_activetabwindow );
-				
-				if ( m_ebookFile->hasFeature( EBook::FEATURE_TOC ) )
-					actionLocateInContentsTab();
+
+				// The opened page is located in the contents tab when they are loaded
 			}
 			
 			// Restore the main window size
@@ -346,12 +363,15 @@ bool MainWindow::loadFile ( const QString &loadFileName, bool call_open_page )
 				openPage( m_ebookFile->homeUrl() );
 		}
 
+		m_openTiming->stage( "settings and tabs restored" );
+
         // Disable the menu if ebook format doesn't support encoding changes
         view_Set_encoding_action->setEnabled( m_ebookFile->hasFeature( EBook::FEATURE_ENCODING ) );
 
 		if ( m_recentFiles )
 			m_recentFiles->setCurrentFile( m_ebookFilename );
 
+		m_openTiming->stage( "file opened" );
 		return true;
 	}
 	else
@@ -444,6 +464,9 @@ bool MainWindow::openPage( const QUrl& url, unsigned int flags )
 		return false; // do not change the current page.
 	}
 
+	// The user is going somewhere else; the new page schedules its own prefetch when loaded
+	m_contentPrefetcher->cancel();
+
     ViewWindow * vwnd = currentBrowser();
 
 	if ( flags & OPF_NEW_TAB )
@@ -487,6 +510,12 @@ void MainWindow::firstShow()
 void MainWindow::setTextEncoding( const QString& encoding )
 {
 	m_ebookFile->setCurrentEncoding( qPrintable( encoding ) );
+
+	// The cached pages carry the old charset
+	m_resourceCache->clear();
+
+	if ( m_httpServer )
+		m_httpServer->setEncoding( m_ebookFile->currentEncoding() );
 	
 	// Find the appropriate encoding item in "Set encodings" menu
 	const QList<QAction *> encodings = m_encodingActions->actions();
@@ -516,6 +545,21 @@ void MainWindow::setTextEncoding( const QString& encoding )
 
 void MainWindow::closeFile( )
 {
+	// The pending content requests must not outlive the ebook
+	m_contentPrefetcher->reset();
+	m_contentThreadPool->waitForDone();
+	m_resourceCache->clear();
+
+	// The browser may still hold the media streams
+	ContentStream::detachAll();
+
+	// Waits for the requests being served
+	if ( m_httpServer )
+		m_httpServer->setEBook( 0, QString(), QString() );
+
+	// Nobody is reading now
+	m_ebookReaders->setFile( QString() );
+
 	// Prepare the settings
 	if ( pConfig->m_HistoryStoreExtra )
 	{
@@ -566,6 +610,26 @@ void MainWindow::closeEvent ( QCloseEvent * e )
 	QMainWindow::closeEvent ( e );
 }
 
+void MainWindow::resizeEvent( QResizeEvent * e )
+{
+	QMainWindow::resizeEvent( e );
+	updateTranscodeWidth();
+}
+
+void MainWindow::updateTranscodeWidth()
+{
+	if ( !pConfig->m_advTranscodeDownscale )
+	{
+		m_imageTranscoder->setMaxWidth( 0 );
+		return;
+	}
+
+	// In device pixels, so the images stay sharp on HiDPI screens. Rounded up,
+	// so resizing the window does not make every image converted again.
+	int width = m_viewWindowMgr->width() * devicePixelRatio();
+	m_imageTranscoder->setMaxWidth( ( width / TRANSCODE_WIDTH_STEP + 1 ) * TRANSCODE_WIDTH_STEP );
+}
+
 void MainWindow::printHelpAndExit()
 {
     fprintf (stderr, "Usage: %s [options] [helpfile]\n"
@@ -575,6 +639,8 @@ void MainWindow::printHelpAndExit()
             "  -search <query>   searches for query in the Search tab, and activate the first entry if found\n"
             "  -token <token>    specifies the application token; see the integration reference\n"
             "  -background       start minimized\n"
+            "  -httpport <port>  serves the opened file over HTTP at 127.0.0.1:<port> to other programs\n"
+            "  -timing           prints the time spent in each stage of opening the file\n"
              , qPrintable( m_arguments[0] ) );
 
     exit (1);
@@ -582,7 +648,7 @@ void MainWindow::printHelpAndExit()
 
 bool MainWindow::parseCmdLineArgs(const QStringList& args , bool from_another_app )
 {
-    QString filename, search_query, search_index, open_url, search_toc;
+    QString filename, search_query, search_index, open_url, search_toc, http_port;
     bool do_autotest = false, force_background = false;
 
 	// argv[0] in Qt is still a program name
@@ -602,6 +668,10 @@ bool MainWindow::parseCmdLineArgs(const QStringList& args , bool from_another_ap
             i++; // ignore
         else if ( args[i] == "-background" )
             force_background = true;
+        else if ( args[i] == "-httpport" )
+            http_port = args[++i];
+        else if ( args[i] == "-timing" )
+            m_openTiming->setEnabled( true );
         else if ( args[i] == "-v" || args[i] == "--version" )
         {
             printf("uChmViewer version %d.%d built at %s %s\n", APP_VERSION_MAJOR, APP_VERSION_MINOR, __DATE__, __TIME__ );
@@ -627,6 +697,23 @@ bool MainWindow::parseCmdLineArgs(const QStringList& args , bool from_another_ap
         }
 	}
 
+    // Started before the file is opened, so it is served as soon as it is loaded
+    if ( !http_port.isEmpty() && !m_httpServer && !from_another_app )
+    {
+        m_httpServer = new HttpServer( this, m_ebookReaders );
+
+        if ( !m_httpServer->listen( QHostAddress::LocalHost, http_port.toUShort() ) )
+        {
+            fprintf( stderr, "Could not start the HTTP server on port %s: %s\n",
+                     qPrintable( http_port ), qPrintable( m_httpServer->errorString() ) );
+
+            delete m_httpServer;
+            m_httpServer = 0;
+        }
+        else
+            printf( "Serving the opened file at http://127.0.0.1:%d/\n", m_httpServer->serverPort() );
+    }
+
     // Opening the file?
 	if ( !filename.isEmpty() )
 	{
@@ -710,6 +797,9 @@ void MainWindow::onOpenPageInNewBackgroundTab( )
 void MainWindow::browserChanged(ViewWindow *newbrowser )
 {
 	m_navPanel->findUrlInContents( newbrowser->getOpenedPage() );
+
+	// Switching tabs is not following a link from the previous page
+	m_contentPrefetcher->reset();
 }
 
 bool MainWindow::event( QEvent * e )
@@ -36,13 +36,21 @@ class QAction;
 class QActionGroup;
 class QCloseEvent;
 class QMenu;
-class QSharedMemory;
+class QResizeEvent;
 class QTemporaryFile;
+class QThreadPool;
 class QUrl;
 
+class ContentPrefetcher;
+class EBookReaders;
+class HttpServer;
+class ImageTranscoder;
 class NavigationPanel;
+class OpenTiming;
 class RecentFiles;
+class ResourceCache;
 class Settings;
+class SingleInstance;
 class ToolbarManager;
 class ViewWindow;
 class ViewWindowMgr;
@@ -89,6 +97,22 @@ class MainWindow : public QMainWindow, public Ui::MainWindow
 		ViewWindowMgr*	viewWindowMgr() const { return m_viewWindowMgr; }
 		NavigationPanel * navigator() const { return m_navPanel; }
 
+		// Worker threads which read the ebook content for the browser. All jobs are finished
+		// before the ebook is closed, so they can safely use chmFile().
+		QThreadPool *	contentThreadPool() const { return m_contentThreadPool; }
+
+		// Private ebook instances for the worker threads, so they decompress in parallel
+		EBookReaders *	ebookReaders() const { return m_ebookReaders; }
+
+		// Content already served to the browser, shared by all tabs
+		ResourceCache *	resourceCache() const { return m_resourceCache; }
+
+		// Loads the likely next pages into the resource cache
+		ContentPrefetcher * contentPrefetcher() const { return m_contentPrefetcher; }
+
+		// Timing breakdown of opening the file, see the -timing option
+		OpenTiming *	openTiming() const { return m_openTiming; }
+
 		void		showInStatusBar (const QString& text);
 		void		setTextEncoding (const QString &enc);
 		QMenu * 	tabItemsContextMenu();
@@ -162,11 +186,12 @@ class MainWindow : public QMainWindow, public Ui::MainWindow
 		void 		firstShow();
 		
         // single app mode
-        void        checkForSharedMemoryMessage();
+        void        onInstanceMessage( const QStringList& args );
 
 	protected:
 		// Reimplemented functions
 		void		closeEvent ( QCloseEvent * e );
+		void		resizeEvent ( QResizeEvent * e );
 		bool		event ( QEvent * e );
 		
 	private:
@@ -175,6 +200,9 @@ class MainWindow : public QMainWindow, public Ui::MainWindow
 		void		setupLangEncodingMenu();
 		
 		bool		loadFile( const QString &fileName,  bool call_open_page = true );
+
+		// Tells the image transcoder the view width to downscale the images to, if enabled
+		void		updateTranscodeWidth();
 		void		closeFile();	
 		void		refreshCurrentBrowser();
 		
@@ -200,7 +228,17 @@ class MainWindow : public QMainWindow, public Ui::MainWindow
 		ToolbarManager		*	m_toolbarMgr;
 
         // For a single instance mode
-        QSharedMemory       *   m_sharedMemory;
+        SingleInstance      *   m_singleInstance;
+
+		QThreadPool			*	m_contentThreadPool;
+		EBookReaders		*	m_ebookReaders;
+		ImageTranscoder		*	m_imageTranscoder;
+		ResourceCache		*	m_resourceCache;
+		ContentPrefetcher	*	m_contentPrefetcher;
+		OpenTiming			*	m_openTiming;
+
+		// Serves the opened ebook to the external clients, if enabled from the command line
+		HttpServer			*	m_httpServer;
 
 		// Storage for built-in icons
 		QPixmap				 	m_builtinIcons[ EBookTocEntry::MAX_BUILTIN_ICONS ];
@@ -17,6 +17,7 @@
  */
 
 #include <QBuffer>
+#include <QLatin1String>
 #include <QString>
 #include <QUrl>
 
@@ -26,6 +27,19 @@
 // Yes, I know about std::isspace(), but it may depend on the locale.
 #define isspace(c) (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v')
 
+// "BM" alone is too short to tell a bitmap from a text, so check the size of the header which follows.
+static bool isBitmap(const QByteArray &buf)
+{
+    if (buf.size() < 18 || !buf.startsWith("BM"))
+        return false;
+
+    const unsigned char *header = (const unsigned char *) buf.constData();
+    unsigned int dibsize = header[14] | (header[15] << 8) | (header[16] << 16) | ((unsigned int) header[17] << 24);
+
+    return dibsize == 12 || dibsize == 40 || dibsize == 52 || dibsize == 56 || dibsize == 64
+            || dibsize == 108 || dibsize == 124;
+}
+
 QByteArray MimeHelper::mimeType(const QUrl &url, const QByteArray &buf)
 {
     QString path = url.path().toLower();
@@ -35,6 +49,16 @@ QByteArray MimeHelper::mimeType(const QUrl &url, const QByteArray &buf)
         return "text/css";
     else if (path.endsWith(".js"))
         return "text/js";
+
+    // Images are recognized by their signatures; old books often have wrong extensions.
+    if (buf.startsWith("GIF87a") || buf.startsWith("GIF89a"))
+        return "image/gif";
+    else if (buf.startsWith("\x89PNG\r\n\x1A\n"))
+        return "image/png";
+    else if (buf.startsWith("\xFF\xD8\xFF"))
+        return "image/jpeg";
+    else if (isBitmap(buf))
+        return "image/bmp";
     
     /* BOM          Encoding Form
      * 00 00 FE FF 	UTF-32, big-endian
@@ -76,3 +100,35 @@ QByteArray MimeHelper::mimeType(const QUrl &url, const QByteArray &buf)
 
     return "application/octet-stream";
 }
+
+QByteArray MimeHelper::mediaType(const QUrl &url)
+{
+    static const char * const types[][2] = {
+        { ".mp4", "video/mp4" },
+        { ".m4v", "video/mp4" },
+        { ".webm", "video/webm" },
+        { ".ogv", "video/ogg" },
+        { ".avi", "video/x-msvideo" },
+        { ".wmv", "video/x-ms-wmv" },
+        { ".mpg", "video/mpeg" },
+        { ".mpeg", "video/mpeg" },
+        { ".mp3", "audio/mpeg" },
+        { ".m4a", "audio/mp4" },
+        { ".ogg", "audio/ogg" },
+        { ".oga", "audio/ogg" },
+        { ".wav", "audio/wav" },
+        { ".flac", "audio/flac" },
+        { ".wma", "audio/x-ms-wma" },
+        { ".mid", "audio/midi" },
+        { ".midi", "audio/midi" }
+    };
+
+    QString path = url.path().toLower();
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (path.endsWith(QLatin1String(types[i][0])))
+            return types[i][1];
+    }
+
+    return QByteArray();
+}
@@ -32,9 +32,17 @@ public:
      * @brief Assumes MIME type by url or content.
      * @param url File address.
      * @param buf File contents.
-     * @return "text/css", "text/html", "text/js" or "application/octet-stream".
+     * @return "text/css", "text/html", "text/js", "image/bmp", "image/gif", "image/jpeg", "image/png"
+     *         or "application/octet-stream".
      */
     static QByteArray mimeType( const QUrl &url, const QByteArray &buf );
+
+    /**
+     * @brief Recognizes the audio and video files by the extension of the file name.
+     * @param url File address.
+     * @return "video/mp4", "audio/mpeg" and so on, or an empty array if it is not a media file.
+     */
+    static QByteArray mediaType( const QUrl &url );
 };
 
 #endif // MIMEHELPER_H
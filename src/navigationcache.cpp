@@ -0,0 +1,371 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QByteArray>
+#include <QChar>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QSaveFile>
+#include <QString>
+#include <QtEndian>			// qFromLittleEndian, qToLittleEndian
+#include <QtGlobal>			// qPrintable, qWarning, Q_BYTE_ORDER
+#include <QUrl>
+#include <QVector>
+
+#include "navigationcache.h"	// NavigationCache
+
+
+static const quint32 NAVIGATION_MAGIC = 0x564E4355;	// "UCNV"
+static const quint32 NAVIGATION_VERSION = 1;
+
+enum
+{
+	PART_TOC = 1 << 0,
+	PART_INDEX = 1 << 1
+};
+
+// The file consists of the header, the string offsets (one more than strings), the TOC entries,
+// the index entries, the index URL string numbers and the string characters in UTF-16.
+// All the values are little-endian, and all the sections are 4-byte aligned.
+//
+// Header: magic, version, parts, encoding string, ebook size and time (64-bit),
+// number of strings, characters, TOC entries, index entries and index URLs
+static const int HEADER_SIZE = 4 * 4 + 2 * 8 + 5 * 4;
+
+// Name, URL, icon, indent
+static const int TOC_ENTRY_SIZE = 4 * 4;
+
+// Name, 'see also', first URL, number of URLs, indent
+static const int INDEX_ENTRY_SIZE = 5 * 4;
+
+
+// Collects the strings of the snapshot, storing each one once
+class StringTable
+{
+	public:
+		StringTable()
+		{
+			m_offsets.push_back( 0 );
+		}
+
+		quint32 intern( const QString& str )
+		{
+			QHash< QString, quint32 >::const_iterator it = m_ids.find( str );
+
+			if ( it != m_ids.end() )
+				return it.value();
+
+			quint32 id = m_ids.size();
+			m_ids.insert( str, id );
+
+			m_chars += str;
+			m_offsets.push_back( m_chars.size() );
+			return id;
+		}
+
+		QHash< QString, quint32 >	m_ids;
+		QVector< quint32 >			m_offsets;	// of each string in m_chars, and the end of the last one
+		QString						m_chars;
+};
+
+static void appendValue( QByteArray& data, quint32 value )
+{
+	value = qToLittleEndian( value );
+	data.append( (const char *) &value, sizeof(value) );
+}
+
+static void appendValue( QByteArray& data, quint64 value )
+{
+	value = qToLittleEndian( value );
+	data.append( (const char *) &value, sizeof(value) );
+}
+
+static quint32 valueAt( const uchar * data, quint64 offset )
+{
+	return qFromLittleEndian<quint32>( data + offset );
+}
+
+static QString stringAt( const uchar * data, quint32 length )
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+	return QString( (const QChar *) data, length );
+#else
+	QString str( length, Qt::Uninitialized );
+
+	for ( quint32 i = 0; i < length; i++ )
+		str[i] = QChar( qFromLittleEndian<quint16>( data + i * 2 ) );
+
+	return str;
+#endif
+}
+
+// Parses the mapped snapshot, checking every offset and string number, so a damaged file is just ignored
+static bool parseSnapshot( const uchar * data, quint64 size, const QString& encoding, quint64 filesize, quint64 filetime,
+						   bool needToc, bool needIndex, QList< EBookTocEntry >& toc, QList< EBookIndexEntry >& index,
+						   bool * damaged )
+{
+	*damaged = false;
+
+	if ( size < (quint64) HEADER_SIZE
+	|| valueAt( data, 0 ) != NAVIGATION_MAGIC
+	|| valueAt( data, 4 ) != NAVIGATION_VERSION )
+		return false;
+
+	quint32 parts = valueAt( data, 8 );
+	quint32 encodingid = valueAt( data, 12 );
+
+	if ( qFromLittleEndian<quint64>( data + 16 ) != filesize
+	|| qFromLittleEndian<quint64>( data + 24 ) != filetime
+	|| (needToc && !(parts & PART_TOC))
+	|| (needIndex && !(parts & PART_INDEX)) )
+		return false;
+
+	quint32 stringcount = valueAt( data, 32 );
+	quint32 charcount = valueAt( data, 36 );
+	quint32 toccount = valueAt( data, 40 );
+	quint32 indexcount = valueAt( data, 44 );
+	quint32 urlcount = valueAt( data, 48 );
+
+	// Here the file is ours, so anything wrong means it is damaged
+	*damaged = true;
+
+	quint64 offsets = HEADER_SIZE;
+	quint64 tocdata = offsets + ((quint64) stringcount + 1) * 4;
+	quint64 indexdata = tocdata + (quint64) toccount * TOC_ENTRY_SIZE;
+	quint64 urldata = indexdata + (quint64) indexcount * INDEX_ENTRY_SIZE;
+	quint64 chardata = urldata + (quint64) urlcount * 4;
+
+	if ( chardata + (quint64) charcount * 2 != size || encodingid >= stringcount )
+		return false;
+
+	// Every string is created once, and the entries share it
+	QVector< QString > strings( stringcount );
+	quint32 start = valueAt( data, offsets );
+
+	for ( quint32 i = 0; i < stringcount; i++ )
+	{
+		quint32 end = valueAt( data, offsets + ((quint64) i + 1) * 4 );
+
+		if ( end < start || end > charcount )
+			return false;
+
+		strings[i] = stringAt( data + chardata + (quint64) start * 2, end - start );
+		start = end;
+	}
+
+	// The entry names depend on the encoding, which may be changed by user without changing the book
+	if ( strings[ encodingid ] != encoding )
+	{
+		*damaged = false;
+		return false;
+	}
+
+	// The same URL is parsed once as well
+	QVector< QUrl > urls( stringcount );
+
+	if ( needToc )
+	{
+		toc.reserve( toccount );
+
+		for ( quint32 i = 0; i < toccount; i++ )
+		{
+			quint64 offset = tocdata + (quint64) i * TOC_ENTRY_SIZE;
+			quint32 name = valueAt( data, offset );
+			quint32 url = valueAt( data, offset + 4 );
+
+			if ( name >= stringcount || url >= stringcount )
+				return false;
+
+			if ( urls[url].isEmpty() && !strings[url].isEmpty() )
+				urls[url] = QUrl( strings[url] );
+
+			EBookTocEntry entry;
+			entry.name = strings[name];
+			entry.url = urls[url];
+			entry.iconid = (EBookTocEntry::Icon) (qint32) valueAt( data, offset + 8 );
+			entry.indent = (qint32) valueAt( data, offset + 12 );
+
+			toc.push_back( entry );
+		}
+	}
+
+	if ( needIndex )
+	{
+		index.reserve( indexcount );
+
+		for ( quint32 i = 0; i < indexcount; i++ )
+		{
+			quint64 offset = indexdata + (quint64) i * INDEX_ENTRY_SIZE;
+			quint32 name = valueAt( data, offset );
+			quint32 seealso = valueAt( data, offset + 4 );
+			quint32 firsturl = valueAt( data, offset + 8 );
+			quint32 numurls = valueAt( data, offset + 12 );
+
+			if ( name >= stringcount || seealso >= stringcount || (quint64) firsturl + numurls > urlcount )
+				return false;
+
+			EBookIndexEntry entry;
+			entry.name = strings[name];
+			entry.seealso = strings[seealso];
+			entry.indent = (qint32) valueAt( data, offset + 16 );
+
+			for ( quint32 j = 0; j < numurls; j++ )
+			{
+				quint32 url = valueAt( data, urldata + ((quint64) firsturl + j) * 4 );
+
+				if ( url >= stringcount )
+					return false;
+
+				if ( urls[url].isEmpty() && !strings[url].isEmpty() )
+					urls[url] = QUrl( strings[url] );
+
+				entry.urls.push_back( urls[url] );
+			}
+
+			index.push_back( entry );
+		}
+	}
+
+	*damaged = false;
+	return true;
+}
+
+
+bool NavigationCache::load( const QString& cachefile, const QString& ebookfile, const QString& encoding,
+							bool needToc, bool needIndex, QList< EBookTocEntry >& toc, QList< EBookIndexEntry >& index )
+{
+	QFileInfo finfo( ebookfile );
+	QFile file( cachefile );
+
+	if ( !file.open( QIODevice::ReadOnly ) )
+		return false; // it's ok, file may not exist
+
+	// The snapshot is replaced by renaming, so the mapped file never changes while we read it
+	qint64 size = file.size();
+	const uchar * data = size > 0 ? file.map( 0, size ) : 0;
+
+	if ( !data )
+		return false;
+
+	bool damaged;
+	bool ok = parseSnapshot( data, size, encoding, finfo.size(), finfo.lastModified().toMSecsSinceEpoch(),
+							 needToc, needIndex, toc, index, &damaged );
+
+	file.unmap( (uchar *) data );
+
+	if ( !ok )
+	{
+		if ( damaged )
+			qWarning( "file %s is damaged, ignoring it.", qPrintable( cachefile ) );
+
+		toc.clear();
+		index.clear();
+	}
+
+	return ok;
+}
+
+bool NavigationCache::save( const QString& cachefile, const QString& ebookfile, const QString& encoding,
+							bool hasToc, bool hasIndex, const QList< EBookTocEntry >& toc, const QList< EBookIndexEntry >& index )
+{
+	QFileInfo finfo( ebookfile );
+	StringTable strings;
+	QByteArray tocdata, indexdata, urldata;
+	quint32 encodingid = strings.intern( encoding );
+	quint32 urlcount = 0;
+
+	if ( hasToc )
+	{
+		tocdata.reserve( toc.size() * TOC_ENTRY_SIZE );
+
+		for ( int i = 0; i < toc.size(); i++ )
+		{
+			appendValue( tocdata, strings.intern( toc[i].name ) );
+			appendValue( tocdata, strings.intern( toc[i].url.toString( QUrl::FullyEncoded ) ) );
+			appendValue( tocdata, (quint32) toc[i].iconid );
+			appendValue( tocdata, (quint32) toc[i].indent );
+		}
+	}
+
+	if ( hasIndex )
+	{
+		indexdata.reserve( index.size() * INDEX_ENTRY_SIZE );
+
+		for ( int i = 0; i < index.size(); i++ )
+		{
+			appendValue( indexdata, strings.intern( index[i].name ) );
+			appendValue( indexdata, strings.intern( index[i].seealso ) );
+			appendValue( indexdata, urlcount );
+			appendValue( indexdata, (quint32) index[i].urls.size() );
+			appendValue( indexdata, (quint32) index[i].indent );
+
+			for ( int j = 0; j < index[i].urls.size(); j++ )
+				appendValue( urldata, strings.intern( index[i].urls[j].toString( QUrl::FullyEncoded ) ) );
+
+			urlcount += index[i].urls.size();
+		}
+	}
+
+	QByteArray data;
+	data.reserve( HEADER_SIZE + strings.m_offsets.size() * 4 + tocdata.size() + indexdata.size() + urldata.size()
+				  + strings.m_chars.size() * 2 );
+
+	appendValue( data, NAVIGATION_MAGIC );
+	appendValue( data, NAVIGATION_VERSION );
+	appendValue( data, (quint32) ((hasToc ? PART_TOC : 0) | (hasIndex ? PART_INDEX : 0)) );
+	appendValue( data, encodingid );
+	appendValue( data, (quint64) finfo.size() );
+	appendValue( data, (quint64) finfo.lastModified().toMSecsSinceEpoch() );
+	appendValue( data, (quint32) strings.m_ids.size() );
+	appendValue( data, (quint32) strings.m_chars.size() );
+	appendValue( data, (quint32) (hasToc ? toc.size() : 0) );
+	appendValue( data, (quint32) (hasIndex ? index.size() : 0) );
+	appendValue( data, urlcount );
+
+	for ( int i = 0; i < strings.m_offsets.size(); i++ )
+		appendValue( data, strings.m_offsets[i] );
+
+	data += tocdata;
+	data += indexdata;
+	data += urldata;
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+	data.append( (const char *) strings.m_chars.constData(), strings.m_chars.size() * 2 );
+#else
+	for ( int i = 0; i < strings.m_chars.size(); i++ )
+	{
+		quint16 ch = qToLittleEndian( strings.m_chars[i].unicode() );
+		data.append( (const char *) &ch, sizeof(ch) );
+	}
+#endif
+
+	// Another instance may be reading it, so it must never be seen half written
+	QSaveFile file( cachefile );
+
+	if ( !file.open( QIODevice::WriteOnly ) || file.write( data ) != data.size() || !file.commit() )
+	{
+		qWarning( "Could not write %s: %s", qPrintable( cachefile ), qPrintable( file.errorString() ) );
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,45 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NAVIGATIONCACHE_H
+#define NAVIGATIONCACHE_H
+
+#include <QList>
+#include <QString>
+
+#include "ebook.h"			// EBookTocEntry, EBookIndexEntry
+
+
+//! Snapshot of the parsed table of contents and index, so reopening an unchanged book does not
+//! parse them again. Like the settings file, it is only valid for the ebook file of the same size
+//! and modification time, and also only for the same encoding. The strings are stored once in
+//! a shared table which the entries refer to by number, and the file is memory-mapped when read.
+//! Both functions are thread-safe.
+class NavigationCache
+{
+	public:
+		//! Reads the snapshot; returns false if there is none, it is outdated or has not got the required parts
+		static bool	load( const QString& cachefile, const QString& ebookfile, const QString& encoding,
+						  bool needToc, bool needIndex, QList< EBookTocEntry >& toc, QList< EBookIndexEntry >& index );
+
+		//! Writes the snapshot
+		static bool	save( const QString& cachefile, const QString& ebookfile, const QString& encoding,
+						  bool hasToc, bool hasIndex, const QList< EBookTocEntry >& toc, const QList< EBookIndexEntry >& index );
+};
+
+#endif // NAVIGATIONCACHE_H
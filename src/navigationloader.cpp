@@ -0,0 +1,146 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QList>
+#include <QMetaObject>		// QMetaObject::invokeMethod
+#include <QString>
+#include <Qt>				// Qt::QueuedConnection
+#include <QThreadPool>
+#include <QtGlobal>			// qPrintable, qWarning
+
+#include "ebook.h"				// EBook, EBookTocEntry, EBookIndexEntry
+#include "navigationcache.h"	// NavigationCache
+#include "navigationloader.h"	// NavigationLoader, NavigationLoadJob, QObject, QRunnable
+
+
+NavigationLoader::NavigationLoader( QObject * parent )
+	: QObject( parent )
+{
+	m_generation = 0;
+	m_loading = false;
+}
+
+void NavigationLoader::load( const QString& filename, const QString& cachefile, const QString& encoding,
+							 bool loadToc, bool loadIndex )
+{
+	cancel();
+
+	if ( !loadToc && !loadIndex )
+		return;
+
+	m_loading = true;
+
+	// The job does not use the opened ebook, so it does not have to be finished before the book is closed
+	QThreadPool::globalInstance()->start( new NavigationLoadJob( this, filename, cachefile, encoding,
+																			  m_generation, loadToc, loadIndex ) );
+}
+
+void NavigationLoader::cancel()
+{
+	// The running job cannot be interrupted, but its results are ignored
+	m_generation++;
+	m_loading = false;
+}
+
+void NavigationLoader::jobTocLoaded( NavigationLoadJob * job )
+{
+	if ( job->m_generation != m_generation )
+		return;
+
+	emit tableOfContentsLoaded( job->m_toc );
+}
+
+void NavigationLoader::jobFinished( NavigationLoadJob * job )
+{
+	if ( job->m_generation != m_generation )
+		return;
+
+	if ( job->m_loadIndex )
+		emit indexLoaded( job->m_index );
+
+	m_loading = false;
+	emit finished();
+}
+
+
+NavigationLoadJob::NavigationLoadJob( NavigationLoader * loader, const QString& filename, const QString& cachefile,
+									  const QString& encoding, int generation, bool loadToc, bool loadIndex )
+	: QObject(), QRunnable(), m_loader( loader ), m_filename( filename ), m_cachefile( cachefile ), m_encoding( encoding ),
+	  m_generation( generation ), m_loadToc( loadToc ), m_loadIndex( loadIndex )
+{
+	// Deleted from done()
+	setAutoDelete( false );
+}
+
+void NavigationLoadJob::run()
+{
+	// The unchanged book does not even have to be opened
+	if ( NavigationCache::load( m_cachefile, m_filename, m_encoding, m_loadToc, m_loadIndex, m_toc, m_index ) )
+	{
+		if ( m_loadToc )
+			QMetaObject::invokeMethod( this, "tocDone", Qt::QueuedConnection );
+
+		QMetaObject::invokeMethod( this, "done", Qt::QueuedConnection );
+		return;
+	}
+
+	EBook * ebook = EBook::loadFile( m_filename );
+
+	if ( ebook )
+	{
+		bool parsed = true;
+
+		// The CHM entry names are decoded with the current encoding
+		if ( !m_encoding.isEmpty() && ebook->hasFeature( EBook::FEATURE_ENCODING ) )
+			ebook->setCurrentEncoding( qPrintable( m_encoding ) );
+
+		// The contents are usually smaller, and are needed first to show the opened page there
+		if ( m_loadToc )
+		{
+			parsed = ebook->getTableOfContents( m_toc );
+			QMetaObject::invokeMethod( this, "tocDone", Qt::QueuedConnection );
+		}
+
+		if ( m_loadIndex && !ebook->getIndex( m_index ) )
+			parsed = false;
+
+		delete ebook;
+
+		// The TOC is not touched after tocDone() is posted, so it can be read here while the GUI thread uses it
+		if ( parsed )
+			NavigationCache::save( m_cachefile, m_filename, m_encoding, m_loadToc, m_loadIndex, m_toc, m_index );
+	}
+	else
+		qWarning( "NavigationLoadJob: could not open %s again, contents and index are not available", qPrintable( m_filename ) );
+
+	QMetaObject::invokeMethod( this, "done", Qt::QueuedConnection );
+}
+
+void NavigationLoadJob::tocDone()
+{
+	if ( m_loader )
+		m_loader->jobTocLoaded( this );
+}
+
+void NavigationLoadJob::done()
+{
+	deleteLater();
+
+	if ( m_loader )
+		m_loader->jobFinished( this );
+}
@@ -0,0 +1,103 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NAVIGATIONLOADER_H
+#define NAVIGATIONLOADER_H
+
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QRunnable>
+#include <QString>
+
+#include "ebook.h"			// EBookTocEntry, EBookIndexEntry
+
+class NavigationLoadJob;
+
+
+//! Parses the table of contents and the index of the ebook in a worker thread, so opening a large
+//! book does not freeze the window. The job opens the file again, so it does not share the reader
+//! with the browser, and the book may be closed while it is still running. The results are kept
+//! in NavigationCache, so the unchanged book is not parsed again.
+class NavigationLoader : public QObject
+{
+	Q_OBJECT
+
+	public:
+		NavigationLoader( QObject * parent );
+
+		//! Starts loading; the results of the previous load are discarded
+		void	load( const QString& filename, const QString& cachefile, const QString& encoding,
+					  bool loadToc, bool loadIndex );
+
+		//! Discards the results of the running load
+		void	cancel();
+
+		bool	isLoading() const { return m_loading; }
+
+	signals:
+		void	tableOfContentsLoaded( const QList< EBookTocEntry >& toc );
+		void	indexLoaded( const QList< EBookIndexEntry >& index );
+		void	finished();
+
+	private:
+		friend class NavigationLoadJob;
+
+		// Called from the GUI thread as the job progresses
+		void	jobTocLoaded( NavigationLoadJob * job );
+		void	jobFinished( NavigationLoadJob * job );
+
+		int		m_generation;
+		bool	m_loading;
+};
+
+
+//! Loads the table of contents and the index in the global thread pool
+class NavigationLoadJob : public QObject, public QRunnable
+{
+	Q_OBJECT
+
+	public:
+		NavigationLoadJob( NavigationLoader * loader, const QString& filename, const QString& cachefile,
+						   const QString& encoding, int generation, bool loadToc, bool loadIndex );
+
+		// Runs in the worker thread
+		void	run();
+
+	private slots:
+		// Run in the GUI thread
+		void	tocDone();
+		void	done();
+
+	private:
+		friend class NavigationLoader;
+
+		QPointer< NavigationLoader >	m_loader;
+		QString					m_filename;
+		QString					m_cachefile;
+		QString					m_encoding;
+		int						m_generation;
+		bool					m_loadToc;
+		bool					m_loadIndex;
+
+		// Results
+		QList< EBookTocEntry >		m_toc;
+		QList< EBookIndexEntry >	m_index;
+};
+
+#endif // NAVIGATIONLOADER_H
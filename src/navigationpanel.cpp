@@ -21,20 +21,21 @@
 #include <QMenu>
 #include <QString>
 #include <QStringList>
-#include <QTreeWidgetItemIterator>
 #include <QUrl>
 
 #include "i18n.h"
 
+#include "config.h"			 // pConfig
 #include "ebook.h"			 // EBook
 #include "mainwindow.h"		 // ::mainWindow
+#include "navigationloader.h" // NavigationLoader
 #include "navigationpanel.h" // NavigationPanel, QWidget
+#include "opentiming.h"		 // OpenTiming
 #include "settings.h"		 // Settings
 #include "tab_bookmarks.h"	 // TabBookmarks
 #include "tab_contents.h"	 // TabContents
 #include "tab_index.h"		 // TabIndex
 #include "tab_search.h"		 // TabSearch
-#include "treeitem_toc.h"	 // TreeItem_TOC
 #include "viewwindow.h"		 // ViewWindow
 
 
@@ -56,6 +57,23 @@ NavigationPanel::NavigationPanel( QWidget * parent )
 	// Those tabs will be added later
 	m_contentsTab = 0;
 	m_indexTab = 0;
+
+	// Shown while the contents and index are loading
+	m_loadProgress->hide();
+
+	m_loader = new NavigationLoader( this );
+
+	connect( m_loader,
+			 SIGNAL( tableOfContentsLoaded( QList<EBookTocEntry> ) ),
+			 this,
+			 SLOT( onTableOfContentsLoaded( QList<EBookTocEntry> ) ) );
+
+	connect( m_loader,
+			 SIGNAL( indexLoaded( QList<EBookIndexEntry> ) ),
+			 this,
+			 SLOT( onIndexLoaded( QList<EBookIndexEntry> ) ) );
+
+	connect( m_loader, SIGNAL( finished() ), this, SLOT( onLoadFinished() ) );
 }
 
 void NavigationPanel::setBookmarkMenu( QMenu * menu )
@@ -65,6 +83,9 @@ void NavigationPanel::setBookmarkMenu( QMenu * menu )
 
 void NavigationPanel::invalidate()
 {
+	m_loader->cancel();
+	m_loadProgress->hide();
+
 	if ( m_contentsTab )
 	{
 		m_tabWidget->removeTab( m_tabWidget->indexOf( m_contentsTab ) );
@@ -115,69 +136,90 @@ void NavigationPanel::getSettings( Settings * settings )
 
 void NavigationPanel::refresh()
 {
-	if ( m_contentsTab )
-		m_contentsTab->refillTableOfContents();
+	EBook * ebook = ::mainWindow->chmFile();
+
+	if ( !ebook || (!m_contentsTab && !m_indexTab) )
+		return;
+
+	// The entry names depend on the encoding, so the worker must use the same one
+	QString encoding;
+
+	if ( ebook->hasFeature( EBook::FEATURE_ENCODING ) )
+		encoding = ebook->currentEncoding();
+
+	m_loader->load( ::mainWindow->getOpenedFileName(), pConfig->getEbookNavigationFile( ::mainWindow->getOpenedFileName() ),
+					encoding, m_contentsTab != 0, m_indexTab != 0 );
+	m_loadProgress->show();
 }
 
-bool NavigationPanel::findUrlInContents( const QUrl& url )
+void NavigationPanel::onTableOfContentsLoaded( const QList< EBookTocEntry >& toc )
 {
 	if ( !m_contentsTab )
-		return false;
+		return;
 
-	TreeItem_TOC * treeitem = m_contentsTab->getTreeItem( url );
+	m_contentsTab->setTableOfContents( toc );
+	::mainWindow->openTiming()->stage( "table of contents loaded" );
 
-	if ( treeitem )
-	{
-		TreeItem_TOC * itemparent = treeitem;
-		while ( (itemparent = (TreeItem_TOC*) itemparent->parent()) != 0 )
-			itemparent->setExpanded(true);
+	// The page was opened before the contents were there
+	findUrlInContents( ::mainWindow->currentBrowser()->getOpenedPage() );
+}
 
-		m_contentsTab->showItem( treeitem );
-		return true;
-	}
+void NavigationPanel::onIndexLoaded( const QList< EBookIndexEntry >& index )
+{
+	if ( m_indexTab )
+		m_indexTab->setIndex( index );
 
-	return false;
+	::mainWindow->openTiming()->stage( "index loaded" );
 }
 
-void NavigationPanel::addBookmark()
+void NavigationPanel::onLoadFinished()
 {
-	m_bookmarksTab->onAddBookmarkPressed();
+	m_loadProgress->hide();
 }
 
-void NavigationPanel::showPrevInToc()
+bool NavigationPanel::findUrlInContents( const QUrl& url )
 {
 	if ( !m_contentsTab )
-		return;
+		return false;
 
-	// Try to find current list item
-	TreeItem_TOC * current = m_contentsTab->getTreeItem( ::mainWindow->currentBrowser()->getOpenedPage() );
+	return m_contentsTab->showUrl( url );
+}
 
-	if ( !current )
-		return;
+void NavigationPanel::addBookmark()
+{
+	m_bookmarksTab->onAddBookmarkPressed();
+}
 
-	QTreeWidgetItemIterator lit( current );
-	lit--;
+void NavigationPanel::showPrevInToc()
+{
+	QUrl url = urlPrevInToc( ::mainWindow->currentBrowser()->getOpenedPage() );
 
-	if ( *lit )
-		::mainWindow->openPage( ((TreeItem_TOC *) (*lit) )->getUrl(), MainWindow::OPF_CONTENT_TREE );
+	if ( url.isValid() )
+		::mainWindow->openPage( url, MainWindow::OPF_CONTENT_TREE );
 }
 
 void NavigationPanel::showNextInToc()
 {
-	if ( !m_contentsTab )
-		return;
+	QUrl url = urlNextInToc( ::mainWindow->currentBrowser()->getOpenedPage() );
 
-	// Try to find current list item
-	TreeItem_TOC * current = m_contentsTab->getTreeItem( ::mainWindow->currentBrowser()->getOpenedPage() );
+	if ( url.isValid() )
+		::mainWindow->openPage( url, MainWindow::OPF_CONTENT_TREE );
+}
 
-	if ( !current )
-		return;
+QUrl NavigationPanel::urlPrevInToc( const QUrl& url ) const
+{
+	if ( !m_contentsTab )
+		return QUrl();
+
+	return m_contentsTab->urlPrevInToc( url );
+}
 
-	QTreeWidgetItemIterator lit( current );
-	lit++;
+QUrl NavigationPanel::urlNextInToc( const QUrl& url ) const
+{
+	if ( !m_contentsTab )
+		return QUrl();
 
-	if ( *lit )
-		::mainWindow->openPage( ((TreeItem_TOC *) (*lit) )->getUrl(),MainWindow::OPF_CONTENT_TREE );
+	return m_contentsTab->urlNextInToc( url );
 }
 
 
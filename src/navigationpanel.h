@@ -20,15 +20,18 @@
 #define NAVIGATIONPANEL_H
 
 #include <QDockWidget>
+#include <QList>
 #include <QStringList>
 
 #include "ui_navigatorpanel.h"
 
+#include <ebook.h>	// EBook, EBookTocEntry, EBookIndexEntry
+
 class QMenu;
 class QString;
 class QUrl;
 
-class EBook;
+class NavigationLoader;
 class Settings;
 class TabBookmarks;
 class TabContents;
@@ -69,7 +72,7 @@ class NavigationPanel : public QDockWidget, public Ui::NavigatorPanel
 		int		active() const;
 		void	setActive( int index );
 
-		// Refresh content and index tab contents
+		// Reload content and index tab contents in background
 		void	refresh();
 
 		// Locate URL or text in the contents tab
@@ -85,6 +88,10 @@ class NavigationPanel : public QDockWidget, public Ui::NavigatorPanel
 		// Just find text without using search tab
 		QStringList	searchQuery( const QString& text );
 
+		// Returns the previous/next page in table of contents, or an empty URL
+		QUrl	urlPrevInToc( const QUrl& url ) const;
+		QUrl	urlNextInToc( const QUrl& url ) const;
+
 	public slots:
 		// Add a new bookmark
 		void	addBookmark();
@@ -93,7 +100,14 @@ class NavigationPanel : public QDockWidget, public Ui::NavigatorPanel
 		void	showPrevInToc();
 		void	showNextInToc();
 
+	private slots:
+		// Called by NavigationLoader
+		void	onTableOfContentsLoaded( const QList< EBookTocEntry >& toc );
+		void	onIndexLoaded( const QList< EBookIndexEntry >& index );
+		void	onLoadFinished();
+
 	private:
+		NavigationLoader	*	m_loader;
 		TabContents			*	m_contentsTab;
 		TabIndex			*	m_indexTab;
 		TabSearch			*	m_searchTab;
@@ -16,33 +16,41 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef TREEITEM_TOC_H
-#define TREEITEM_TOC_H
+#include <cstdio>		// fprintf, stderr
 
-#include <QTreeWidgetItem>
+#include <QByteArray>
 #include <QString>
-#include <QUrl>
+#include <QtGlobal>		// qPrintable
 
-class QVariant;
+#include "opentiming.h"
 
 
-class TreeItem_TOC : public QTreeWidgetItem
+OpenTiming::OpenTiming()
 {
-	public:
-		TreeItem_TOC( QTreeWidgetItem* parent, QTreeWidgetItem* after, const QString& name, const QUrl& url, int image );
-		TreeItem_TOC( QTreeWidget* parent, QTreeWidgetItem* after, const QString& name, const QUrl& url, int image );
+	m_enabled = false;
+	m_lastStage = 0;
+}
 
-		QUrl		getUrl() const;
-		bool		containstUrl(const QUrl& url , bool ignorefragment ) const;
+void OpenTiming::start( const QString& filename )
+{
+	if ( !m_enabled )
+		return;
+
+	m_stages.clear();
+	m_lastStage = 0;
+	m_timer.start();
 
-		// Overridden methods
-		int 		columnCount () const;
-		QVariant 	data ( int column, int role ) const;
+	fprintf( stderr, "Opening %s\n", qPrintable( filename ) );
+}
+
+void OpenTiming::stage( const char * name )
+{
+	if ( !m_enabled || !m_timer.isValid() || m_stages.contains( name ) )
+		return;
 
-	private:
-		QString		m_name;
-		QUrl		m_url;
-		int 		m_image;
-};
+	m_stages.insert( name );
 
-#endif // TREEITEM_TOC_H
+	qint64 elapsed = m_timer.elapsed();
+	fprintf( stderr, "  %-28s %6lld ms  (+%lld ms)\n", name, (long long) elapsed, (long long) ( elapsed - m_lastStage ) );
+	m_lastStage = elapsed;
+}
@@ -0,0 +1,54 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPENTIMING_H
+#define OPENTIMING_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QString>
+#include <QtGlobal>		// qint64
+
+
+//! Timing breakdown of opening an ebook, enabled by the -timing option. Every stage is printed
+//! to the standard error as it ends, with the time since the file was selected and since the previous
+//! stage. The stages which run in background after the first page is shown are reported the same way.
+class OpenTiming
+{
+	public:
+		OpenTiming();
+
+		void	setEnabled( bool enabled ) { m_enabled = enabled; }
+		bool	isEnabled() const { return m_enabled; }
+
+		//! Starts measuring the opening of the file; the stages of the previous file are forgotten
+		void	start( const QString& filename );
+
+		//! Marks the end of the stage. Only the first end of every stage is reported,
+		//! so the stages which repeat later, like the page loading, may be marked every time.
+		void	stage( const char * name );
+
+	private:
+		bool				m_enabled;
+		QElapsedTimer		m_timer;
+		qint64				m_lastStage;
+		QSet< QByteArray >	m_stages;
+};
+
+#endif // OPENTIMING_H
@@ -19,14 +19,20 @@
 
 #include <QBuffer>
 #include <QByteArray>
+#include <QMetaObject>
 #include <QObject>
 #include <QString>
 #include <QtGlobal>					// QT_VERSION, QT_VERSION_CHECK
+#include <QThreadPool>
 #include <QUrl>
 #include <QWebEngineUrlRequestJob>
 
+#include "../contentstream.h" // ContentStream
+#include "../ebookreaders.h" // EBookReaders
 #include "../mainwindow.h" // ::mainWindow
-#include "../mimehelper.h" // MimeHelper::mimeType
+#include "../mimehelper.h" // MimeHelper::mediaType
+#include "../opentiming.h" // OpenTiming
+#include "../resourcecache.h" // ResourceCache
 #include "dataprovider.h"  // DataProvider, QWebEngineUrlSchemeHandler
 #include "ebook.h"         // EBook
 #include "ebook_chm.h"     // EBook_CHM::URL_SCHEME_CHM
@@ -65,44 +71,105 @@ DataProvider::DataProvider( QObject *parent )
 
 void DataProvider::requestStarted( QWebEngineUrlRequestJob *request )
 {
-    QUrl url = request->requestUrl();
 #if PRINT_DEBUG
     qDebug() << "[DEBUG] DataProvider::requestStarted";
-    qDebug() << "  url = " << url.toString();
+    qDebug() << "  url = " << request->requestUrl().toString();
 #endif
 
-    // Retreive the data from ebook file
-    QByteArray buf;
+    // Audio and video are not loaded in memory, but streamed from the ebook. QtWebEngine serves
+    // the range requests by seeking the device, so the playback starts immediately, and seeking
+    // does not decompress everything before the position.
+    QByteArray mediatype = MimeHelper::mediaType( request->requestUrl() );
 
-    if ( !::mainWindow->chmFile()->getFileContentAsBinary( buf, url ) )
+    if ( !mediatype.isEmpty() )
     {
-        qWarning( "Could not resolve file %s\n", qPrintable( url.toString() ) );
-        request->fail( QWebEngineUrlRequestJob::UrlNotFound );
+        ContentStream * stream = ContentStream::open( ::mainWindow->chmFile(), request->requestUrl() );
+
+        if ( !stream )
+        {
+            qWarning( "Could not resolve file %s\n", qPrintable( request->requestUrl().toString() ) );
+            request->fail( QWebEngineUrlRequestJob::UrlNotFound );
+            return;
+        }
+
+        connect( request, SIGNAL( destroyed() ), stream, SLOT( deleteLater() ) );
+        request->reply( mediatype, stream );
         return;
     }
 
-    QByteArray mimetype = MimeHelper::mimeType( url, buf );
+    // Other tabs or a previous load may have already requested it
+    QByteArray data, mimetype;
 
-    // We must specify the proper MIME type for the page to display correctly.
-    // The HTML and XML files correspond to "text/html";
-    // for other types "application/octet-stream" is sufficient.
-    // In addition, for "text/html", a "meta" tag is added specifying the text encoding.
-    // This is the easiest and most stable way to set the encoding.
-    if ( mimetype == "text/html")
+    if ( ::mainWindow->resourceCache()->find( request->requestUrl(), data, mimetype ) )
     {
-        buf.prepend(QString( "<META http-equiv='Content-Type' content='text/html; charset=%1'>" )
-                    .arg( ::mainWindow->chmFile()->currentEncoding() ).toLatin1() );
+        DataProviderJob::reply( request, data, mimetype );
+        return;
     }
 
+    // Decompression of large pages and images is slow, so it is done in background
+    // to keep the GUI responsive. The encoding is taken here, as it belongs to the GUI thread.
+    EBook * ebook = ::mainWindow->chmFile();
+    DataProviderJob * job = new DataProviderJob( request, ebook, ebook->currentEncoding(),
+                                                 ::mainWindow->resourceCache()->generation() );
+
+    ::mainWindow->contentThreadPool()->start( job );
+}
+
+
+DataProviderJob::DataProviderJob( QWebEngineUrlRequestJob * request, EBook * ebook, const QString& encoding, unsigned int generation )
+    : QObject(), QRunnable(), m_request( request ), m_ebook( ebook ), m_url( request->requestUrl() ), m_encoding( encoding ),
+      m_generation( generation )
+{
+    m_found = false;
+
+    // Deleted from deliver() once the reply is sent
+    setAutoDelete( false );
+}
+
+void DataProviderJob::run()
+{
+    // Retreive the data from ebook file, or the cache if another tab was faster.
+    // The private reader lets the other jobs decompress at the same time.
+    EBook * reader = ::mainWindow->ebookReaders()->acquire();
+    m_found = ::mainWindow->resourceCache()->fetch( reader ? reader : m_ebook, m_url, m_encoding, m_generation, m_data, m_mimetype );
+    ::mainWindow->ebookReaders()->release( reader );
+
+    QMetaObject::invokeMethod( this, "deliver", Qt::QueuedConnection );
+}
+
+void DataProviderJob::deliver()
+{
+    deleteLater();
+
+    // The request was cancelled while we were reading
+    if ( !m_request )
+        return;
+
+    if ( !m_found )
+    {
+        qWarning( "Could not resolve file %s\n", qPrintable( m_url.toString() ) );
+        m_request->fail( QWebEngineUrlRequestJob::UrlNotFound );
+        return;
+    }
+
+    reply( m_request, m_data, m_mimetype );
+}
+
+void DataProviderJob::reply( QWebEngineUrlRequestJob * request, const QByteArray& data, const QByteArray& mimetype )
+{
     // We will use the buffer because reply() requires the QIODevice.
     // This buffer must be valid until the request is deleted.
     QBuffer * outbuf = new QBuffer;
-    outbuf->setData( buf );
+    outbuf->setData( data );
     outbuf->close();
 
     // Only delete the buffer when the request is deleted too
     connect( request, SIGNAL( destroyed() ), outbuf, SLOT( deleteLater() ) );
 
+    // The page can be painted once its HTML is in; the images follow until the page is loaded
+    if ( mimetype.startsWith( "text/html" ) )
+        ::mainWindow->openTiming()->stage( "first page served" );
+
     // We're good to go
     request->reply( mimetype, outbuf );
 }
@@ -20,9 +20,15 @@
 #ifndef QTWEBENGINE_DATAPROVIDER_H
 #define QTWEBENGINE_DATAPROVIDER_H
 
+#include <QByteArray>
+#include <QObject>
+#include <QPointer>
+#include <QRunnable>
+#include <QString>
+#include <QUrl>
 #include <QWebEngineUrlSchemeHandler>
 
-class QObject;
+class EBook;
 class QWebEngineUrlRequestJob;
 
 
@@ -34,4 +40,39 @@ class DataProvider : public QWebEngineUrlSchemeHandler
         void requestStarted( QWebEngineUrlRequestJob *request );
 };
 
+
+// A single request being served. The content is read in the content thread pool,
+// and the reply is sent from the GUI thread the object lives in.
+class DataProviderJob : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+    public:
+        DataProviderJob( QWebEngineUrlRequestJob * request, EBook * ebook, const QString& encoding, unsigned int generation );
+
+        // Runs in the worker thread
+        void run();
+
+        // Sends the content to the request
+        static void reply( QWebEngineUrlRequestJob * request, const QByteArray& data, const QByteArray& mimetype );
+
+    private slots:
+        // Runs in the GUI thread
+        void deliver();
+
+    private:
+        // The request could be cancelled and deleted while we are reading
+        QPointer<QWebEngineUrlRequestJob> m_request;
+
+        EBook       *   m_ebook;
+        QUrl            m_url;
+        QString         m_encoding;
+        unsigned int    m_generation;   // of the resource cache
+
+        // Results
+        bool            m_found;
+        QByteArray      m_data;
+        QByteArray      m_mimetype;
+};
+
 #endif // QTWEBENGINE_DATAPROVIDER_H
@@ -18,7 +18,9 @@
 
 #include <QApplication>
 #include <QContextMenuEvent>
+#include <QDataStream>
 #include <QDialog>							// QDialog::Accepted
+#include <QIODevice>
 #include <QKeySequence>
 #include <QMenu>
 #include <QPalette>
@@ -254,6 +256,23 @@ void ViewWindow::updateHistoryIcons()
     }
 }
 
+QByteArray ViewWindow::saveHistory() const
+{
+    QByteArray data;
+    QDataStream stream( &data, QIODevice::WriteOnly );
+
+    stream << *history();
+    return data;
+}
+
+bool ViewWindow::restoreHistory( const QByteArray& data )
+{
+    QDataStream stream( data );
+
+    stream >> *history();
+    return stream.status() == QDataStream::Ok && history()->count() > 0;
+}
+
 void ViewWindow::contextMenuEvent(QContextMenuEvent *e)
 {
     QMenu *m = new QMenu(0);
@@ -19,6 +19,7 @@
 #ifndef QTWEBENGINE_VIEWWINDOW_H
 #define QTWEBENGINE_VIEWWINDOW_H
 
+#include <QByteArray>
 #include <QtGlobal>			// qreal
 #include <QUrl>
 #include <QWebEngineView>
@@ -84,6 +85,11 @@ class ViewWindow : public QWebEngineView
         //! Updates the history toolbar icon status
         void	updateHistoryIcons();
 
+        //! Saves the back/forward history, so the window could be recreated by restoreHistory(),
+        //! which also opens the current page. Returns false if the history could not be restored.
+        QByteArray	saveHistory() const;
+        bool	restoreHistory( const QByteArray& data );
+
         //! Returns the window title
         QString	title() const;
 
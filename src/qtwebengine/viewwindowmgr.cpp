@@ -16,8 +16,11 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>          // std::sort
+
 #include <QAction>
 #include <QClipboard>
+#include <QDateTime>
 #include <QIcon>
 #include <QKeySequence>
 #include <QMenu>
@@ -31,6 +34,7 @@
 #include <QToolButton>
 #include <QMouseEvent>
 #include <QUrl>
+#include <QVBoxLayout>
 #include <QWebEnginePage>     // QWebEnginePage::{ FindFlag, FindBackward, FindCaseSensitively }
 #include <QWebEngineSettings>
 #include <QWidget>
@@ -38,7 +42,9 @@
 #include "../i18n.h"
 
 #include "../config.h"        // ::pConfig
+#include "../contentprefetcher.h" // ContentPrefetcher
 #include "../mainwindow.h"    // MainWindow, ::mainWindow
+#include "../opentiming.h"    // OpenTiming
 #include "../settings.h"      // Settings
 #include "../viewwindow.h"    // ViewWindow
 #include "../viewwindowmgr.h"
@@ -108,6 +114,14 @@ ViewWindowMgr::ViewWindowMgr( QWidget *parent )
 
     connect( toolPrevious, SIGNAL(clicked()), this, SLOT( onFindPrevious()) );
     connect( toolNext, SIGNAL(clicked()), this, SLOT( onFindNext()) );
+
+    // Check for the idle background tabs every minute
+    m_lastCurrent = 0;
+    m_hibernatedCount = 0;
+    m_restoredTitlesPending = false;
+    m_hibernateTimer.setInterval( 60000 );
+    connect( &m_hibernateTimer, SIGNAL(timeout()), this, SLOT(hibernateTabs()) );
+    m_hibernateTimer.start();
 }
 
 ViewWindowMgr::~ViewWindowMgr( )
@@ -123,6 +137,7 @@ void ViewWindowMgr::createMenu( MainWindow *, QMenu * menuWindow, QAction * acti
 void ViewWindowMgr::invalidate()
 {
     closeAllWindows();
+    m_hibernatedCount = 0;
     addNewTab( true );
 }
 
@@ -133,20 +148,30 @@ ViewWindow * ViewWindowMgr::current()
     if ( !tab )
         abort();
 
-    return tab->window;
+    // The restored tab gets its window when it is needed
+    return createWindow( tab );
 }
 
 ViewWindow * ViewWindowMgr::addNewTab( bool set_active )
 {
-    ViewWindow * viewvnd = new ViewWindow( m_tabWidget );
+    return addTab( Settings::SavedViewWindow(), set_active, true )->window;
+}
 
+ViewWindowMgr::TabData * ViewWindowMgr::addTab( const Settings::SavedViewWindow& page, bool set_active, bool create_window )
+{
     editFind->installEventFilter( this );
 
-    // Create the tab data structure
+    // Create the tab data structure. The tab page holds the browser window, so the window
+    // could be created later, when the tab is activated.
     TabData tabdata;
-    tabdata.window = viewvnd;
+    tabdata.widget = new QWidget( m_tabWidget );
+    tabdata.window = 0;
     tabdata.action = new QAction( "window", this ); // temporary name; real name is set in setTabName
-    tabdata.widget = viewvnd;
+    tabdata.page = page;
+    tabdata.lastActive = QDateTime::currentMSecsSinceEpoch();
+
+    QVBoxLayout * layout = new QVBoxLayout( tabdata.widget );
+    layout->setContentsMargins( 0, 0, 0, 0 );
 
     connect( tabdata.action,
              SIGNAL( triggered() ),
@@ -154,12 +179,45 @@ ViewWindow * ViewWindowMgr::addNewTab( bool set_active )
              SLOT( activateWindow() ) );
 
     m_Windows.push_back( tabdata );
-    m_tabWidget->addTab( tabdata.widget, "" );
+    TabData * tab = &m_Windows.last();
+
+    // The window must be there before the first tab is added, as it becomes current
+    if ( create_window )
+        createWindow( tab );
+
+    m_tabWidget->addTab( tab->widget, "" );
     Q_ASSERT( m_Windows.size() == m_tabWidget->count() );
 
+    // The topic titles need the topic table, which is built after the first page is loaded
+    if ( !create_window )
+    {
+        setTabTitle( tab, QUrl( page.url ).fileName() );
+        m_restoredTitlesPending = true;
+    }
+
     // Set active if it is the first tab
     if ( set_active || m_Windows.size() == 1 )
-        m_tabWidget->setCurrentWidget( tabdata.widget );
+        m_tabWidget->setCurrentWidget( tab->widget );
+
+    // Set up the accelerator if we have room
+    if ( m_Windows.size() < 10 )
+        tab->action->setShortcut( QKeySequence( i18n("Alt+%1").arg( m_Windows.size() ) ) );
+
+    // Add it to the "Windows" menu
+    m_menuWindow->addAction( tab->action );
+
+    return tab;
+}
+
+ViewWindow * ViewWindowMgr::createWindow( TabData * tab )
+{
+    if ( tab->window )
+        return tab->window;
+
+    ViewWindow * viewvnd = new ViewWindow( tab->widget );
+    tab->widget->layout()->addWidget( viewvnd );
+    tab->widget->setFocusProxy( viewvnd );
+    tab->window = viewvnd;
 
     // Handle clicking on link in browser window
     connect( viewvnd,
@@ -169,12 +227,18 @@ ViewWindow * ViewWindowMgr::addNewTab( bool set_active )
 
     connect( viewvnd, SIGNAL(dataLoaded(ViewWindow*)), this, SLOT(onWindowContentChanged(ViewWindow*)));
 
-    // Set up the accelerator if we have room
-    if ( m_Windows.size() < 10 )
-        tabdata.action->setShortcut( QKeySequence( i18n("Alt+%1").arg( m_Windows.size() ) ) );
-
-    // Add it to the "Windows" menu
-    m_menuWindow->addAction( tabdata.action );
+    // Open the page of the restored or hibernated tab; the hibernated one gets its history back
+    if ( !tab->page.url.isEmpty() )
+    {
+        if ( tab->history.isEmpty() || !viewvnd->restoreHistory( tab->history ) )
+            viewvnd->openUrl( tab->page.url ); // will call setTabName()
+
+        viewvnd->setScrollbarPosition( tab->page.scroll_y );
+        viewvnd->setZoomFactor( tab->page.zoom );
+        tab->page = Settings::SavedViewWindow();
+        tab->history.clear();
+        m_tabWidget->setTabToolTip( m_tabWidget->indexOf( tab->widget ), QString() );
+    }
 
     return viewvnd;
 }
@@ -190,18 +254,21 @@ void ViewWindowMgr::setTabName( ViewWindow * window )
     TabData * tab = findTab( window );
 
     if ( tab )
-    {
-        QString title = window->title().trimmed();
+        setTabTitle( tab, window->title() );
+}
 
-        // Trim too long string
-        if ( title.length() > 25 )
-            title = title.left( 22 ) + "...";
+void ViewWindowMgr::setTabTitle( TabData * tab, const QString& text )
+{
+    QString title = text.trimmed();
 
-        m_tabWidget->setTabText( m_tabWidget->indexOf( window ), title );
-        tab->action->setText( title );
+    // Trim too long string
+    if ( title.length() > 25 )
+        title = title.left( 22 ) + "...";
 
-        updateCloseButtons();
-    }
+    m_tabWidget->setTabText( m_tabWidget->indexOf( tab->widget ), title );
+    tab->action->setText( title );
+
+    updateCloseButtons();
 }
 
 void ViewWindowMgr::onCloseCurrentWindow( )
@@ -237,10 +304,13 @@ void ViewWindowMgr::closeWindow( QWidget * widget )
     if ( it == m_Windows.end() )
         qFatal( "ViewWindowMgr::closeWindow called with unknown widget!" );
 
+    if ( m_lastCurrent == it->widget )
+        m_lastCurrent = 0;
+
     m_menuWindow->removeAction( it->action );
 
     m_tabWidget->removeTab( m_tabWidget->indexOf( it->widget ) );
-    delete it->window;
+    delete it->widget;
     delete it->action;
 
     m_Windows.erase( it );
@@ -257,13 +327,13 @@ void ViewWindowMgr::restoreSettings( const Settings::viewindow_saved_settings_t
     // Destroy automatically created tab
     closeWindow( m_Windows.first().widget );
 
+    // Only the tab which is activated loads its page, see setCurrentPage()
+    m_tabWidget->blockSignals( true );
+
     for ( int i = 0; i < settings.size(); i++ )
-    {
-        ViewWindow * window = addNewTab( false );
-        window->openUrl( settings[i].url ); // will call setTabName()
-        window->setScrollbarPosition( settings[i].scroll_y );
-        window->setZoomFactor( settings[i].zoom );
-    }
+        addTab( settings[i], false, false );
+
+    m_tabWidget->blockSignals( false );
 }
 
 void ViewWindowMgr::saveSettings( Settings::viewindow_saved_settings_t & settings )
@@ -278,9 +348,13 @@ void ViewWindowMgr::saveSettings( Settings::viewindow_saved_settings_t & setting
         if ( !tab )
             abort();
 
-        settings.push_back( Settings::SavedViewWindow( tab->window->getOpenedPage().toString(),
-                                                       tab->window->getScrollbarPosition(),
-                                                       tab->window->getZoomFactor()) );
+        // The tab which was never activated still has the restored page
+        if ( !tab->window )
+            settings.push_back( tab->page );
+        else
+            settings.push_back( Settings::SavedViewWindow( tab->window->getOpenedPage().toString(),
+                                                           tab->window->getScrollbarPosition(),
+                                                           tab->window->getZoomFactor()) );
     }
 }
 
@@ -297,14 +371,85 @@ void ViewWindowMgr::onTabChanged( int newtabIndex )
     if ( newtabIndex == -1 )
         return;
 
-    TabData * tab = findTab( m_tabWidget->widget( newtabIndex ) );
+    // The idle time of the tab which was left starts now
+    TabData * previous = findTab( m_lastCurrent );
+
+    if ( previous )
+        previous->lastActive = QDateTime::currentMSecsSinceEpoch();
+
+    m_lastCurrent = m_tabWidget->widget( newtabIndex );
+
+    TabData * tab = findTab( m_lastCurrent );
 
     if ( tab )
     {
-        tab->window->updateHistoryIcons();
-        mainWindow->browserChanged( tab->window );
+        ViewWindow * window = createWindow( tab );
+
+        window->updateHistoryIcons();
+        mainWindow->browserChanged( window );
         tab->widget->setFocus();
     }
+
+    // Another tab went to background, which may exceed the loaded tabs limit
+    QTimer::singleShot( 0, this, SLOT( hibernateTabs() ) );
+}
+
+void ViewWindowMgr::hibernateTabs()
+{
+    QWidget * current = m_tabWidget->currentWidget();
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 maxidle = qint64( pConfig->m_browserHibernateMinutes ) * 60000;
+    QList< TabData * > loaded;
+    int count = 0;
+
+    for ( WindowsIterator it = m_Windows.begin(); it != m_Windows.end(); ++it )
+    {
+        if ( !it->window || it->widget == current )
+            continue;
+
+        if ( maxidle > 0 && now - it->lastActive >= maxidle )
+        {
+            hibernate( it.operator->() );
+            count++;
+        }
+        else
+            loaded.push_back( it.operator->() );
+    }
+
+    // Above the limit, the least recently active tabs go first
+    if ( pConfig->m_browserMaxLoadedTabs > 0 && loaded.size() > pConfig->m_browserMaxLoadedTabs )
+    {
+        std::sort( loaded.begin(), loaded.end(),
+                   []( const TabData * a, const TabData * b ) { return a->lastActive < b->lastActive; } );
+
+        while ( loaded.size() > pConfig->m_browserMaxLoadedTabs )
+        {
+            hibernate( loaded.takeFirst() );
+            count++;
+        }
+    }
+
+    if ( count > 0 )
+        ::mainWindow->showInStatusBar( i18n( "%1 background tab(s) hibernated, %2 since the file was opened" )
+                                       .arg( count ).arg( m_hibernatedCount ) );
+}
+
+void ViewWindowMgr::hibernate( TabData * tab )
+{
+    ViewWindow * window = tab->window;
+
+    // Everything needed to bring the window back when the tab is activated
+    tab->page = Settings::SavedViewWindow( window->getOpenedPage().toString(),
+                                           window->getScrollbarPosition(),
+                                           window->getZoomFactor() );
+    tab->history = window->saveHistory();
+
+    tab->widget->setFocusProxy( 0 );
+    tab->window = 0;
+    delete window;
+
+    m_tabWidget->setTabToolTip( m_tabWidget->indexOf( tab->widget ), i18n( "Hibernated, reloads when activated" ) );
+    m_hibernatedCount++;
 }
 
 void ViewWindowMgr::openNewTab()
@@ -335,8 +480,9 @@ void ViewWindowMgr::closeSearch()
 
 ViewWindowMgr::TabData * ViewWindowMgr::findTab(QWidget * widget)
 {
+    // Either the tab page or the browser window in it
     for ( WindowsIterator it = m_Windows.begin(); it != m_Windows.end(); ++it )
-        if ( it->widget == widget )
+        if ( it->widget == widget || (it->window && it->window == widget) )
             return (it.operator->());
 
     return 0;
@@ -345,6 +491,12 @@ ViewWindowMgr::TabData * ViewWindowMgr::findTab(QWidget * widget)
 void ViewWindowMgr::setCurrentPage(int index)
 {
     m_tabWidget->setCurrentIndex( index );
+
+    // After restoreSettings() the current tab may have been made current silently
+    TabData * tab = findTab( m_tabWidget->currentWidget() );
+
+    if ( tab && !tab->window )
+        onTabChanged( m_tabWidget->currentIndex() );
 }
 
 int ViewWindowMgr::currentPageIndex() const
@@ -408,7 +560,38 @@ void ViewWindowMgr::onFindPrevious()
 
 void ViewWindowMgr::onWindowContentChanged(ViewWindow *window)
 {
+    bool iscurrent = window == current();
+
+    if ( iscurrent )
+        ::mainWindow->openTiming()->stage( "first page loaded" );
+
     setTabName( (ViewWindow*) window );
+
+    // The page is shown, so it is the time for the titles of the other tabs
+    if ( m_restoredTitlesPending )
+        updateRestoredTitles();
+
+    // The background tabs are not being read
+    if ( iscurrent )
+        ::mainWindow->contentPrefetcher()->pageOpened( window->getOpenedPage() );
+}
+
+void ViewWindowMgr::updateRestoredTitles()
+{
+    m_restoredTitlesPending = false;
+
+    for ( WindowsIterator it = m_Windows.begin(); it != m_Windows.end(); ++it )
+    {
+        if ( it->window || it->page.url.isEmpty() )
+            continue;
+
+        QString title = ::mainWindow->chmFile()->getTopicByUrl( QUrl( it->page.url ) );
+
+        if ( !title.isEmpty() )
+            setTabTitle( it.operator->(), title );
+    }
+
+    ::mainWindow->openTiming()->stage( "tab titles loaded" );
 }
 
 void ViewWindowMgr::copyUrlToClipboard()
@@ -18,6 +18,7 @@
 
 #include <QByteArray>
 #include <QIODevice>
+#include <QMetaObject>
 #include <QNetworkRequest>
 #include <QObject>
 #include <Qt>              // Qt::QueuedConnection
@@ -25,74 +26,218 @@
 #include <QUrl>
 
 #include "../config.h"     // ::pConfig
+#include "../contentstream.h" // ContentStream
 #include "../mainwindow.h" // ::mainWindow
-#include "../mimehelper.h" // MimeHelper::mimeType
+#include "../mimehelper.h" // MimeHelper::mediaType
+#include "../resourcecache.h" // ResourceCache
 #include "dataprovider.h"
+#include "ebook.h"         // EBook
 
 
 KCHMNetworkReply::KCHMNetworkReply( const QNetworkRequest &request, const QUrl &url )
 {
 	setRequest( request );
+	setUrl( url );
 	setOpenMode( QIODevice::ReadOnly );
 
-	m_data = loadResource( url );
-	m_length = m_data.length();
+	m_offset = 0;
+	m_stream = 0;
+	m_end = 0;
 
-	setHeader( QNetworkRequest::ContentLengthHeader, QByteArray::number(m_data.length()) );
-	QMetaObject::invokeMethod(this, "metaDataChanged", Qt::QueuedConnection);
-
-	if ( m_length )
-		QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
+	QMetaObject::invokeMethod( this, "loadResource", Qt::QueuedConnection );
+}
 
-	QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection);
+KCHMNetworkReply::~KCHMNetworkReply()
+{
+	delete m_stream;
 }
 
 qint64 KCHMNetworkReply::bytesAvailable() const
 {
-	return m_data.length() + QNetworkReply::bytesAvailable();
+	if ( m_stream )
+		return m_end - m_offset + QNetworkReply::bytesAvailable();
+
+	return m_data.length() - m_offset + QNetworkReply::bytesAvailable();
 }
 
 void KCHMNetworkReply::abort()
 {
+	if ( isFinished() )
+		return;
+
+	// The queued loadResource() sees the reply finished and does nothing
+	m_data.clear();
+	m_offset = 0;
+
+	setError( QNetworkReply::OperationCanceledError, "Operation canceled" );
+	setFinished( true );
+	close();
+
+	emit finished();
 }
 
 qint64 KCHMNetworkReply::readData(char *buffer, qint64 maxlen)
 {
-	qint64 len = qMin(qint64(m_data.length()), maxlen);
-
-	if (len)
+	if ( m_stream )
 	{
-        memcpy(buffer, m_data.constData(), len);
-		m_data.remove(0, len);
+		qint64 len = qMin( m_end - m_offset, maxlen );
+
+		if ( len <= 0 )
+			return isFinished() ? -1 : 0;
+
+		if ( !m_stream->seek( m_offset ) )
+			return -1;
+
+		qint64 got = m_stream->read( buffer, len );
+
+		if ( got > 0 )
+			m_offset += got;
+
+		return got;
 	}
 
+	qint64 len = qMin( qint64(m_data.length()) - m_offset, maxlen );
+
+	if ( len <= 0 )
+		return isFinished() ? -1 : 0;
+
+	memcpy( buffer, m_data.constData() + m_offset, len );
+	m_offset += len;
+
 	return len;
 }
 
-QByteArray KCHMNetworkReply::loadResource( const QUrl &url )
+void KCHMNetworkReply::loadResource()
 {
-    //qDebug("loadResource %s", qPrintable(url.toString()) );
+	// Aborted before we got here
+	if ( isFinished() )
+		return;
+
+	//qDebug("loadResource %s", qPrintable(url().toString()) );
+
+	QByteArray mediatype = MimeHelper::mediaType( url() );
+
+	if ( !mediatype.isEmpty() )
+	{
+		loadMedia( mediatype );
+		return;
+	}
 
-	// Retreive the data from ebook file
-	QByteArray buf;
+	// Other tabs or a previous load may have already requested it
+	EBook * ebook = ::mainWindow->chmFile();
+	QByteArray mime;
 
-	if ( !::mainWindow->chmFile()->getFileContentAsBinary( buf, url ) )
+	// Retreive the data from ebook file; it could have been closed since the request was made
+	if ( !ebook || !::mainWindow->resourceCache()->fetch( ebook, url(), ebook->currentEncoding(),
+														   ::mainWindow->resourceCache()->generation(), m_data, mime ) )
 	{
-		qWarning( "Could not resolve file %s\n", qPrintable( url.toString() ) );
+		qWarning( "Could not resolve file %s\n", qPrintable( url().toString() ) );
 
+		setError( QNetworkReply::ContentNotFoundError, "Could not resolve file " + url().toString() );
+		setFinished( true );
+		emit finished();
+		return;
 	}
-	
-	QString mime = MimeHelper::mimeType( url, buf );
 
     if ( mime == "text/html" || mime == "text/xhtml" || mime == "text/xml" )
     {
         QString header = QString( "%1; charset=%2")
-                .arg( mime )
-                .arg( ::mainWindow->chmFile()->currentEncoding() );
+                .arg( QString( mime ) )
+                .arg( ebook->currentEncoding() );
         setHeader( QNetworkRequest::ContentTypeHeader, header );
     }
 
-	return buf;
+	setHeader( QNetworkRequest::ContentLengthHeader, QByteArray::number( m_data.length() ) );
+	setFinished( true );
+
+	emit metaDataChanged();
+
+	if ( !m_data.isEmpty() )
+		emit readyRead();
+
+	emit finished();
+}
+
+void KCHMNetworkReply::loadMedia( const QByteArray& mimetype )
+{
+	EBook * ebook = ::mainWindow->chmFile();
+
+	if ( ebook )
+		m_stream = ContentStream::open( ebook, url() );
+
+	if ( !m_stream )
+	{
+		qWarning( "Could not resolve file %s\n", qPrintable( url().toString() ) );
+
+		setError( QNetworkReply::ContentNotFoundError, "Could not resolve file " + url().toString() );
+		setFinished( true );
+		emit finished();
+		return;
+	}
+
+	// The media player seeks by requesting a range, like from a HTTP server: "bytes=first-[last]" or "bytes=-suffix"
+	QByteArray range = request().rawHeader( "Range" ).trimmed();
+	qint64 size = m_stream->size();
+	qint64 first = 0, last = size - 1;
+	bool partial = false;
+
+	if ( range.startsWith( "bytes=" ) && range.indexOf( ',' ) < 0 )
+	{
+		QByteArray spec = range.mid( 6 );
+		int dash = spec.indexOf( '-' );
+
+		if ( dash == 0 )
+		{
+			first = qMax( size - spec.mid( 1 ).toLongLong(), Q_INT64_C(0) );
+			partial = true;
+		}
+		else if ( dash > 0 )
+		{
+			first = spec.left( dash ).toLongLong();
+
+			if ( dash + 1 < spec.size() )
+				last = qMin( spec.mid( dash + 1 ).toLongLong(), size - 1 );
+
+			partial = true;
+		}
+	}
+
+	setHeader( QNetworkRequest::ContentTypeHeader, mimetype );
+	setRawHeader( "Accept-Ranges", "bytes" );
+
+	if ( partial && (first >= size || first > last) )
+	{
+		setAttribute( QNetworkRequest::HttpStatusCodeAttribute, 416 );
+		setAttribute( QNetworkRequest::HttpReasonPhraseAttribute, "Requested Range Not Satisfiable" );
+		setRawHeader( "Content-Range", "bytes */" + QByteArray::number( size ) );
+		first = last + 1;
+	}
+	else if ( partial )
+	{
+		setAttribute( QNetworkRequest::HttpStatusCodeAttribute, 206 );
+		setAttribute( QNetworkRequest::HttpReasonPhraseAttribute, "Partial Content" );
+		setRawHeader( "Content-Range", "bytes " + QByteArray::number( first ) + "-" + QByteArray::number( last )
+					  + "/" + QByteArray::number( size ) );
+	}
+	else
+	{
+		setAttribute( QNetworkRequest::HttpStatusCodeAttribute, 200 );
+		setAttribute( QNetworkRequest::HttpReasonPhraseAttribute, "OK" );
+	}
+
+	// Nothing is decompressed until the player reads it
+	m_offset = first;
+	m_end = last + 1;
+
+	setHeader( QNetworkRequest::ContentLengthHeader, QByteArray::number( m_end - m_offset ) );
+	setFinished( true );
+
+	emit metaDataChanged();
+
+	if ( m_end > m_offset )
+		emit readyRead();
+
+	emit finished();
 }
 
 
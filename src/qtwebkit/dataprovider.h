@@ -29,24 +29,40 @@ class QIODevice;
 class QNetworkRequest;
 class QUrl;
 
+class ContentStream;
+
 
 //
 // A network reply to emulate data transfer from CHM file
 //
 class KCHMNetworkReply : public QNetworkReply
 {
+	Q_OBJECT
+
 	public:
 		KCHMNetworkReply( const QNetworkRequest &request, const QUrl &url );
+		~KCHMNetworkReply();
 		virtual qint64 bytesAvailable() const;
 		virtual void abort();
 
 	protected:
 		virtual qint64 readData(char *buffer, qint64 maxlen);
-		QByteArray loadResource( const QUrl &url );
+
+	private slots:
+		// Loads the resource from the event loop, so the reply could be aborted before that
+		void loadResource();
 
 	private:
+		// Replies with the requested range of a media file, read from the ebook on demand
+		void loadMedia( const QByteArray& mimetype );
+
+		// The content is never modified after loading; reads just advance the offset
 		QByteArray	m_data;
-		qint64 		m_length;
+		qint64 		m_offset;
+
+		// Audio and video are streamed instead; m_offset and m_end are the stream positions
+		ContentStream * m_stream;
+		qint64		m_end;
 };
 
 
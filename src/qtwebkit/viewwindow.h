@@ -19,6 +19,7 @@
 #ifndef VIEWWINDOW_WEBKIT_H
 #define VIEWWINDOW_WEBKIT_H
 
+#include <QByteArray>
 #include <QtGlobal>	// qreal
 #include <QUrl>
 #include <QWebView>
@@ -83,6 +84,11 @@ class ViewWindow : public QWebView
 		//! Updates the history toolbar icon status
 		void	updateHistoryIcons();
 
+		//! Saves the back/forward history, so the window could be recreated by restoreHistory(),
+		//! which also opens the current page. Returns false if the history could not be restored.
+		QByteArray	saveHistory() const;
+		bool	restoreHistory( const QByteArray& data );
+
 		//! Returns the window title
         QString	title() const;
 		
@@ -0,0 +1,118 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QByteArray>
+#include <QMutexLocker>
+#include <QString>
+#include <QUrl>
+
+#include "ebook.h"				// EBook
+#include "imagetranscoder.h"		// ImageTranscoder
+#include "mimehelper.h"			// MimeHelper::mimeType
+#include "resourcecache.h"
+
+
+ResourceCache::ResourceCache( int budget, ImageTranscoder * transcoder )
+	: m_transcoder( transcoder ), m_cache( budget )
+{
+	m_generation = 0;
+}
+
+bool ResourceCache::find( const QUrl& url, QByteArray& data, QByteArray& mimetype ) const
+{
+	QMutexLocker locker( &m_lock );
+	Entry * entry = m_cache.object( url );
+
+	if ( !entry )
+		return false;
+
+	data = entry->data;
+	mimetype = entry->mimetype;
+	return true;
+}
+
+void ResourceCache::insert( const QUrl& url, const QByteArray& data, const QByteArray& mimetype, unsigned int generation )
+{
+	// Large media would just push everything else out
+	if ( data.size() > m_cache.maxCost() / 4 )
+		return;
+
+	QMutexLocker locker( &m_lock );
+
+	if ( generation != m_generation )
+		return;
+
+	Entry * entry = new Entry;
+	entry->data = data;
+	entry->mimetype = mimetype;
+
+	m_cache.insert( url, entry, data.size() );
+}
+
+bool ResourceCache::fetch( EBook * ebook, const QUrl& url, const QString& encoding, unsigned int generation,
+						   QByteArray& data, QByteArray& mimetype )
+{
+	if ( find( url, data, mimetype ) )
+		return true;
+
+	// Retreive the data from ebook file
+	if ( !ebook->getFileContentAsBinary( data, url ) )
+		return false;
+
+	mimetype = MimeHelper::mimeType( url, data );
+
+	// Uncompressed images are served converted, if enabled. The original served while the conversion
+	// is running must not be cached, or the converted one would never be served.
+	bool cacheable = m_transcoder->process( url, data, mimetype ) != ImageTranscoder::DEFERRED;
+
+#if defined (USE_WEBENGINE)
+	// We must specify the proper MIME type for the page to display correctly.
+	// The HTML and XML files correspond to "text/html";
+	// for other types "application/octet-stream" is sufficient.
+	// In addition, for "text/html", a "meta" tag is added specifying the text encoding.
+	// This is the easiest and most stable way to set the encoding.
+	// WebKit sets the charset in the reply header instead.
+	if ( mimetype == "text/html" )
+	{
+		data.prepend( QString( "<META http-equiv='Content-Type' content='text/html; charset=%1'>" )
+					  .arg( encoding ).toLatin1() );
+	}
+#else
+	Q_UNUSED( encoding );
+#endif
+
+	// Keep it as served; ignored if the encoding was changed meanwhile
+	if ( cacheable )
+		insert( url, data, mimetype, generation );
+
+	return true;
+}
+
+unsigned int ResourceCache::generation() const
+{
+	QMutexLocker locker( &m_lock );
+	return m_generation;
+}
+
+void ResourceCache::clear()
+{
+	QMutexLocker locker( &m_lock );
+
+	m_cache.clear();
+	m_generation++;
+}
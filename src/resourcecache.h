@@ -0,0 +1,76 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RESOURCECACHE_H
+#define RESOURCECACHE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QMutex>
+#include <QString>
+#include <QUrl>
+
+class EBook;
+class ImageTranscoder;
+
+//! Cache of the resources served to the browser, shared by all the tabs. Keeps the content
+//! in the form the browser backend serves it, together with its MIME type, so the repeated requests
+//! (stylesheets, scripts, images, reloads) do not decompress and analyze the same data again.
+//! Thread-safe, as the content could be loaded in the worker threads.
+class ResourceCache
+{
+	public:
+		//! \param budget Total size of the cached content in bytes
+		//! \param transcoder Converts the legacy images when they are loaded
+		ResourceCache( int budget, ImageTranscoder * transcoder );
+
+		//! Looks up the url; returns false if it is not cached.
+		bool	find( const QUrl& url, QByteArray& data, QByteArray& mimetype ) const;
+
+		//! Adds the content into the cache, unless it is too large or the cache
+		//! has been cleared since generation() was taken.
+		void	insert( const QUrl& url, const QByteArray& data, const QByteArray& mimetype, unsigned int generation );
+
+		//! Returns the resource in the form the browser backend serves it, loading it from the ebook
+		//! and caching if it is not cached yet. Returns false if the ebook has no such file.
+		//! Thread-safe; the encoding and generation must be taken in the GUI thread.
+		bool	fetch( EBook * ebook, const QUrl& url, const QString& encoding, unsigned int generation,
+					   QByteArray& data, QByteArray& mimetype );
+
+		//! Current cache generation. Take it before loading the content which is going to be inserted.
+		unsigned int generation() const;
+
+		//! Drops all the content. Must be called when the ebook is closed, or its encoding is changed.
+		void	clear();
+
+	private:
+		class Entry
+		{
+			public:
+				QByteArray	data;
+				QByteArray	mimetype;
+		};
+
+		ImageTranscoder			*	m_transcoder;
+
+		mutable QMutex				m_lock;
+		QCache< QUrl, Entry >		m_cache;
+		unsigned int				m_generation;
+};
+
+#endif // RESOURCECACHE_H
@@ -29,7 +29,7 @@
 
 
 static qint32 SETTINGS_MAGIC = 0xD8AB4E76;
-static qint32 SETTINGS_VERSION = 4;
+static qint32 SETTINGS_VERSION = 5;
 
 /*
  * The order is important!
@@ -53,6 +53,8 @@ enum marker_t
 	MARKER_INDEXDATA,
 
 	MARKER_ACTIVEENCODINGNAME,
+
+	MARKER_PAGETRANSITIONS,
 		
 	// This should be the last
 	MARKER_END = 0x7FFF
@@ -130,6 +132,7 @@ bool Settings::loadSettings( const QString & filename )
 	m_searchhistory.clear();
 	m_bookmarks.clear();
 	m_viewwindows.clear();
+	m_pageTransitions.clear();
 
 	QFileInfo finfo ( filename );
 
@@ -234,6 +237,10 @@ bool Settings::loadSettings( const QString & filename )
 		case MARKER_VIEWINDOWS:
 			stream >> m_viewwindows;
 			break;
+
+		case MARKER_PAGETRANSITIONS:
+			stream >> m_pageTransitions;
+			break;
 		}
 	}
 	
@@ -290,6 +297,9 @@ bool Settings::saveSettings( )
 
 	stream << MARKER_VIEWINDOWS;
 	stream << m_viewwindows;
+
+	stream << MARKER_PAGETRANSITIONS;
+	stream << m_pageTransitions;
 	
 	stream << MARKER_END;
 	return true;
@@ -300,7 +310,9 @@ void Settings::removeSettings( const QString & filename )
 {
 	QString settingsfile = pConfig->getEbookSettingFile( filename );
 	QString idxfile = pConfig->getEbookIndexFile( filename );
+	QString navigationfile = pConfig->getEbookNavigationFile( filename );
 
 	QFile::remove( settingsfile );
 	QFile::remove( idxfile );
+	QFile::remove( navigationfile );
 }
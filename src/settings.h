@@ -19,9 +19,10 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
+#include <QHash>
 #include <QList>
 #include <QString>
-#include <QtGlobal> // qreal
+#include <QtGlobal> // qreal, quint32
 
 
 class Settings
@@ -60,6 +61,9 @@ class Settings
 		typedef QList<QString>			search_saved_settings_t;
 		typedef QList<SavedBookmark>	bookmark_saved_settings_t;
 		typedef QList<SavedViewWindow>	viewindow_saved_settings_t;
+
+		// How many times each page was followed by another one; keyed by the page URLs
+		typedef QHash< QString, QHash<QString, quint32> >	page_transitions_t;
 		
 		int							m_window_size_x;
 		int							m_window_size_y;
@@ -70,6 +74,7 @@ class Settings
 		search_saved_settings_t		m_searchhistory;
 		bookmark_saved_settings_t	m_bookmarks;
 		viewindow_saved_settings_t	m_viewwindows;
+		page_transitions_t			m_pageTransitions;
 	
 	private:
 		unsigned int				m_currentfilesize;
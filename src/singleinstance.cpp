@@ -0,0 +1,206 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QAbstractSocket>		// QAbstractSocket::AddressInUseError
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QIODevice>			// QIODevice::WriteOnly
+#include <QLatin1String>
+#include <QList>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>				// qWarning, qPrintable
+
+#include "singleinstance.h"
+
+
+// The running instance is local and idle, so it answers quickly
+static const int CONNECT_TIMEOUT = 1000;
+static const int ACK_TIMEOUT = 5000;
+
+// Frame is the 32-bit message size followed by the serialized QStringList
+static const int FRAME_HEADER_SIZE = 4;
+static const quint32 MAX_MESSAGE_SIZE = 1024 * 1024;
+static const char MESSAGE_ACK = 0x06;
+
+// Both sides may be built with different Qt versions
+static const int STREAM_VERSION = QDataStream::Qt_5_0;
+
+
+SingleInstance::SingleInstance( const QString& token, QObject * parent )
+	: QObject( parent )
+{
+	// The token may contain anything, while the server name becomes a file name on Unix
+	m_serverName = QString( "uchmviewer-" ) + QLatin1String( QCryptographicHash::hash( token.toUtf8(), QCryptographicHash::Sha1 ).toHex() );
+	m_server = 0;
+}
+
+bool SingleInstance::start( const QStringList& message )
+{
+	// Another instance may be starting at the same time, so its server may appear between the attempts
+	for ( int attempt = 0; attempt < 2; attempt++ )
+	{
+		if ( sendMessage( message ) )
+			return true;
+
+		if ( listen() )
+			return false;
+
+		if ( m_server->serverError() != QAbstractSocket::AddressInUseError )
+			return false;
+	}
+
+	// Nobody answers on the address, so it is left by a crashed instance (on Unix)
+	if ( QLocalServer::removeServer( m_serverName ) )
+		listen();
+
+	return false;
+}
+
+bool SingleInstance::isListening() const
+{
+	return m_server && m_server->isListening();
+}
+
+QString SingleInstance::errorString() const
+{
+	return m_server ? m_server->errorString() : QString();
+}
+
+bool SingleInstance::sendMessage( const QStringList& message )
+{
+	QLocalSocket socket;
+	socket.connectToServer( m_serverName );
+
+	if ( !socket.waitForConnected( CONNECT_TIMEOUT ) )
+		return false;
+
+	QByteArray frame;
+	QDataStream stream( &frame, QIODevice::WriteOnly );
+	stream.setVersion( STREAM_VERSION );
+
+	// The size is known once the message is serialized
+	stream << quint32( 0 ) << message;
+	stream.device()->seek( 0 );
+	stream << quint32( frame.size() - FRAME_HEADER_SIZE );
+
+	socket.write( frame );
+
+	// The instance is there even if it does not confirm the message, so it is not started again
+	if ( !socket.waitForReadyRead( ACK_TIMEOUT ) || socket.read( 1 ) != QByteArray( 1, MESSAGE_ACK ) )
+		qWarning( "The running instance did not confirm the message: %s", qPrintable( socket.errorString() ) );
+
+	socket.disconnectFromServer();
+	return true;
+}
+
+bool SingleInstance::listen()
+{
+	if ( !m_server )
+	{
+		m_server = new QLocalServer( this );
+
+		// Only the same user may send the messages
+		m_server->setSocketOptions( QLocalServer::UserAccessOption );
+		connect( m_server, SIGNAL( newConnection() ), this, SLOT( onNewConnection() ) );
+	}
+
+	return m_server->listen( m_serverName );
+}
+
+void SingleInstance::onNewConnection()
+{
+	while ( QLocalSocket * socket = m_server->nextPendingConnection() )
+	{
+		m_buffers.insert( socket, QByteArray() );
+
+		connect( socket, SIGNAL( readyRead() ), this, SLOT( onReadyRead() ) );
+		connect( socket, SIGNAL( disconnected() ), this, SLOT( onDisconnected() ) );
+
+		// The message might have arrived before the signals were connected
+		readMessages( socket );
+	}
+}
+
+void SingleInstance::onReadyRead()
+{
+	QLocalSocket * socket = qobject_cast< QLocalSocket * >( sender() );
+
+	if ( socket )
+		readMessages( socket );
+}
+
+void SingleInstance::onDisconnected()
+{
+	QLocalSocket * socket = qobject_cast< QLocalSocket * >( sender() );
+
+	if ( !socket )
+		return;
+
+	m_buffers.remove( socket );
+	socket->deleteLater();
+}
+
+void SingleInstance::readMessages( QLocalSocket * socket )
+{
+	QList< QStringList > messages;
+	QByteArray& buffer = m_buffers[ socket ];
+
+	buffer += socket->readAll();
+
+	// Several messages may come in one connection, each one is confirmed separately
+	while ( buffer.size() >= FRAME_HEADER_SIZE )
+	{
+		quint32 size;
+		QDataStream header( buffer );
+		header >> size;
+
+		if ( size > MAX_MESSAGE_SIZE )
+		{
+			qWarning( "Single instance message is too large (%u bytes), dropping the connection", size );
+			buffer.clear();
+			socket->abort();
+			return;
+		}
+
+		if ( (quint32) buffer.size() - FRAME_HEADER_SIZE < size )
+			break;
+
+		QStringList message;
+		QDataStream stream( buffer.mid( FRAME_HEADER_SIZE, size ) );
+		stream.setVersion( STREAM_VERSION );
+		stream >> message;
+
+		buffer.remove( 0, FRAME_HEADER_SIZE + size );
+
+		socket->write( &MESSAGE_ACK, 1 );
+		socket->flush();
+
+		if ( stream.status() == QDataStream::Ok && !message.isEmpty() )
+			messages.push_back( message );
+		else
+			qWarning( "Invalid single instance message received" );
+	}
+
+	// Handling a message may run a nested event loop (a message box), which may delete the socket
+	for ( int i = 0; i < messages.size(); i++ )
+		emit messageReceived( messages[i] );
+}
@@ -0,0 +1,71 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SINGLEINSTANCE_H
+#define SINGLEINSTANCE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+class QLocalServer;
+class QLocalSocket;
+
+
+//! Single instance mode: the instances started with the same token pass their command line
+//! to the one which was started first, through a local socket. Every message is a length-prefixed
+//! frame, and the running instance confirms each one as soon as it is queued, so the sender
+//! could quit immediately. Several senders may talk to the running instance at the same time.
+class SingleInstance : public QObject
+{
+	Q_OBJECT
+
+	public:
+		SingleInstance( const QString& token, QObject * parent = 0 );
+
+		//! Sends the message to the running instance with the same token; returns true if it is
+		//! delivered. Otherwise this instance becomes the running one, see isListening().
+		bool	start( const QStringList& message );
+
+		bool	isListening() const;
+		QString	errorString() const;
+
+	signals:
+		//! The message from another instance, in the order they came
+		void	messageReceived( const QStringList& message );
+
+	private slots:
+		void	onNewConnection();
+		void	onReadyRead();
+		void	onDisconnected();
+
+	private:
+		bool	sendMessage( const QStringList& message );
+		bool	listen();
+		void	readMessages( QLocalSocket * socket );
+
+		QString					m_serverName;
+		QLocalServer		*	m_server;
+
+		// Incomplete frames of the connected senders
+		QHash< QLocalSocket *, QByteArray >	m_buffers;
+};
+
+#endif // SINGLEINSTANCE_H
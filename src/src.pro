@@ -11,11 +11,16 @@ QT += \
 
 HEADERS += \
     config.h \
+    contentprefetcher.h \
+    contentstream.h \
     dialog_chooseurlfromlist.h \
     dialog_setup.h \
+    ebookreaders.h \
+    httpserver.h \
     kde-qt.h \
     mainwindow.h \
     recentfiles.h \
+    resourcecache.h \
     settings.h \
     tab_bookmarks.h \
     tab_contents.h \
@@ -24,35 +29,52 @@ HEADERS += \
     version.h \
     viewwindow.h \
     viewwindowmgr.h \
+    navigationcache.h \
+    navigationloader.h \
     navigationpanel.h \
+    opentiming.h \
     toolbarmanager.h \
     toolbareditor.h \
     textencodings.h \
-    treeitem_toc.h \
-    treeitem_index.h \
+    treemodel_index.h \
+    treemodel_search.h \
+    treemodel_toc.h \
     mimehelper.h \
+    singleinstance.h \
     showwaitcursor.h \
+    imagetranscoder.h \
     i18n.h
 
 SOURCES += \
     config.cpp \
+    contentprefetcher.cpp \
+    contentstream.cpp \
     dialog_chooseurlfromlist.cpp \
     dialog_setup.cpp \
+    ebookreaders.cpp \
+    httpserver.cpp \
     main.cpp \
     mainwindow.cpp \
     recentfiles.cpp \
+    resourcecache.cpp \
     settings.cpp \
     tab_bookmarks.cpp \
     tab_contents.cpp \
     tab_index.cpp \
     tab_search.cpp \
+    navigationcache.cpp \
+    navigationloader.cpp \
     navigationpanel.cpp \
+    opentiming.cpp \
     toolbarmanager.cpp \
     toolbareditor.cpp \
     textencodings.cpp \
-    treeitem_toc.cpp \
-    treeitem_index.cpp \
+    treemodel_index.cpp \
+    treemodel_search.cpp \
+    treemodel_toc.cpp \
     mimehelper.cpp \
+    singleinstance.cpp \
+    imagetranscoder.cpp \
     i18n.cpp
 
 FORMS += tab_bookmarks.ui \
@@ -17,20 +17,19 @@
  */
 
 #include <QList>
+#include <QModelIndex>
 #include <QObject>			// QObject::connect
 #include <QPoint>
-#include <Qt>				// Qt::CustomContextMenu, Qt::MatchRecursive, Qt::MatchWildcard
-#include <QtGlobal>			// qFatal, qWarning
-#include <QTreeWidgetItem>
+#include <QString>
+#include <Qt>				// Qt::CustomContextMenu, Qt::DisplayRole, Qt::MatchRecursive, Qt::MatchWildcard
+#include <QtGlobal>			// qWarning
 #include <QUrl>
-#include <QVector>
 
 #include "ebook.h"			// EBookTocEntry
 #include "config.h"			// pConfig
 #include "mainwindow.h"		// ::mainWindow
-#include "showwaitcursor.h"	// ShowWaitCursor
 #include "tab_contents.h"	// TabContents, QWidget
-#include "treeitem_toc.h"	// TreeItem_TOC
+#include "treemodel_toc.h"	// TreeModel_TOC
 #include "viewwindow.h"		// ViewWindow
 
 
@@ -40,25 +39,34 @@ TabContents::TabContents( QWidget *parent )
 	setupUi( this );
 	
 	m_contextMenu = 0;
-	
+
+	m_model = new TreeModel_TOC( this );
+	tree->setModel( m_model );
+
+	// All the rows have the same height, so the view does not have to measure each one
+	tree->setUniformRowHeights( true );
 	tree->header()->hide();
 	
 	// Handle clicking on m_contentsWindow element
     if ( pConfig->m_tabUseSingleClick )
     {
         connect( tree,
-                 SIGNAL( itemClicked(QTreeWidgetItem*,int)),
+                 SIGNAL( clicked(QModelIndex)),
                  this,
-                 SLOT( onClicked ( QTreeWidgetItem *, int ) ) );
+                 SLOT( onClicked ( QModelIndex ) ) );
     }
     else
     {
         connect( tree,
-                 SIGNAL( itemActivated ( QTreeWidgetItem *, int ) ),
+                 SIGNAL( activated ( QModelIndex ) ),
                  this,
-                 SLOT( onClicked ( QTreeWidgetItem *, int ) ) );
+                 SLOT( onClicked ( QModelIndex ) ) );
     }
 
+	// The book icons show whether the entry is expanded
+	connect( tree, SIGNAL( expanded(QModelIndex) ), this, SLOT( onExpanded(QModelIndex) ) );
+	connect( tree, SIGNAL( collapsed(QModelIndex) ), this, SLOT( onCollapsed(QModelIndex) ) );
+
 	// Activate custom context menu, and connect it
 	tree->setContextMenuPolicy( Qt::CustomContextMenu );
 	connect( tree, 
@@ -73,151 +81,84 @@ TabContents::~TabContents()
 {
 }
 
-void TabContents::refillTableOfContents( )
+void TabContents::setTableOfContents( const QList< EBookTocEntry >& data )
 {
-	ShowWaitCursor wc;
-	QList< EBookTocEntry > data;
-	
-	if ( !::mainWindow->chmFile()->getTableOfContents( data )
-	|| data.size() == 0 )
+	if ( data.size() == 0 )
 	{
 		qWarning ("Table of contents is present but is empty; wrong parsing?");
 		return;
 	}
 
-	// Fill up the tree; we use a pretty complex routine to handle buggy CHMs
-	QVector< TreeItem_TOC *> lastchild;
-	QVector< TreeItem_TOC *> rootentry;
-	bool warning_shown = false;
+	m_model->setTableOfContents( data );
 
-	tree->clear();
+    // This lays out every row, which takes a while for the huge TOCs, but that is what the option asks for
+    if ( pConfig->m_tocOpenAllEntries )
+    {
+        tree->expandAll();
+        m_model->setAllExpanded( true );
+    }
 
-	for ( int i = 0; i < data.size(); i++ )
+	// The search requested while the contents were loading
+	if ( !m_pendingSearch.isEmpty() )
 	{
-		int indent = data[i].indent;
-
-		// Do we need to add another indent?
-		if ( indent >= rootentry.size() )
-		{
-			int maxindent = rootentry.size() - 1;
-
-			// Resize the arrays
-			lastchild.resize( indent + 1 );
-			rootentry.resize( indent + 1 );
-
-			if ( indent > 0 && maxindent < 0 )
-				qFatal("Invalid fisrt TOC indent (first entry has no root entry), aborting.");
-
-			// And init the rest if needed
-			if ( (indent - maxindent) > 1 )
-			{
-				if ( !warning_shown )
-				{
-					qWarning("Invalid TOC step, applying workaround. Results may vary.");
-					warning_shown = true;
-				}
-
-				for ( int j = maxindent; j < indent; j++ )
-				{
-					lastchild[j+1] = lastchild[j];
-					rootentry[j+1] = rootentry[j];
-				}
-			}
-
-			lastchild[indent] = 0;
-			rootentry[indent] = 0;
-		}
-
-		// Create the node
-		TreeItem_TOC * item;
-
-		if ( indent == 0 )
-			item = new TreeItem_TOC( tree, lastchild[indent], data[i].name, data[i].url, data[i].iconid );
-		else
-		{
-			// New non-root entry. It is possible (for some buggy CHMs) that there is no previous entry: previoous entry had indent 1,
-			// and next entry has indent 3. Backtracking it up, creating missing entries.
-			if ( rootentry[indent-1] == 0 )
-				qFatal("Child entry indented as %d with no root entry!", indent);
-
-			item = new TreeItem_TOC( rootentry[indent-1], lastchild[indent], data[i].name, data[i].url, data[i].iconid );
-		}
-
-        if ( pConfig->m_tocOpenAllEntries )
-            item->setExpanded( true );
-
-		lastchild[indent] = item;
-		rootentry[indent] = item;
+		QString text = m_pendingSearch;
+		m_pendingSearch.clear();
+		search( text );
 	}
-
-	tree->update();
 }
 
-
-static TreeItem_TOC * findTreeItem( TreeItem_TOC *item, const QUrl& url, bool ignorefragment )
+bool TabContents::showUrl( const QUrl& url )
 {
-	if ( item->containstUrl( url, ignorefragment ) )
-		return item;
+	QModelIndex index = m_model->findUrl( url );
 
-	for ( int i = 0; i < item->childCount(); ++i )
-	{
-		TreeItem_TOC * bitem = findTreeItem( (TreeItem_TOC *) item->child( i ), url, ignorefragment );
+	if ( !index.isValid() )
+		return false;
 
-		if ( bitem )
-			return bitem;
-	}
+	// Open all the tree items to show current item
+	for ( QModelIndex parent = index.parent(); parent.isValid(); parent = parent.parent() )
+		tree->expand( parent );
 
-	return 0;
+	tree->setCurrentIndex( index );
+	tree->scrollTo( index );
+	return true;
 }
 
-TreeItem_TOC * TabContents::getTreeItem( const QUrl& url )
+QUrl TabContents::urlPrevInToc( const QUrl& url ) const
 {
-	// During the first iteraction we check for the fragment as well, so the URLs
-	// like ch05.htm#app1 and ch05.htm#app2 could be handled as different TOC entries
-	for ( int i = 0; i < tree->topLevelItemCount(); i++ )
-	{
-		TreeItem_TOC * item = findTreeItem( (TreeItem_TOC*) tree->topLevelItem(i), url, false );
-
-		if ( item )
-			return item;
-	}
-
-	// During the second iteraction we ignore the fragment, so if there is no ch05.htm#app1
-	// but there is ch05.htm, we just use it
-	for ( int i = 0; i < tree->topLevelItemCount(); i++ )
-	{
-		TreeItem_TOC * item = findTreeItem( (TreeItem_TOC*) tree->topLevelItem(i), url, true );
-
-		if ( item )
-			return item;
-	}
-
-	return 0;
+	return m_model->url( m_model->previous( m_model->findUrl( url ) ) );
 }
 
-void TabContents::showItem( TreeItem_TOC * item )
+QUrl TabContents::urlNextInToc( const QUrl& url ) const
 {
-	tree->setCurrentItem( item );
-	tree->scrollToItem( item );
+	return m_model->url( m_model->next( m_model->findUrl( url ) ) );
 }
 
 
-void TabContents::onClicked(QTreeWidgetItem * item, int)
+void TabContents::onClicked( const QModelIndex& index )
 {
-	if ( !item )
+	if ( !index.isValid() )
 		return;
 	
-	TreeItem_TOC * treeitem = (TreeItem_TOC*) item;
-	::mainWindow->activateUrl( treeitem->getUrl() );
+	::mainWindow->activateUrl( m_model->url( index ) );
+}
+
+void TabContents::onExpanded( const QModelIndex& index )
+{
+	m_model->setExpanded( index, true );
+}
+
+void TabContents::onCollapsed( const QModelIndex& index )
+{
+	m_model->setExpanded( index, false );
 }
 
 void TabContents::onContextMenuRequested(const QPoint & point)
 {
-	TreeItem_TOC * treeitem = (TreeItem_TOC *) tree->itemAt( point );
+	QModelIndex index = tree->indexAt( point );
 	
-	if( treeitem )
+	if( index.isValid() )
 	{
-		::mainWindow->currentBrowser()->setTabKeeper( treeitem->getUrl() );
+		::mainWindow->currentBrowser()->setTabKeeper( m_model->url( index ) );
 		::mainWindow->tabItemsContextMenu()->popup( tree->viewport()->mapToGlobal( point ) );
 	}
 }
@@ -225,13 +166,19 @@ void TabContents::onContextMenuRequested(const QPoint & point)
 
 void TabContents::search( const QString & text )
 {
-	QList<QTreeWidgetItem*> items = tree->findItems( text, Qt::MatchWildcard | Qt::MatchRecursive );
+	if ( m_model->rowCount() == 0 )
+	{
+		m_pendingSearch = text;
+		return;
+	}
+
+	QModelIndexList items = m_model->match( m_model->index( 0, 0 ), Qt::DisplayRole, text, 1,
+											Qt::MatchWildcard | Qt::MatchRecursive );
 
 	if ( items.isEmpty() )
 		return;
 			
-	TreeItem_TOC * treeitem = (TreeItem_TOC *) items.first();
-	::mainWindow->activateUrl( treeitem->getUrl() );
+	::mainWindow->activateUrl( m_model->url( items.first() ) );
 }
 
 void TabContents::focus()
@@ -19,17 +19,19 @@
 #ifndef TAB_CONTENTS_H
 #define TAB_CONTENTS_H
 
+#include <QList>
+#include <QString>
 #include <QWidget>
 
 #include "ui_tab_contents.h"
 
 class QMenu;
+class QModelIndex;
 class QPoint;
-class QString;
-class QTreeWidgetItem;
 class QUrl;
 
-class TreeItem_TOC;
+class EBookTocEntry;
+class TreeModel_TOC;
 
 
 class TabContents : public QWidget, public Ui::TabContents
@@ -39,19 +41,30 @@ class TabContents : public QWidget, public Ui::TabContents
 		TabContents( QWidget *parent = 0 );
 		~TabContents();
 		
-		void	refillTableOfContents();
-		void	showItem( TreeItem_TOC * item );
+		// Fills the tree with the table of contents loaded by NavigationLoader
+		void	setTableOfContents( const QList< EBookTocEntry >& data );
 		void	search( const QString& text );
 		void	focus();
-		
-		TreeItem_TOC *	getTreeItem(const QUrl &url );
+
+		// Locates the URL in the tree, expanding the parents; returns false if it is not in TOC
+		bool	showUrl( const QUrl& url );
+
+		// Returns the previous/next page in TOC, or an empty URL
+		QUrl	urlPrevInToc( const QUrl& url ) const;
+		QUrl	urlNextInToc( const QUrl& url ) const;
 		
 	public slots:
 		void	onContextMenuRequested ( const QPoint &point );
-		void	onClicked ( QTreeWidgetItem * item, int column );
+		void	onClicked ( const QModelIndex& index );
+
+	private slots:
+		void	onExpanded( const QModelIndex& index );
+		void	onCollapsed( const QModelIndex& index );
 	
 	private:
-		QMenu 	*	m_contextMenu;
+		QMenu 			*	m_contextMenu;
+		TreeModel_TOC	*	m_model;
+		QString				m_pendingSearch;
 };
 
 
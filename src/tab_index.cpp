@@ -16,23 +16,21 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QHeaderView>
 #include <QList>
+#include <QModelIndex>
 #include <QObject>			// QObject::connect
 #include <QPoint>
-#include <QShowEvent>
 #include <QString>
-#include <Qt>				// Qt::CustomContextMenu, Qt::MatchFixedString, Qt::MatchStartsWith
-#include <QtGlobal>			// qFatal, qWarning
-#include <QTreeWidgetItem>
+#include <Qt>				// Qt::CustomContextMenu
+#include <QtGlobal>			// qWarning
 #include <QUrl>
-#include <QVector>
 
 #include "config.h"			// pConfig
 #include "ebook.h"			// EBookIndexEntry
 #include "mainwindow.h"		// :mainWindow
-#include "showwaitcursor.h"	// ShowWaitCursor
 #include "tab_index.h"		// TabIndex, QWidget
-#include "treeitem_index.h"	// TreeItem_Index
+#include "treemodel_index.h"	// TreeModel_Index
 #include "viewwindow.h"		// ViewWindow
 
 
@@ -42,7 +40,9 @@ TabIndex::TabIndex ( QWidget * parent )
 	// UIC stuff
 	setupUi( this );
 	
-	tree->headerItem()->setHidden( true );
+	m_model = new TreeModel_Index( this );
+	tree->setModel( m_model );
+	tree->header()->hide();
 	
 	connect( text,
 			 SIGNAL( textChanged (const QString &) ), 
@@ -57,16 +57,16 @@ TabIndex::TabIndex ( QWidget * parent )
     if ( pConfig->m_tabUseSingleClick )
     {
         connect( tree,
-                 SIGNAL( itemClicked(QTreeWidgetItem*,int)),
+                 SIGNAL( clicked(QModelIndex)),
                  this,
-                 SLOT( onItemActivated( QTreeWidgetItem *, int ) ) );
+                 SLOT( onItemActivated( QModelIndex ) ) );
     }
     else
     {
         connect( tree,
-                 SIGNAL( itemActivated ( QTreeWidgetItem *, int ) ),
+                 SIGNAL( activated ( QModelIndex ) ),
                  this,
-                 SLOT( onItemActivated( QTreeWidgetItem *, int ) ) );
+                 SLOT( onItemActivated( QModelIndex ) ) );
     }
 
 	// Activate custom context menu, and connect it
@@ -76,8 +76,6 @@ TabIndex::TabIndex ( QWidget * parent )
 	         this, 
 	         SLOT( onContextMenuRequested( const QPoint & ) ) );
 	
-	m_indexListFilled = false;
-	m_lastSelectedItem = 0;
 	m_contextMenu = 0;
 
 	focus();
@@ -85,157 +83,72 @@ TabIndex::TabIndex ( QWidget * parent )
 
 void TabIndex::onTextChanged ( const QString & newvalue)
 {
-	QList<QTreeWidgetItem *> items = tree->findItems( newvalue, Qt::MatchStartsWith );
+	m_lastSelectedItem = m_model->findPrefix( newvalue );
 	
-	if ( !items.isEmpty() )
+	if ( m_lastSelectedItem.isValid() )
 	{
-		m_lastSelectedItem = items[0];
-		tree->setCurrentItem( m_lastSelectedItem );
-		tree->scrollToItem( m_lastSelectedItem );
+		tree->setCurrentIndex( m_lastSelectedItem );
+		tree->scrollTo( m_lastSelectedItem );
 	}
-	else
-		m_lastSelectedItem = 0;
 }
 
 
-void TabIndex::showEvent( QShowEvent * )
-{
-	if ( !::mainWindow->chmFile() || m_indexListFilled )
-		return;
-
-	m_indexListFilled = true;
-	refillIndex();
-}
-
 void TabIndex::onReturnPressed( )
 {
-	if ( !m_lastSelectedItem )
+	if ( !m_lastSelectedItem.isValid() )
 		return;
 	
-	TreeItem_Index * treeitem = (TreeItem_Index*) m_lastSelectedItem;
-	::mainWindow->activateUrl( treeitem->getUrl() );
+	::mainWindow->activateUrl( m_model->url( m_lastSelectedItem ) );
 }
 
 
 void TabIndex::invalidate( )
 {
-	tree->clear();
-	m_indexListFilled = false;
-	m_lastSelectedItem = 0;
+	m_model->setIndex( QList< EBookIndexEntry >() );
+	m_lastSelectedItem = QModelIndex();
 }
 
-void TabIndex::onItemActivated ( QTreeWidgetItem * item, int )
+void TabIndex::onItemActivated ( const QModelIndex& index )
 {
-	if ( !item )
+	if ( !index.isValid() )
 		return;
 	
-	TreeItem_Index * treeitem = (TreeItem_Index*) item;
-	
-	// Prevent opened index tree item from closing; because the tree open/close 
-	// procedure will be triggered after the slots are called, we change the tree
-	// state to "collapsed", so the slot handler expands it again.
-	if ( item->isExpanded() )
-		item->setExpanded( false );
-	
-	QUrl url = treeitem->getUrl();
-	
-	if ( !url.isValid() )
-		return;
+	// The items cannot be collapsed (see the form), so the tree stays open when the item is activated
+	QString seealso = m_model->seeAlso( index );
 
-	if ( treeitem->isSeeAlso() ) // 'see also' link
+	if ( !seealso.isEmpty() ) // 'see also' link
 	{
-		QList<QTreeWidgetItem *> items = tree->findItems( treeitem->seeAlso(), Qt::MatchFixedString );
+		m_lastSelectedItem = m_model->findKeyword( seealso );
 	
-		if ( !items.isEmpty() )
+		if ( m_lastSelectedItem.isValid() )
 		{
-			m_lastSelectedItem = items[0];
-			tree->setCurrentItem( m_lastSelectedItem );
-			tree->scrollToItem( m_lastSelectedItem );
+			tree->setCurrentIndex( m_lastSelectedItem );
+			tree->scrollTo( m_lastSelectedItem );
 		}
-		else
-			m_lastSelectedItem = 0;
+		return;
 	}
-	else
+
+	QUrl url = m_model->url( index );
+	
+	if ( url.isValid() )
 		::mainWindow->openPage( url, MainWindow::OPF_CONTENT_TREE );
 }
 
 
-void TabIndex::refillIndex( )
+void TabIndex::setIndex( const QList< EBookIndexEntry >& data )
 {
-	ShowWaitCursor wc;
-	QList< EBookIndexEntry > data;
-	
-	if ( !::mainWindow->chmFile()->getIndex( data ) || data.size() == 0 )
+	if ( data.size() == 0 )
 	{
 		qWarning ("CHM index present but is empty; wrong parsing?");
 		return;
 	}
 	
-	QVector< TreeItem_Index *> lastchild;
-	QVector< TreeItem_Index *> rootentry;
-	bool warning_shown = false;
-
-	tree->clear();
-
-	for ( int i = 0; i < data.size(); i++ )
-	{
-		int indent = data[i].indent;
-
-		// Do we need to add another indent?
-		if ( indent >= rootentry.size() )
-		{
-			int maxindent = rootentry.size() - 1;
+	m_model->setIndex( data );
+	m_lastSelectedItem = QModelIndex();
 
-			// Resize the arrays
-			lastchild.resize( indent + 1 );
-			rootentry.resize( indent + 1 );
-
-			if ( indent > 0 && maxindent < 0 )
-				qFatal("Invalid fisrt TOC indent (first entry has no root entry), aborting.");
-
-			// And init the rest if needed
-			if ( (indent - maxindent) > 1 )
-			{
-				if ( !warning_shown )
-				{
-					qWarning("Invalid TOC step, applying workaround. Results may vary.");
-					warning_shown = true;
-				}
-
-				for ( int j = maxindent; j < indent; j++ )
-				{
-					lastchild[j+1] = lastchild[j];
-					rootentry[j+1] = rootentry[j];
-				}
-			}
-
-			lastchild[indent] = 0;
-			rootentry[indent] = 0;
-		}
-
-		// Create the node
-		TreeItem_Index * item;
-
-		if ( indent == 0 )
-			item = new TreeItem_Index( tree, lastchild[indent], data[i].name, data[i].urls, data[i].seealso );
-		else
-		{
-			// New non-root entry. It is possible (for some buggy CHMs) that there is no previous entry: previoous entry had indent 1,
-			// and next entry has indent 3. Backtracking it up, creating missing entries.
-			if ( rootentry[indent-1] == 0 )
-				qFatal("Child entry indented as %d with no root entry!", indent);
-
-			item = new TreeItem_Index( rootentry[indent-1], lastchild[indent], data[i].name, data[i].urls, data[i].seealso );
-		}
-
-		// Make it open
-		item->setExpanded( true );
-
-		lastchild[indent] = item;
-		rootentry[indent] = item;
-	}
-
-	tree->update();
+	// The user may have typed or searched something while the index was loading
+	if ( !text->text().isEmpty() )
+		onTextChanged( text->text() );
 }
 
 void TabIndex::search( const QString & index )
@@ -243,12 +156,7 @@ void TabIndex::search( const QString & index )
 	if ( !::mainWindow->chmFile() )
 		return;
 
-	if ( !m_indexListFilled )
-	{
-		m_indexListFilled = true;
-		refillIndex();
-	}
-
+	// If the index is still loading, the keyword is found when it arrives
 	text->setText( index );
 	onTextChanged( index );
 }
@@ -261,11 +169,11 @@ void TabIndex::focus()
 
 void TabIndex::onContextMenuRequested(const QPoint & point)
 {
-	TreeItem_Index * treeitem = (TreeItem_Index *) tree->itemAt( point );
+	QModelIndex index = tree->indexAt( point );
 	
-	if( treeitem )
+	if( index.isValid() )
 	{
-		::mainWindow->currentBrowser()->setTabKeeper( treeitem->getUrl() );
+		::mainWindow->currentBrowser()->setTabKeeper( m_model->url( index ) );
 		::mainWindow->tabItemsContextMenu()->popup( tree->viewport()->mapToGlobal( point ) );
 	}
 }
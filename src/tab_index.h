@@ -19,15 +19,19 @@
 #ifndef TAB_INDEX_H
 #define TAB_INDEX_H
 
+#include <QList>
+#include <QPersistentModelIndex>
 #include <QWidget>
 
 #include "ui_tab_index.h"
 
 class QMenu;
+class QModelIndex;
 class QPoint;
-class QShowEvent;
 class QString;
-class QTreeWidgetItem;
+
+class EBookIndexEntry;
+class TreeModel_Index;
 
 
 class TabIndex : public QWidget, public Ui::TabIndex
@@ -37,23 +41,23 @@ class TabIndex : public QWidget, public Ui::TabIndex
 		TabIndex( QWidget * parent = 0 );
 	
 		void	invalidate();
+
+		// Fills the tree with the index loaded by NavigationLoader
+		void	setIndex( const QList< EBookIndexEntry >& data );
+
 		void	search( const QString& index );
 		void	focus();
 		
 	private slots:
 		void 	onTextChanged ( const QString & newvalue);
 		void 	onReturnPressed ();
-		void	onItemActivated ( QTreeWidgetItem * item, int column );
+		void	onItemActivated ( const QModelIndex& index );
 		void	onContextMenuRequested ( const QPoint &point );
 		
 	private:
-		void	showEvent ( QShowEvent * );
-		
-		void	refillIndex();
-		
 		QMenu 			* 	m_contextMenu;	
-		QTreeWidgetItem	*	m_lastSelectedItem;
-		bool				m_indexListFilled;
+		TreeModel_Index	*	m_model;
+		QPersistentModelIndex	m_lastSelectedItem;
 };
 
 #endif
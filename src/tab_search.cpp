@@ -26,16 +26,13 @@
 #include <QList>
 #include <QMenu>
 #include <QMessageBox>
+#include <QModelIndex>
 #include <QObject>			// QObject::connect
 #include <QPoint>
 #include <QProgressDialog>
 #include <QString>
-#include <Qt>				// Qt::DisplayRole, Qt::ToolTipRole, Qt::WhatsThisRole
-							// Qt::CustomContextMenu
-#include <QTreeWidget>
-#include <QTreeWidgetItem>
+#include <Qt>				// Qt::CustomContextMenu, Qt::AscendingOrder, Qt::DescendingOrder
 #include <QUrl>
-#include <QVariant>
 #include <QWhatsThis>
 
 #include "i18n.h"
@@ -46,51 +43,26 @@
 #include "settings.h"		// Settings::search_saved_settings_t
 #include "showwaitcursor.h"	// ShowWaitCursor
 #include "tab_search.h"		// TabSearch, QWidget
+#include "treemodel_search.h"	// TreeModel_Search
 #include "viewwindow.h"		// ViewWindow
 
 
-class SearchTreeViewItem : public QTreeWidgetItem
-{
-	public:
-		SearchTreeViewItem( QTreeWidget * tree, const QString& name, const QUrl& url )
-			:	QTreeWidgetItem( tree ), m_name( name ), m_url( url ) {}
-	
-		QUrl	getUrl() const { return m_url; }
-	
-	protected:
-		// Overriden members
-		int columnCount () const	{ return 2; }
-	
-		// Overriden member
-		QVariant data ( int column, int role ) const
-		{
-			switch( role )
-			{
-				// Item name
-				case Qt::DisplayRole:
-				case Qt::ToolTipRole:
-				case Qt::WhatsThisRole:
-				if ( column == 0 )
-					return m_name;
-				else
-					return m_url.path();
-			}
-			
-			return QVariant();
-		}
-	
-	private:
-		QString		m_name;		
-		QUrl		m_url;
-};
-
-
-
 TabSearch::TabSearch( QWidget * parent )
 	: QWidget( parent ), Ui::TabSearch()
 {
 	// UIC stuff
 	setupUi( this );
+
+	m_model = new TreeModel_Search( this );
+	tree->setModel( m_model );
+
+	// Clicking on the column header sorts the results by it
+	tree->header()->setSectionsClickable( true );
+	tree->header()->setSortIndicatorShown( false );
+	connect( tree->header(),
+			 SIGNAL( sectionClicked(int) ),
+			 this,
+			 SLOT( onHeaderClicked(int) ) );
 	
 	// Clickable Help label
 	connect( lblHelp, 
@@ -114,16 +86,16 @@ TabSearch::TabSearch( QWidget * parent )
     if ( pConfig->m_tabUseSingleClick )
     {
         connect( tree,
-                 SIGNAL( itemClicked(QTreeWidgetItem*,int)),
+                 SIGNAL( clicked(QModelIndex)),
                  this,
-                 SLOT( onItemActivated( QTreeWidgetItem *, int ) ) );
+                 SLOT( onItemActivated( QModelIndex ) ) );
     }
     else
     {
         connect( tree,
-                 SIGNAL( itemActivated ( QTreeWidgetItem *, int ) ),
+                 SIGNAL( activated ( QModelIndex ) ),
                  this,
-                 SLOT( onItemActivated( QTreeWidgetItem *, int ) ) );
+                 SLOT( onItemActivated( QModelIndex ) ) );
     }
 
 	// Activate custom context menu, and connect it
@@ -146,7 +118,7 @@ TabSearch::TabSearch( QWidget * parent )
 
 void TabSearch::invalidate( )
 {
-	tree->clear();
+	m_model->clear();
 	searchBox->clear();
 	searchBox->lineEdit()->clear();
 	
@@ -165,21 +137,16 @@ void TabSearch::onReturnPressed( )
 	if ( text.isEmpty() )
 		return;
 	
-	tree->clear();
+	m_model->clear();
 	
 	if ( searchQuery( text, &results ) )
 	{
 		if ( !results.empty() )
 		{
-			for ( int i = 0; i < results.size(); i++ )
-			{
-				SearchTreeViewItem * item = new SearchTreeViewItem ( tree,
-																	 ::mainWindow->chmFile()->getTopicByUrl( results[i] ),
-																	 results[i] );
-
-				if ( i == 0 )
-					tree->setCurrentItem( item );
-			}
+			// The titles are looked up as the rows are shown
+			m_model->appendResults( results );
+			tree->setCurrentIndex( m_model->index( 0, 0 ) );
+			tree->scrollToTop();
 
 			::mainWindow->showInStatusBar( i18n( "Search returned %1 result(s)" ) . arg(results.size()) );
 			tree->setFocus();
@@ -192,13 +159,30 @@ void TabSearch::onReturnPressed( )
 }
 
 
-void TabSearch::onItemActivated( QTreeWidgetItem * item, int )
+void TabSearch::onItemActivated( const QModelIndex& index )
 {
-	if ( !item )
+	if ( !index.isValid() )
 		return;
 	
-	SearchTreeViewItem * treeitem = (SearchTreeViewItem *) item;
-	::mainWindow->currentBrowser()->openUrl( treeitem->getUrl() );
+	::mainWindow->currentBrowser()->openUrl( m_model->url( index ) );
+}
+
+
+void TabSearch::onHeaderClicked( int section )
+{
+	// The first click sorts ascending, the second one descending, and the third one restores the relevance order
+	if ( m_model->sortColumn() != section )
+		m_model->sort( section, Qt::AscendingOrder );
+	else if ( m_model->sortOrder() == Qt::AscendingOrder )
+		m_model->sort( section, Qt::DescendingOrder );
+	else
+		m_model->sort( -1 );
+
+	if ( m_model->sortColumn() != -1 )
+		tree->header()->setSortIndicator( m_model->sortColumn(), m_model->sortOrder() );
+
+	tree->header()->setSortIndicatorShown( m_model->sortColumn() != -1 );
+	tree->scrollTo( tree->currentIndex() );
 }
 
 
@@ -330,11 +314,11 @@ void TabSearch::focus()
 
 void TabSearch::onContextMenuRequested( const QPoint & point )
 {
-	SearchTreeViewItem * treeitem = (SearchTreeViewItem *) tree->itemAt( point );
+	QModelIndex index = tree->indexAt( point );
 	
-	if( treeitem )
+	if( index.isValid() )
 	{
-		::mainWindow->currentBrowser()->setTabKeeper( treeitem->getUrl() );
+		::mainWindow->currentBrowser()->setTabKeeper( m_model->url( index ) );
 		::mainWindow->tabItemsContextMenu()->popup( tree->viewport()->mapToGlobal( point ) );
 	}
 }
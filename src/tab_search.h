@@ -27,13 +27,14 @@
 
 template <typename T> class QList;
 class QMenu;
+class QModelIndex;
 class QPoint;
 class QProgressDialog;
 class QString;
-class QTreeWidgetItem;
 class QUrl;
 
 class EBookSearch;
+class TreeModel_Search;
 
 
 class TabSearch : public QWidget, public Ui::TabSearch
@@ -53,7 +54,8 @@ class TabSearch : public QWidget, public Ui::TabSearch
 		void	onContextMenuRequested ( const QPoint &point );
 		void	onHelpClicked( const QString & );
 		void 	onReturnPressed ();
-		void	onItemActivated( QTreeWidgetItem * item, int );
+		void	onItemActivated( const QModelIndex& index );
+		void	onHeaderClicked( int section );
 		
 		// For index generation
 		void	onProgressStep( int value, const QString& stepName );
@@ -63,6 +65,7 @@ class TabSearch : public QWidget, public Ui::TabSearch
 		
 	private:
 		QMenu			* 	m_contextMenu;
+		TreeModel_Search	*	m_model;
 		EBookSearch		*	m_searchEngine;
 		bool				m_searchEngineInitDone;
 		
@@ -0,0 +1,219 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>	// std::lower_bound, std::stable_sort
+
+#include <QBrush>
+#include <QChar>
+#include <QColor>
+#include <QHash>
+#include <QList>
+#include <QModelIndex>
+#include <QString>
+#include <QStringList>
+#include <Qt>		 // Qt::DisplayRole, Qt::ForegroundRole, Qt::ToolTipRole, Qt::WhatsThisRole
+					 // Qt::red, Qt::lightGray
+#include <QtGlobal>	 // qFatal, qPrintable, qWarning
+#include <QUrl>
+#include <QVariant>
+#include <QVector>
+
+#include "ebook.h"					  // EBook, EBookIndexEntry
+#include "dialog_chooseurlfromlist.h" // DialogChooseUrlFromList
+#include "mainwindow.h"				  // ::mainWindow
+#include "treemodel_index.h"		  // TreeModel_Index, QAbstractListModel
+
+
+// The number of spaces a sub-keyword is shifted by per indent level
+static const int INDENT_WIDTH = 4;
+
+TreeModel_Index::TreeModel_Index( QObject * parent )
+	: QAbstractListModel( parent )
+{
+}
+
+void TreeModel_Index::setIndex( const QList< EBookIndexEntry >& data )
+{
+	beginResetModel();
+
+	m_entries.clear();
+	m_keywords.clear();
+	m_keywordIndex.clear();
+
+	m_entries.resize( data.size() );
+
+	// Buggy CHMs may skip the indent levels; an entry is shown at most one level below the previous one
+	int maxindent = 0;
+	bool warning_shown = false;
+
+	for ( int i = 0; i < data.size(); i++ )
+	{
+		int indent = data[i].indent;
+
+		if ( indent > maxindent )
+		{
+			if ( i == 0 )
+				qFatal("Invalid fisrt TOC indent (first entry has no root entry), aborting.");
+
+			if ( !warning_shown )
+			{
+				qWarning("Invalid TOC step, applying workaround. Results may vary.");
+				warning_shown = true;
+			}
+
+			indent = maxindent;
+		}
+
+		Entry& entry = m_entries[i];
+		entry.name = data[i].name;
+		entry.urls = data[i].urls;
+		entry.seealso = data[i].seealso;
+		entry.indent = indent;
+
+		if ( indent == 0 )
+		{
+			Keyword keyword;
+			keyword.key = entry.name.toCaseFolded();
+			keyword.entry = i;
+
+			// The same keyword may be listed several times; the first one is found
+			if ( !m_keywordIndex.contains( keyword.key ) )
+				m_keywordIndex.insert( keyword.key, keyword.entry );
+
+			m_keywords.push_back( keyword );
+		}
+
+		maxindent = indent + 1;
+	}
+
+	// The index is usually sorted already, but not necessarily by our rules; the equal keywords keep the index order
+	std::stable_sort( m_keywords.begin(), m_keywords.end() );
+
+	endResetModel();
+}
+
+QUrl TreeModel_Index::url( const QModelIndex& index ) const
+{
+	if ( !index.isValid() )
+		return QUrl();
+
+	const QList<QUrl>& urls = m_entries[ index.row() ].urls;
+
+	if ( urls.isEmpty() )
+		return QUrl();
+
+	if ( urls.size() == 1 )
+		return urls.front();
+
+	// Create a dialog with URLs, and show it, so user can select an URL he/she wants.
+	QStringList titles;
+	EBook * xchm = ::mainWindow->chmFile();
+
+	for ( int i = 0; i < urls.size(); i++ )
+	{
+		QString title = xchm->getTopicByUrl( urls[i] );
+
+		if ( title.isEmpty() )
+		{
+			qWarning( "Could not get item name for url '%s'", qPrintable( urls[i].toString() ) );
+			titles.push_back(QString());
+		}
+		else
+			titles.push_back(title);
+	}
+
+	DialogChooseUrlFromList dlg( ::mainWindow );
+	return dlg.getSelectedItemUrl( urls, titles );
+}
+
+QString TreeModel_Index::seeAlso( const QModelIndex& index ) const
+{
+	if ( !index.isValid() )
+		return QString();
+
+	return m_entries[ index.row() ].seealso;
+}
+
+QModelIndex TreeModel_Index::findPrefix( const QString& text ) const
+{
+	// Everything starts with an empty string, so this is just the first keyword
+	if ( text.isEmpty() )
+		return index( 0, 0 );
+
+	Keyword keyword;
+	keyword.key = text.toCaseFolded();
+
+	// The keywords starting with the text follow the text itself in the sorted array
+	QVector< Keyword >::const_iterator it = std::lower_bound( m_keywords.begin(), m_keywords.end(), keyword );
+
+	if ( it == m_keywords.end() || !it->key.startsWith( keyword.key ) )
+		return QModelIndex();
+
+	return index( it->entry, 0 );
+}
+
+QModelIndex TreeModel_Index::findKeyword( const QString& text ) const
+{
+	QHash< QString, int >::const_iterator it = m_keywordIndex.find( text.toCaseFolded() );
+
+	if ( it == m_keywordIndex.end() )
+		return QModelIndex();
+
+	return index( it.value(), 0 );
+}
+
+int TreeModel_Index::rowCount( const QModelIndex& parent ) const
+{
+	if ( parent.isValid() )
+		return 0;
+
+	return m_entries.size();
+}
+
+QVariant TreeModel_Index::data( const QModelIndex& index, int role ) const
+{
+	if ( !index.isValid() || index.column() != 0 )
+		return QVariant();
+
+	const Entry& entry = m_entries[ index.row() ];
+
+	switch( role )
+	{
+		// Item name, indented under its keyword
+		case Qt::DisplayRole:
+			if ( entry.indent > 0 )
+				return QString( entry.indent * INDENT_WIDTH, QChar(' ') ) + entry.name;
+
+			return entry.name;
+
+		// Item foreground color
+		case Qt::ForegroundRole:
+			// For Index URL it means that there is URL list in m_url
+			if ( entry.urls.size() > 1 )
+				return QBrush( QColor( Qt::red ) );
+			else if ( !entry.seealso.isEmpty() )
+				return QBrush( QColor( Qt::lightGray ) );
+			break;
+
+		case Qt::ToolTipRole:
+		case Qt::WhatsThisRole:
+			return entry.name;
+	}
+
+	return QVariant();
+}
@@ -0,0 +1,92 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREEMODEL_INDEX_H
+#define TREEMODEL_INDEX_H
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QList>
+#include <QModelIndex>
+#include <QString>
+#include <QUrl>
+#include <QVariant>
+#include <QVector>
+
+class QObject;
+
+class EBookIndexEntry;
+
+
+//! Index model. The entries are flat rows in the index order, and the sub-keywords are shown
+//! indented under their keyword, so the view never has to expand (and lay out) the whole index.
+//! The top-level keywords are also kept case-folded and sorted, so the keyword typed by user
+//! is found by a binary search, and a 'see also' keyword by a hash lookup.
+class TreeModel_Index : public QAbstractListModel
+{
+	Q_OBJECT
+
+	public:
+		TreeModel_Index( QObject * parent = 0 );
+
+		//! Replaces the content; the entries are in the index order with their indentation
+		void		setIndex( const QList< EBookIndexEntry >& index );
+
+		//! Returns the entry URL; if there are several, asks user to choose one
+		QUrl		url( const QModelIndex& index ) const;
+
+		//! Returns the keyword the 'see also' entry refers to, or empty string for a regular entry
+		QString		seeAlso( const QModelIndex& index ) const;
+
+		//! Returns the first top-level keyword starting with text, case-insensitive
+		QModelIndex	findPrefix( const QString& text ) const;
+
+		//! Returns the top-level keyword equal to text, case-insensitive
+		QModelIndex	findKeyword( const QString& text ) const;
+
+		// Overridden methods
+		int			rowCount( const QModelIndex& parent = QModelIndex() ) const;
+		QVariant	data( const QModelIndex& index, int role ) const;
+
+	private:
+		class Entry
+		{
+			public:
+				QString		name;
+				QList<QUrl>	urls;
+				QString		seealso;
+				int			indent;
+		};
+
+		class Keyword
+		{
+			public:
+				QString	key;			// case-folded name
+				int		entry;			// row in m_entries
+
+				bool operator < ( const Keyword& other ) const { return key < other.key; }
+		};
+
+		QVector< Entry >	m_entries;
+
+		// The top-level keywords sorted by the case-folded name, and the first entry for each name
+		QVector< Keyword >		m_keywords;
+		QHash< QString, int >	m_keywordIndex;
+};
+
+#endif // TREEMODEL_INDEX_H
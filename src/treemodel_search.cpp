@@ -0,0 +1,225 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>	// std::sort
+
+#include <QList>
+#include <QModelIndex>
+#include <QModelIndexList>
+#include <QString>
+#include <Qt>		 // Qt::DisplayRole, Qt::ToolTipRole, Qt::WhatsThisRole, Qt::Horizontal
+#include <QtGlobal>	 // qMin
+#include <QUrl>
+#include <QVariant>
+#include <QVector>
+
+#include "i18n.h"
+
+#include "ebook.h"					  // EBook
+#include "mainwindow.h"				  // ::mainWindow
+#include "treemodel_search.h"		  // TreeModel_Search, QAbstractItemModel
+
+
+// Number of titles looked up at once; a bit more than a screenful of rows
+static const int TITLE_BATCH_SIZE = 64;
+
+
+TreeModel_Search::TreeModel_Search( QObject * parent )
+	: QAbstractItemModel( parent )
+{
+	m_sortColumn = -1;
+	m_sortOrder = Qt::AscendingOrder;
+}
+
+void TreeModel_Search::clear()
+{
+	beginResetModel();
+	m_results.clear();
+	endResetModel();
+}
+
+void TreeModel_Search::appendResults( const QList< QUrl >& urls )
+{
+	if ( urls.isEmpty() )
+		return;
+
+	int first = m_results.size();
+
+	beginInsertRows( QModelIndex(), first, first + urls.size() - 1 );
+	m_results.resize( first + urls.size() );
+
+	for ( int i = 0; i < urls.size(); i++ )
+	{
+		Result& result = m_results[ first + i ];
+		result.url = urls[i];
+		result.rank = first + i;
+		result.hasTitle = false;
+	}
+
+	endInsertRows();
+
+	// The new page goes to its place in the current order
+	if ( m_sortColumn != -1 )
+		sort( m_sortColumn, m_sortOrder );
+}
+
+QUrl TreeModel_Search::url( const QModelIndex& index ) const
+{
+	if ( !index.isValid() )
+		return QUrl();
+
+	return m_results[ index.row() ].url;
+}
+
+QModelIndex TreeModel_Search::index( int row, int column, const QModelIndex& parent ) const
+{
+	if ( parent.isValid() || column < 0 || column > 1 || row < 0 || row >= m_results.size() )
+		return QModelIndex();
+
+	return createIndex( row, column );
+}
+
+QModelIndex TreeModel_Search::parent( const QModelIndex& ) const
+{
+	return QModelIndex();
+}
+
+int TreeModel_Search::rowCount( const QModelIndex& parent ) const
+{
+	if ( parent.isValid() )
+		return 0;
+
+	return m_results.size();
+}
+
+int TreeModel_Search::columnCount( const QModelIndex& ) const
+{
+	return 2;
+}
+
+QVariant TreeModel_Search::data( const QModelIndex& index, int role ) const
+{
+	if ( !index.isValid() )
+		return QVariant();
+
+	switch( role )
+	{
+		// Item name
+		case Qt::DisplayRole:
+		case Qt::ToolTipRole:
+		case Qt::WhatsThisRole:
+			if ( index.column() == 1 )
+				return m_results[ index.row() ].url.path();
+
+			// The view only asks for the rows it shows
+			if ( !m_results[ index.row() ].hasTitle )
+				fetchTitles( index.row() );
+
+			return m_results[ index.row() ].title;
+	}
+
+	return QVariant();
+}
+
+QVariant TreeModel_Search::headerData( int section, Qt::Orientation orientation, int role ) const
+{
+	if ( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+		return QVariant();
+
+	if ( section == 0 )
+		return i18n( "Title" );
+	else if ( section == 1 )
+		return i18n( "Location" );
+
+	return QVariant();
+}
+
+void TreeModel_Search::sort( int column, Qt::SortOrder order )
+{
+	emit layoutAboutToBeChanged();
+
+	// Remember which results the selection and the current item point to
+	QModelIndexList oldindexes = persistentIndexList();
+	QVector< int > oldranks;
+
+	for ( int i = 0; i < oldindexes.size(); i++ )
+		oldranks.push_back( m_results[ oldindexes[i].row() ].rank );
+
+	// Sorting by title needs them all
+	if ( column == 0 )
+	{
+		for ( int row = 0; row < m_results.size(); row += TITLE_BATCH_SIZE )
+			fetchTitles( row );
+	}
+
+	// The results which compare equal keep the relevance order in both directions
+	bool descending = column != -1 && order == Qt::DescendingOrder;
+
+	std::sort( m_results.begin(), m_results.end(),
+			   [column, descending]( const Result& a, const Result& b )
+			   {
+				   int cmp = 0;
+
+				   if ( column == 0 )
+					   cmp = QString::localeAwareCompare( a.title, b.title );
+				   else if ( column == 1 )
+					   cmp = QString::compare( a.url.path(), b.url.path() );
+
+				   if ( cmp == 0 )
+					   return a.rank < b.rank;
+
+				   return descending ? cmp > 0 : cmp < 0;
+			   } );
+
+	m_sortColumn = column;
+	m_sortOrder = order;
+
+	// Move the persistent indexes to the new rows of their results
+	QVector< int > rankrows( m_results.size() );
+
+	for ( int row = 0; row < m_results.size(); row++ )
+		rankrows[ m_results[row].rank ] = row;
+
+	QModelIndexList newindexes;
+
+	for ( int i = 0; i < oldindexes.size(); i++ )
+		newindexes.push_back( createIndex( rankrows[ oldranks[i] ], oldindexes[i].column() ) );
+
+	changePersistentIndexList( oldindexes, newindexes );
+	emit layoutChanged();
+}
+
+void TreeModel_Search::fetchTitles( int row ) const
+{
+	EBook * ebook = ::mainWindow->chmFile();
+	int first = row - row % TITLE_BATCH_SIZE;
+	int last = qMin( first + TITLE_BATCH_SIZE, m_results.size() );
+
+	for ( int i = first; i < last; i++ )
+	{
+		Result& result = m_results[i];
+
+		if ( result.hasTitle )
+			continue;
+
+		if ( ebook )
+			result.title = ebook->getTopicByUrl( result.url );
+
+		result.hasTitle = true;
+	}
+}
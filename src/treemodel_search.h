@@ -0,0 +1,87 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREEMODEL_SEARCH_H
+#define TREEMODEL_SEARCH_H
+
+#include <QAbstractItemModel>
+#include <QList>
+#include <QModelIndex>
+#include <QString>
+#include <QUrl>
+#include <QVariant>
+#include <QVector>
+#include <Qt>		// Qt::SortOrder
+
+class QObject;
+
+
+//! Search results model. The results are kept in a flat array in the search engine order,
+//! which is the relevance order. The topic titles are only looked up for the rows which are
+//! shown, a batch at a time, so a long result list is shown at once.
+class TreeModel_Search : public QAbstractItemModel
+{
+	Q_OBJECT
+
+	public:
+		TreeModel_Search( QObject * parent = 0 );
+
+		//! Removes all the results; the sort order stays
+		void		clear();
+
+		//! Appends the next page of results, which are less relevant than those already there
+		void		appendResults( const QList< QUrl >& urls );
+
+		QUrl		url( const QModelIndex& index ) const;
+
+		//! The column the results are sorted by, or -1 for the relevance order
+		int				sortColumn() const { return m_sortColumn; }
+		Qt::SortOrder	sortOrder() const { return m_sortOrder; }
+
+		// Overridden methods
+		QModelIndex	index( int row, int column, const QModelIndex& parent = QModelIndex() ) const;
+		QModelIndex	parent( const QModelIndex& index ) const;
+		int			rowCount( const QModelIndex& parent = QModelIndex() ) const;
+		int			columnCount( const QModelIndex& parent = QModelIndex() ) const;
+		QVariant	data( const QModelIndex& index, int role ) const;
+		QVariant	headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const;
+
+		//! Sorts by title (column 0) or location (column 1); column -1 restores the relevance order
+		void		sort( int column, Qt::SortOrder order = Qt::AscendingOrder );
+
+	private:
+		class Result
+		{
+			public:
+				QUrl		url;
+				QString		title;
+				int			rank;			// position in the search engine order
+				bool		hasTitle;
+		};
+
+		//! Looks up the titles of the batch of rows which includes the row
+		void		fetchTitles( int row ) const;
+
+		// The titles are filled in on demand
+		mutable QVector< Result >	m_results;
+
+		int				m_sortColumn;
+		Qt::SortOrder	m_sortOrder;
+};
+
+#endif // TREEMODEL_SEARCH_H
@@ -0,0 +1,314 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>	// abort
+
+#include <QHash>
+#include <QList>
+#include <QModelIndex>
+#include <QPixmap>
+#include <QString>
+#include <Qt>		 // Qt::DecorationRole, Qt::DisplayRole, Qt::ToolTipRole, Qt::WhatsThisRole
+#include <QtGlobal>	 // qFatal, qWarning
+#include <QUrl>
+#include <QVariant>
+#include <QVector>
+
+#include "ebook.h"		   // EBookTocEntry
+#include "mainwindow.h"	   // ::mainWindow
+#include "treemodel_toc.h" // TreeModel_TOC, QAbstractItemModel
+
+
+TreeModel_TOC::TreeModel_TOC( QObject * parent )
+	: QAbstractItemModel( parent )
+{
+}
+
+void TreeModel_TOC::setTableOfContents( const QList< EBookTocEntry >& data )
+{
+	beginResetModel();
+
+	m_entries.clear();
+	m_children.clear();
+	m_urlIndex.clear();
+	m_pathIndex.clear();
+
+	m_entries.resize( data.size() + 1 );
+
+	Entry& root = m_entries[0];
+	root.parent = -1;
+	root.row = 0;
+	root.childCount = 0;
+	root.image = EBookTocEntry::IMAGE_NONE;
+	root.expanded = true;
+
+	// Find the parents; we use a pretty complex routine to handle buggy CHMs
+	QVector< int > rootentry;
+	bool warning_shown = false;
+
+	for ( int i = 0; i < data.size(); i++ )
+	{
+		int indent = data[i].indent;
+
+		// Do we need to add another indent?
+		if ( indent >= rootentry.size() )
+		{
+			int maxindent = rootentry.size() - 1;
+
+			// Resize the array
+			rootentry.resize( indent + 1 );
+
+			if ( indent > 0 && maxindent < 0 )
+				qFatal("Invalid fisrt TOC indent (first entry has no root entry), aborting.");
+
+			// And init the rest if needed
+			if ( (indent - maxindent) > 1 )
+			{
+				if ( !warning_shown )
+				{
+					qWarning("Invalid TOC step, applying workaround. Results may vary.");
+					warning_shown = true;
+				}
+
+				for ( int j = maxindent; j < indent; j++ )
+					rootentry[j+1] = rootentry[j];
+			}
+
+			rootentry[indent] = -1;
+		}
+
+		Entry& entry = m_entries[i+1];
+		entry.name = data[i].name;
+		entry.url = data[i].url;
+		entry.childCount = 0;
+		entry.image = data[i].iconid;
+		entry.expanded = false;
+
+		if ( indent == 0 )
+			entry.parent = 0;
+		else
+		{
+			// New non-root entry. It is possible (for some buggy CHMs) that there is no previous entry: previoous entry had indent 1,
+			// and next entry has indent 3. Backtracking it up, creating missing entries.
+			if ( rootentry[indent-1] < 0 )
+				qFatal("Child entry indented as %d with no root entry!", indent);
+
+			entry.parent = rootentry[indent-1];
+		}
+
+		m_entries[ entry.parent ].childCount++;
+		rootentry[indent] = i + 1;
+
+		// The same page may be listed several times; the first one is shown
+		if ( !m_urlIndex.contains( entry.url ) )
+			m_urlIndex.insert( entry.url, i + 1 );
+
+		QString path = pathKey( entry.url );
+
+		if ( !m_pathIndex.contains( path ) )
+			m_pathIndex.insert( path, i + 1 );
+	}
+
+	// Group the children by parent, keeping the TOC order
+	int offset = 0;
+
+	for ( int i = 0; i < m_entries.size(); i++ )
+	{
+		m_entries[i].firstChild = offset;
+		offset += m_entries[i].childCount;
+		m_entries[i].childCount = 0;
+	}
+
+	m_children.resize( offset );
+
+	for ( int i = 1; i < m_entries.size(); i++ )
+	{
+		Entry& parent = m_entries[ m_entries[i].parent ];
+
+		m_entries[i].row = parent.childCount;
+		m_children[ parent.firstChild + parent.childCount++ ] = i;
+	}
+
+	endResetModel();
+}
+
+QUrl TreeModel_TOC::url( const QModelIndex& index ) const
+{
+	if ( !index.isValid() )
+		return QUrl();
+
+	return m_entries[ index.internalId() ].url;
+}
+
+QModelIndex TreeModel_TOC::findUrl( const QUrl& url ) const
+{
+	// First we check for the fragment as well, so the URLs like ch05.htm#app1 and ch05.htm#app2
+	// could be handled as different TOC entries
+	QHash< QUrl, int >::const_iterator it = m_urlIndex.find( url );
+
+	if ( it != m_urlIndex.end() )
+		return indexOf( it.value() );
+
+	// Then we ignore the fragment, so if there is no ch05.htm#app1 but there is ch05.htm, we just use it
+	QHash< QString, int >::const_iterator pit = m_pathIndex.find( pathKey( url ) );
+
+	if ( pit != m_pathIndex.end() )
+		return indexOf( pit.value() );
+
+	return QModelIndex();
+}
+
+QModelIndex TreeModel_TOC::previous( const QModelIndex& index ) const
+{
+	if ( !index.isValid() )
+		return QModelIndex();
+
+	return indexOf( (int) index.internalId() - 1 );
+}
+
+QModelIndex TreeModel_TOC::next( const QModelIndex& index ) const
+{
+	if ( !index.isValid() )
+		return QModelIndex();
+
+	return indexOf( (int) index.internalId() + 1 );
+}
+
+void TreeModel_TOC::setExpanded( const QModelIndex& index, bool expanded )
+{
+	if ( !index.isValid() )
+		return;
+
+	m_entries[ index.internalId() ].expanded = expanded;
+	emit dataChanged( index, index );
+}
+
+void TreeModel_TOC::setAllExpanded( bool expanded )
+{
+	// The root stays expanded
+	for ( int i = 1; i < m_entries.size(); i++ )
+		m_entries[i].expanded = expanded;
+
+	// The view repaints all the visible rows for a range change
+	if ( !m_entries.isEmpty() && m_entries[0].childCount > 0 )
+		emit dataChanged( index( 0, 0 ), index( m_entries[0].childCount - 1, 0 ) );
+}
+
+QModelIndex TreeModel_TOC::index( int row, int column, const QModelIndex& parent ) const
+{
+	int entry = parent.isValid() ? (int) parent.internalId() : 0;
+
+	if ( column != 0 || row < 0 || entry >= m_entries.size() || row >= m_entries[entry].childCount )
+		return QModelIndex();
+
+	return createIndex( row, 0, (quintptr) m_children[ m_entries[entry].firstChild + row ] );
+}
+
+QModelIndex TreeModel_TOC::parent( const QModelIndex& index ) const
+{
+	if ( !index.isValid() )
+		return QModelIndex();
+
+	return indexOf( m_entries[ index.internalId() ].parent );
+}
+
+int TreeModel_TOC::rowCount( const QModelIndex& parent ) const
+{
+	if ( parent.column() > 0 )
+		return 0;
+
+	int entry = parent.isValid() ? (int) parent.internalId() : 0;
+
+	if ( entry >= m_entries.size() )
+		return 0;
+
+	return m_entries[entry].childCount;
+}
+
+int TreeModel_TOC::columnCount( const QModelIndex& ) const
+{
+	return 1;
+}
+
+QVariant TreeModel_TOC::data( const QModelIndex& index, int role ) const
+{
+	int imagenum;
+
+	if ( !index.isValid() || index.column() != 0 )
+		return QVariant();
+
+	const Entry& entry = m_entries[ index.internalId() ];
+
+	switch( role )
+	{
+		// Item name
+		case Qt::DisplayRole:
+			return entry.name;
+
+		// Item image
+		case Qt::DecorationRole:
+			if ( entry.image != EBookTocEntry::IMAGE_NONE )
+			{
+				// If the item has children, we change the book image to "open book", or next image automatically
+				if ( entry.childCount )
+				{
+					if ( entry.expanded )
+						imagenum = (entry.image == EBookTocEntry::IMAGE_AUTO) ? 1 : entry.image;
+					else
+						imagenum = (entry.image == EBookTocEntry::IMAGE_AUTO) ? 0 : entry.image + 1;
+				}
+				else
+					imagenum = (entry.image == EBookTocEntry::IMAGE_AUTO) ? 10 : entry.image;
+
+				const QPixmap *pix = ::mainWindow->getEBookIconPixmap( (EBookTocEntry::Icon) imagenum );
+
+				if ( !pix || pix->isNull() )
+					abort();
+
+				return *pix;
+			}
+			break;
+
+		case Qt::ToolTipRole:
+		case Qt::WhatsThisRole:
+			return entry.name;
+	}
+
+	return QVariant();
+}
+
+QString TreeModel_TOC::pathKey( const QUrl& url )
+{
+	// This appears to be a bug in Qt: the url.path() returns a proper path starting with /,
+	// but for some TOC URLs it returns a relative path starting with no / - so we make sure both are.
+	QString path = url.path();
+
+	if ( !path.startsWith( '/' ) )
+		path.prepend( '/' );
+
+	return path;
+}
+
+QModelIndex TreeModel_TOC::indexOf( int entry ) const
+{
+	// The root, or out of range
+	if ( entry <= 0 || entry >= m_entries.size() )
+		return QModelIndex();
+
+	return createIndex( m_entries[entry].row, 0, (quintptr) entry );
+}
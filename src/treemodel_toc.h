@@ -0,0 +1,103 @@
+/*
+ *  Kchmviewer - a CHM and EPUB file viewer with broad language support
+ *  Copyright (C) 2004-2014 George Yunaev, gyunaev@ulduzsoft.com
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TREEMODEL_TOC_H
+#define TREEMODEL_TOC_H
+
+#include <QAbstractItemModel>
+#include <QHash>
+#include <QList>
+#include <QModelIndex>
+#include <QString>
+#include <QUrl>
+#include <QVariant>
+#include <QVector>
+#include <QtGlobal>			// qint16
+
+class QObject;
+
+class EBookTocEntry;
+
+
+//! Table of contents model. The entries are kept in a flat array in the TOC order, each one
+//! referring to its parent by the array index, so filling the model creates no per-entry objects,
+//! and the view only asks for the rows it shows.
+class TreeModel_TOC : public QAbstractItemModel
+{
+	Q_OBJECT
+
+	public:
+		TreeModel_TOC( QObject * parent = 0 );
+
+		//! Replaces the content; the entries are in the TOC order with their indentation
+		void		setTableOfContents( const QList< EBookTocEntry >& toc );
+
+		//! Returns the entry URL
+		QUrl		url( const QModelIndex& index ) const;
+
+		//! Returns the entry for url; the entry with the same fragment is preferred
+		QModelIndex	findUrl( const QUrl& url ) const;
+
+		//! Returns the previous/next entry in the TOC order regardless of the tree structure
+		QModelIndex	previous( const QModelIndex& index ) const;
+		QModelIndex	next( const QModelIndex& index ) const;
+
+		//! The icon of a book entry shows whether it is expanded, which is known to the view only
+		void		setExpanded( const QModelIndex& index, bool expanded );
+
+		//! Same for all the entries at once, as QTreeView::expandAll() does not emit expanded()
+		void		setAllExpanded( bool expanded );
+
+		// Overridden methods
+		QModelIndex	index( int row, int column, const QModelIndex& parent = QModelIndex() ) const;
+		QModelIndex	parent( const QModelIndex& index ) const;
+		int			rowCount( const QModelIndex& parent = QModelIndex() ) const;
+		int			columnCount( const QModelIndex& parent = QModelIndex() ) const;
+		QVariant	data( const QModelIndex& index, int role ) const;
+
+	private:
+		class Entry
+		{
+			public:
+				QString	name;
+				QUrl	url;
+				int		parent;			// index in m_entries
+				int		row;			// in the parent
+				int		firstChild;		// index in m_children
+				int		childCount;
+				qint16	image;
+				bool	expanded;
+		};
+
+		QModelIndex	indexOf( int entry ) const;
+
+		// The path used to find the entry when the fragment does not match
+		static QString	pathKey( const QUrl& url );
+
+		// Entry 0 is the invisible root
+		QVector< Entry >	m_entries;
+
+		// Entry indexes of the children of all the entries, grouped by parent
+		QVector< int >		m_children;
+
+		// The first entry with the URL, and with the URL path
+		QHash< QUrl, int >		m_urlIndex;
+		QHash< QString, int >	m_pathIndex;
+};
+
+#endif // TREEMODEL_TOC_H
@@ -19,8 +19,10 @@
 #ifndef VIEWWINDOWMGR_H
 #define VIEWWINDOWMGR_H
 
+#include <QByteArray>
 #include <QList>
 #include <QString>
+#include <QTimer>
 #include <QWidget>
 
 #include "settings.h"
@@ -57,7 +59,8 @@ class ViewWindowMgr : public QWidget, public Ui::TabbedBrowser
 		// Creates a Window menu
 		void 	createMenu( MainWindow * parent, QMenu * menuWindow, QAction * actionCloseWindow );
 		
-		// Saves and restores current settings between sessions
+		// Saves and restores current settings between sessions. The restored tabs do not load
+		// their pages until they are activated.
 		void	restoreSettings( const Settings::viewindow_saved_settings_t& settings );
 		void	saveSettings( Settings::viewindow_saved_settings_t& settings );
 		
@@ -85,6 +88,9 @@ class ViewWindowMgr : public QWidget, public Ui::TabbedBrowser
 		void	updateCloseButtons();
 		void	activateWindow();
 		void	closeSearch();
+
+		// Destroys the browser windows of the tabs idle for too long, or above the loaded tabs limit
+		void	hibernateTabs();
 		
 		void	editTextEdited( const QString & text );
 	
@@ -93,11 +99,28 @@ class ViewWindowMgr : public QWidget, public Ui::TabbedBrowser
 		
 		typedef struct
 		{
-			QWidget			*	widget;
-            ViewWindow		*	window;
+			QWidget			*	widget;		// tab page holding the window
+            ViewWindow		*	window;		// not created until the restored tab is activated
 			QAction			*	action;
+			Settings::SavedViewWindow	page;	// opened in the window when it is created
+			QByteArray		history;	// navigation history of the hibernated window
+			qint64			lastActive;	// when the tab was current the last time, in ms since epoch
 		} TabData;
 		
+		// Adds a tab, with or without the browser window
+		TabData	*	addTab( const Settings::SavedViewWindow& page, bool set_active, bool create_window );
+
+		// Creates the browser window of the tab if it is not there yet
+		ViewWindow *	createWindow( TabData * tab );
+
+		void	setTabTitle( TabData * tab, const QString& text );
+
+		// Sets the topic titles of the restored tabs which have no window yet
+		void	updateRestoredTitles();
+
+		// Destroys the browser window of the background tab, keeping what is needed to recreate it
+		void	hibernate( TabData * tab );
+		
 		void	closeAllWindows();
 		void	closeWindow( QWidget * widget );		
 		TabData * findTab( QWidget * widget );
@@ -118,6 +141,14 @@ class ViewWindowMgr : public QWidget, public Ui::TabbedBrowser
         QString                 m_lastSearchedWord;
 
 		ViewWindowTabWidget	*	m_tabWidget;
+
+		// Tab hibernation
+		QTimer					m_hibernateTimer;
+		QWidget				*	m_lastCurrent;		// tab page which was current before the active one
+		int						m_hibernatedCount;	// total number of hibernated tabs
+
+		// The restored tabs show the file names until the first page is loaded
+		bool					m_restoredTitlesPending;
 };
 
 #endif /* INCLUDE_KCHMVIEWWINDOWMGR_H */